@@ -19,8 +19,22 @@ extern "C" {
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <dirent.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif // __SSE2__
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif // __AVX2__
 
 
 #define array_size(array) ((unsigned int)(sizeof(array) / sizeof(array[0])))
@@ -60,6 +74,58 @@ typedef struct file_t {
     size_t size;
 } file_t;
 
+typedef void (*job_function_t)(void* data);
+
+typedef struct job_t {
+    job_function_t function;
+    void* data;
+} job_t;
+
+// Threads start with the first push, the pool must not be moved after that
+typedef struct job_pool_t {
+    pthread_t* threads;
+    size_t threads_count;
+    job_t* jobs;
+    size_t jobs_capacity;
+    size_t jobs_first;
+    size_t jobs_count;
+    size_t jobs_pending;
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    size_t threads_started;
+    bool running;
+} job_pool_t;
+
+#define TLSF_SL_BITS 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_BITS)
+#define TLSF_FL_COUNT 32
+
+// A range of the allocator's space, blocks are linked in address order and, while free, into their size class list.
+// Links are indices into tlsf_t.blocks, -1 ends a list.
+typedef struct tlsf_block_t {
+    uint32_t offset;
+    uint32_t size;
+    int32_t prev_physical;
+    int32_t next_physical;
+    int32_t prev_free;
+    int32_t next_free;
+    bool free;
+} tlsf_block_t;
+
+// Two-level segregated fit allocator over [0, size) in caller defined units, it never touches the memory it manages.
+// Allocation and free are O(1): a first level per power of two, TLSF_SL_COUNT linear classes inside each.
+typedef struct tlsf_t {
+    uint32_t size;
+    tlsf_block_t* blocks;
+    int32_t blocks_count;
+    int32_t blocks_capacity;
+    int32_t unused;
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmaps[TLSF_FL_COUNT];
+    int32_t heads[TLSF_FL_COUNT][TLSF_SL_COUNT];
+} tlsf_t;
+
 
 void file_free(file_t* self) {
     if (self->data) {
@@ -116,8 +182,36 @@ const char* file_get_extension(const char* file_name) {
     return dot + 1;
 }
 
+bool file_save(const char* file_name, const void* data, size_t size) {
+    bool result = false;
+    FILE* stream = fopen(file_name, "wb");
+
+    if (stream) {
+        result = fwrite(data, size, 1, stream) == 1;
+
+        if (fclose(stream)) {
+            printf("%s is not closed\n", file_name);
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+uint64_t hash_fnv1a(const void* data, size_t size, uint64_t hash) {
+    const uint8_t* bytes = (const uint8_t*)data;
+
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
 bool file_check_extension(const char* file_name, const char* extension) {
-    return strcmp(file_get_extension(file_name), extension) == 0;
+    const char* file_extension = file_get_extension(file_name);
+
+    return file_extension && strcmp(file_extension, extension) == 0;
 }
 
 
@@ -229,11 +323,527 @@ void directory_free(directory_t* self) {
 }
 
 
+bool job_pool_pop(job_pool_t* self, job_t* job) {
+    if (!self->jobs_count) {
+        return false;
+    }
+
+    *job = self->jobs[self->jobs_first];
+    self->jobs_first = (self->jobs_first + 1) % self->jobs_capacity;
+    --self->jobs_count;
+
+    return true;
+}
+
+void job_pool_finish(job_pool_t* self) {
+    if (!--self->jobs_pending) {
+        pthread_cond_broadcast(&self->done);
+    }
+}
+
+// 0 on threads outside of a pool, 1 to threads_count on the threads of job_thread_pool
+_Thread_local size_t job_thread_index = 0;
+_Thread_local const job_pool_t* job_thread_pool = NULL;
+_Thread_local uint32_t job_thread_id = 0;
+atomic_uint job_threads_spawned = 0;
+
+// Lets jobs of pool pick per-thread data without locking, the thread calling job_pool_wait runs jobs as index 0.
+// SIZE_MAX on threads of any other pool.
+size_t job_thread_get_index(const job_pool_t* pool) {
+    if (job_thread_pool && job_thread_pool != pool) {
+        return SIZE_MAX;
+    }
+
+    return job_thread_index;
+}
+
+// Unique among the threads of all pools, 0 outside of them
+uint32_t job_thread_get_id() {
+    return job_thread_id;
+}
+
+void* job_pool_thread(void* data) {
+    job_pool_t* self = (job_pool_t*)data;
+    job_t job;
+
+    pthread_mutex_lock(&self->mutex);
+
+    job_thread_index = ++self->threads_started;
+    job_thread_pool = self;
+    job_thread_id = atomic_fetch_add(&job_threads_spawned, 1) + 1;
+
+    while (true) {
+        while (self->running && !self->jobs_count) {
+            pthread_cond_wait(&self->work, &self->mutex);
+        }
+
+        if (!job_pool_pop(self, &job)) {
+            break;
+        }
+
+        pthread_mutex_unlock(&self->mutex);
+        job.function(job.data);
+        pthread_mutex_lock(&self->mutex);
+
+        job_pool_finish(self);
+    }
+
+    pthread_mutex_unlock(&self->mutex);
+
+    return NULL;
+}
+
+// threads_count 0 - one thread per core except the calling one
+job_pool_t job_pool_create(size_t threads_count) {
+    job_pool_t result = {
+        .threads = NULL,
+        .threads_count = threads_count,
+        .jobs = NULL,
+        .jobs_capacity = 0,
+        .jobs_first = 0,
+        .jobs_count = 0,
+        .jobs_pending = 0,
+        .threads_started = 0,
+        .running = false
+    };
+
+    if (!threads_count) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+        result.threads_count = cores > 1 ? (size_t)cores - 1 : 1;
+    }
+
+    return result;
+}
+
+bool job_pool_start(job_pool_t* self) {
+    if (self->running) {
+        return true;
+    }
+
+    self->threads = (pthread_t*)calloc(self->threads_count, sizeof(pthread_t));
+
+    if (!self->threads) {
+        return false;
+    }
+
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->work, NULL);
+    pthread_cond_init(&self->done, NULL);
+
+    self->running = true;
+
+    for (size_t i = 0; i < self->threads_count; ++i) {
+        if (pthread_create(&self->threads[i], NULL, job_pool_thread, self)) {
+            puts("Failed to pthread_create()");
+            self->threads_count = i;
+            break;
+        }
+    }
+
+    return true;
+}
+
+void job_pool_push(job_pool_t* self, job_function_t function, void* data) {
+    if (!job_pool_start(self)) {
+        function(data);
+        return;
+    }
+
+    pthread_mutex_lock(&self->mutex);
+
+    if (self->jobs_count == self->jobs_capacity) {
+        size_t capacity = self->jobs_capacity ? self->jobs_capacity * 2 : 64;
+        job_t* jobs = (job_t*)calloc(capacity, sizeof(job_t));
+
+        if (!jobs) {
+            pthread_mutex_unlock(&self->mutex);
+            function(data);
+            return;
+        }
+
+        for (size_t i = 0; i < self->jobs_count; ++i) {
+            jobs[i] = self->jobs[(self->jobs_first + i) % self->jobs_capacity];
+        }
+
+        free(self->jobs);
+
+        self->jobs = jobs;
+        self->jobs_capacity = capacity;
+        self->jobs_first = 0;
+    }
+
+    self->jobs[(self->jobs_first + self->jobs_count) % self->jobs_capacity] = (job_t) {
+        .function = function,
+        .data = data
+    };
+    ++self->jobs_count;
+    ++self->jobs_pending;
+
+    pthread_cond_signal(&self->work);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+// The calling thread runs queued jobs too while it waits
+void job_pool_wait(job_pool_t* self) {
+    job_t job;
+
+    if (!self->running) {
+        return;
+    }
+
+    pthread_mutex_lock(&self->mutex);
+
+    while (self->jobs_pending) {
+        if (job_pool_pop(self, &job)) {
+            pthread_mutex_unlock(&self->mutex);
+            job.function(job.data);
+            pthread_mutex_lock(&self->mutex);
+
+            job_pool_finish(self);
+        }
+        else {
+            pthread_cond_wait(&self->done, &self->mutex);
+        }
+    }
+
+    pthread_mutex_unlock(&self->mutex);
+}
+
+void job_pool_destroy(job_pool_t* self) {
+    if (self->running) {
+        job_pool_wait(self);
+
+        pthread_mutex_lock(&self->mutex);
+        self->running = false;
+        pthread_cond_broadcast(&self->work);
+        pthread_mutex_unlock(&self->mutex);
+
+        for (size_t i = 0; i < self->threads_count; ++i) {
+            pthread_join(self->threads[i], NULL);
+        }
+
+        pthread_cond_destroy(&self->done);
+        pthread_cond_destroy(&self->work);
+        pthread_mutex_destroy(&self->mutex);
+    }
+
+    if (self->threads) {
+        free(self->threads);
+        self->threads = NULL;
+    }
+
+    if (self->jobs) {
+        free(self->jobs);
+        self->jobs = NULL;
+    }
+
+    self->jobs_capacity = 0;
+    self->jobs_first = 0;
+    self->jobs_count = 0;
+    self->jobs_pending = 0;
+    self->threads_started = 0;
+}
+
+
+void tlsf_mapping(uint32_t size, uint32_t* fl, uint32_t* sl) {
+    if (size < TLSF_SL_COUNT) {
+        *fl = 0;
+        *sl = size;
+    }
+    else {
+        uint32_t log2 = 31u - (uint32_t)__builtin_clz(size);
+
+        *fl = log2 - TLSF_SL_BITS + 1;
+        *sl = (size >> (log2 - TLSF_SL_BITS)) ^ TLSF_SL_COUNT;
+    }
+}
+
+void tlsf_insert(tlsf_t* self, int32_t block) {
+    uint32_t fl, sl;
+    tlsf_block_t* current = &self->blocks[block];
+
+    tlsf_mapping(current->size, &fl, &sl);
+
+    current->free = true;
+    current->prev_free = -1;
+    current->next_free = self->heads[fl][sl];
+
+    if (current->next_free >= 0) {
+        self->blocks[current->next_free].prev_free = block;
+    }
+
+    self->heads[fl][sl] = block;
+    self->fl_bitmap |= 1u << fl;
+    self->sl_bitmaps[fl] |= 1u << sl;
+}
+
+void tlsf_remove(tlsf_t* self, int32_t block) {
+    uint32_t fl, sl;
+    tlsf_block_t* current = &self->blocks[block];
+
+    tlsf_mapping(current->size, &fl, &sl);
+
+    if (current->prev_free >= 0) {
+        self->blocks[current->prev_free].next_free = current->next_free;
+    }
+    else {
+        self->heads[fl][sl] = current->next_free;
+    }
+
+    if (current->next_free >= 0) {
+        self->blocks[current->next_free].prev_free = current->prev_free;
+    }
+
+    if (self->heads[fl][sl] < 0) {
+        self->sl_bitmaps[fl] &= ~(1u << sl);
+
+        if (!self->sl_bitmaps[fl]) {
+            self->fl_bitmap &= ~(1u << fl);
+        }
+    }
+
+    current->free = false;
+}
+
+// Block records are recycled through a stack threaded over next_free
+int32_t tlsf_new_block(tlsf_t* self) {
+    int32_t result = self->unused;
+
+    if (result >= 0) {
+        self->unused = self->blocks[result].next_free;
+        return result;
+    }
+
+    if (self->blocks_count == self->blocks_capacity) {
+        int32_t capacity = self->blocks_capacity ? self->blocks_capacity * 2 : 64;
+        tlsf_block_t* blocks = (tlsf_block_t*)realloc(self->blocks, (size_t)capacity * sizeof(tlsf_block_t));
+
+        if (!blocks) {
+            return -1;
+        }
+
+        self->blocks = blocks;
+        self->blocks_capacity = capacity;
+    }
+
+    return self->blocks_count++;
+}
+
+void tlsf_delete_block(tlsf_t* self, int32_t block) {
+    self->blocks[block].next_free = self->unused;
+    self->unused = block;
+}
+
+tlsf_t tlsf_create(uint32_t size) {
+    tlsf_t result = {
+        .size = size,
+        .blocks = NULL,
+        .blocks_count = 0,
+        .blocks_capacity = 0,
+        .unused = -1,
+        .fl_bitmap = 0,
+        .sl_bitmaps = { 0 }
+    };
+
+    memset(result.heads, 0xFF, sizeof(result.heads));
+
+    int32_t block = size ? tlsf_new_block(&result) : -1;
+
+    if (block < 0) {
+        result.size = 0;
+        return result;
+    }
+
+    result.blocks[block] = (tlsf_block_t) {
+        .offset = 0,
+        .size = size,
+        .prev_physical = -1,
+        .next_physical = -1
+    };
+    tlsf_insert(&result, block);
+
+    return result;
+}
+
+// Returns the block for tlsf_free and its start in offset, -1 when no free range is large enough
+int32_t tlsf_allocate(tlsf_t* self, uint32_t size, uint32_t* offset) {
+    uint32_t fl, sl;
+    uint32_t rounded = size;
+
+    if (!size || size > self->size) {
+        return -1;
+    }
+
+    // Rounding up to the next class start makes any block of the found class fit without walking its list
+    if (size >= TLSF_SL_COUNT) {
+        uint32_t round = (1u << (31u - (uint32_t)__builtin_clz(size) - TLSF_SL_BITS)) - 1;
+
+        rounded = size > UINT32_MAX - round ? size : size + round;
+    }
+
+    tlsf_mapping(rounded, &fl, &sl);
+
+    uint32_t sl_map = self->sl_bitmaps[fl] & (~0u << sl);
+
+    if (!sl_map) {
+        uint32_t fl_map = fl + 1 < TLSF_FL_COUNT ? self->fl_bitmap & (~0u << (fl + 1)) : 0;
+
+        if (!fl_map) {
+            return -1;
+        }
+
+        fl = (uint32_t)__builtin_ctz(fl_map);
+        sl_map = self->sl_bitmaps[fl];
+    }
+
+    sl = (uint32_t)__builtin_ctz(sl_map);
+
+    int32_t block = self->heads[fl][sl];
+
+    tlsf_remove(self, block);
+
+    if (self->blocks[block].size > size) {
+        int32_t rest = tlsf_new_block(self);
+
+        if (rest >= 0) {
+            tlsf_block_t* current = &self->blocks[block];
+
+            self->blocks[rest] = (tlsf_block_t) {
+                .offset = current->offset + size,
+                .size = current->size - size,
+                .prev_physical = block,
+                .next_physical = current->next_physical
+            };
+
+            if (current->next_physical >= 0) {
+                self->blocks[current->next_physical].prev_physical = rest;
+            }
+
+            current->next_physical = rest;
+            current->size = size;
+            tlsf_insert(self, rest);
+        }
+    }
+
+    *offset = self->blocks[block].offset;
+
+    return block;
+}
+
+// Merges the block with free neighbours, block may be -1
+void tlsf_free(tlsf_t* self, int32_t block) {
+    if (block < 0) {
+        return;
+    }
+
+    int32_t prev = self->blocks[block].prev_physical;
+    int32_t next = self->blocks[block].next_physical;
+
+    if (prev >= 0 && self->blocks[prev].free) {
+        tlsf_remove(self, prev);
+        self->blocks[prev].size += self->blocks[block].size;
+        self->blocks[prev].next_physical = next;
+
+        if (next >= 0) {
+            self->blocks[next].prev_physical = prev;
+        }
+
+        tlsf_delete_block(self, block);
+        block = prev;
+    }
+
+    if (next >= 0 && self->blocks[next].free) {
+        tlsf_remove(self, next);
+        self->blocks[block].size += self->blocks[next].size;
+        self->blocks[block].next_physical = self->blocks[next].next_physical;
+
+        if (self->blocks[block].next_physical >= 0) {
+            self->blocks[self->blocks[block].next_physical].prev_physical = block;
+        }
+
+        tlsf_delete_block(self, next);
+    }
+
+    tlsf_insert(self, block);
+}
+
+void tlsf_destroy(tlsf_t* self) {
+    if (self->blocks) {
+        free(self->blocks);
+        self->blocks = NULL;
+    }
+
+    self->size = 0;
+    self->blocks_count = 0;
+    self->blocks_capacity = 0;
+    self->unused = -1;
+    self->fl_bitmap = 0;
+}
+
+
+// Sorts keys ascending and moves values along, LSD radix over bytes. Passes where every key has the same byte are skipped.
+// The temporary arrays need count elements, the result always ends up in keys and values.
+void radix_sort(uint64_t* keys, uint32_t* values, uint64_t* keys_temporary, uint32_t* values_temporary, size_t count) {
+    size_t histograms[8][256] = { { 0 } };
+    uint64_t* source_keys = keys;
+    uint32_t* source_values = values;
+    uint64_t* destination_keys = keys_temporary;
+    uint32_t* destination_values = values_temporary;
+
+    // Every histogram in one read of the keys
+    for (size_t i = 0; i < count; ++i) {
+        for (int pass = 0; pass < 8; ++pass) {
+            histograms[pass][(keys[i] >> (pass * 8)) & 0xFF] += 1;
+        }
+    }
+
+    for (int pass = 0; pass < 8; ++pass) {
+        size_t* histogram = histograms[pass];
+        size_t offset = 0;
+
+        if (count && histogram[(keys[0] >> (pass * 8)) & 0xFF] == count) {
+            continue;
+        }
+
+        for (int i = 0; i < 256; ++i) {
+            size_t bucket = histogram[i];
+
+            histogram[i] = offset;
+            offset += bucket;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            size_t position = histogram[(source_keys[i] >> (pass * 8)) & 0xFF]++;
+
+            destination_keys[position] = source_keys[i];
+            destination_values[position] = source_values[i];
+        }
+
+        uint64_t* swap_keys = source_keys;
+        uint32_t* swap_values = source_values;
+
+        source_keys = destination_keys;
+        source_values = destination_values;
+        destination_keys = swap_keys;
+        destination_values = swap_values;
+    }
+
+    if (source_keys != keys) {
+        memcpy(keys, source_keys, count * sizeof(uint64_t));
+        memcpy(values, source_values, count * sizeof(uint32_t));
+    }
+}
+
+
 #include <cglm/cglm.h>     // Math
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h> // Image loader
 
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb/stb_image_write.h> // Image writer
+
 #define CGLTF_IMPLEMENTATION
 #include <cgltf/cgltf.h>   // 2D/3D models, materials, scenes, etc...
 
@@ -248,6 +858,20 @@ void directory_free(directory_t* self) {
 #define to_pixels(image_size, window_size) ((1.0f / (float)window_size) * (float)image_size)
 #define to_percent(image_size, window_size) ((float)image_size / (float)window_size)
 
+// GL_KHR_parallel_shader_compile, not every glad profile exports it
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif // GL_COMPLETION_STATUS_KHR
+
+typedef void (GLAPIENTRY* gl_max_shader_compiler_threads_t)(GLuint count);
+
+// GL_ARB_gl_spirv / OpenGL 4.6
+#ifndef GL_SHADER_BINARY_FORMAT_SPIR_V_ARB
+#define GL_SHADER_BINARY_FORMAT_SPIR_V_ARB 0x9551
+#endif // GL_SHADER_BINARY_FORMAT_SPIR_V_ARB
+
+typedef void (GLAPIENTRY* gl_specialize_shader_t)(GLuint shader, const GLchar* entry_point, GLuint constants_count, const GLuint* constant_indices, const GLuint* constant_values);
+
 
 typedef enum shader_type {
     SHADER_TYPE_VERTEX,
@@ -255,6 +879,43 @@ typedef enum shader_type {
     SHADER_TYPE_FRAGMENT
 } shader_type;
 
+typedef enum vertex_attribute_type {
+    VERTEX_ATTRIBUTE_TYPE_POSITION,
+    VERTEX_ATTRIBUTE_TYPE_NORMAL,
+    VERTEX_ATTRIBUTE_TYPE_TEX_COORD,
+    VERTEX_ATTRIBUTE_TYPE_COLOR,
+    VERTEX_ATTRIBUTE_TYPE_TANGENT,
+    VERTEX_ATTRIBUTE_TYPE_JOINTS,
+    VERTEX_ATTRIBUTE_TYPE_WEIGHTS,
+    VERTEX_ATTRIBUTE_TYPE_COUNT
+} vertex_attribute_type;
+
+typedef enum vertex_format {
+    VERTEX_FORMAT_NONE,
+    VERTEX_FORMAT_FLOAT_2,
+    VERTEX_FORMAT_FLOAT_3,
+    VERTEX_FORMAT_FLOAT_4,
+    VERTEX_FORMAT_HALF_2,
+    VERTEX_FORMAT_HALF_4,
+    VERTEX_FORMAT_SNORM_10_10_10_2,
+    VERTEX_FORMAT_UNORM_8_4,
+    VERTEX_FORMAT_UNORM_16_4,
+    VERTEX_FORMAT_UINT_16_4
+} vertex_format;
+
+typedef enum shader_compiler_mode {
+    SHADER_COMPILER_MODE_SYNCHRONOUS,
+    SHADER_COMPILER_MODE_PARALLEL,
+    SHADER_COMPILER_MODE_THREADED
+} shader_compiler_mode;
+
+typedef enum program_status {
+    PROGRAM_STATUS_NONE,
+    PROGRAM_STATUS_COMPILING,
+    PROGRAM_STATUS_READY,
+    PROGRAM_STATUS_FAILED
+} program_status;
+
 
 typedef struct texture_t {
     GLuint id;
@@ -272,22 +933,269 @@ typedef struct shader_t {
     GLuint id;
 } shader_t;
 
+// SPIR-V specialization constants, the GLSL fallback receives them as "#define CONSTANT_ID_<index> <value>"
+typedef struct shader_specialization_t {
+    const char* entry_point;
+    GLuint constants_count;
+    const GLuint* constant_indices;
+    const GLuint* constant_values;
+} shader_specialization_t;
+
 typedef struct program_t {
     GLuint id;
 } program_t;
 
+typedef struct shader_compiler_t shader_compiler_t;
+
+typedef struct shader_compiler_task_t {
+    shader_compiler_t* compiler;
+    char* file_names[3];
+    shader_t shaders[3];
+    program_t program;
+    atomic_int status;
+    bool claimed;
+} shader_compiler_task_t;
+
+struct shader_compiler_t {
+    shader_compiler_mode mode;
+    shader_compiler_task_t** tasks;
+    size_t tasks_count;
+    size_t tasks_capacity;
+    size_t tasks_next;
+    GLFWwindow* context;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    bool running;
+};
+
+// Attribute locations are the vertex_attribute_type values, all attributes share one interleaved buffer
+typedef struct vertex_layout_t {
+    vertex_format formats[VERTEX_ATTRIBUTE_TYPE_COUNT];
+    GLuint offsets[VERTEX_ATTRIBUTE_TYPE_COUNT];
+    GLuint stride;
+} vertex_layout_t;
+
+// One glTF primitive inside the shared vertex/index buffers, material is an index into the file's materials or -1
+typedef struct submesh_t {
+    GLint base_vertex;
+    GLuint first_index;
+    GLsizei indices_count;
+    GLint material;
+} submesh_t;
+
+// Load-time processing for mesh_create_ex, the default (NULL) loads the file as is
+// lods_count - number of simplified levels after the full detail one, each halves the triangle count
+// meshlets - split the full detail level into meshlets for mesh_cull_meshlets
+// short_indices - split primitives with more than 65536 vertices so the whole mesh uses 16-bit indices
+typedef struct mesh_options_t {
+    bool optimize;
+    job_pool_t* job_pool;
+    const char* cache_directory;
+    GLsizei lods_count;
+    bool meshlets;
+    bool short_indices;
+} mesh_options_t;
+
+// A simplified copy of every submesh in the same index buffer, error is in object space units
+typedef struct mesh_lod_t {
+    submesh_t* submeshes;
+    float error;
+} mesh_lod_t;
+
+// A run of triangles in the full detail index buffer, drawn or culled as a whole.
+// Back-facing when dot(center - eye, cone_axis) >= cone_cutoff * |center - eye| + radius, a cone_cutoff of 1 never is.
+typedef struct meshlet_t {
+    vec3 center;
+    float radius;
+    vec3 cone_axis;
+    float cone_cutoff;
+    GLuint first_index;
+    GLsizei indices_count;
+    GLint base_vertex;
+} meshlet_t;
+
+// meshlet_ranges is the output of mesh_cull_meshlets, one entry per meshlet.
+// bounds is the object space box (min, max) of the positions, in the bind pose for skinned meshes.
 typedef struct mesh_t {
     GLuint id;
+    GLuint vertex_buffer;
+    GLuint index_buffer;
+    vertex_layout_t layout;
+    vec3 bounds[2];
     GLsizei indices_count;
+    GLenum index_type;
+    submesh_t* submeshes;
+    GLsizei submeshes_count;
+    mesh_lod_t* lods;
+    GLsizei lods_count;
+    meshlet_t* meshlets;
+    submesh_t* meshlet_ranges;
+    GLsizei meshlets_count;
 } mesh_t;
 
+#define RING_BUFFER_REGIONS 3
+
+// A persistently and coherently mapped buffer split into RING_BUFFER_REGIONS regions filled in turn by bump allocation.
+// Leaving a region fences it and entering one waits for its fence, so the CPU never writes what the GPU still reads
+// and the driver neither copies nor synchronizes. Offsets are from the start of buffer.
+typedef struct ring_buffer_t {
+    GLuint buffer;
+    uint8_t* data;
+    GLsizeiptr region_size;
+    GLsync fences[RING_BUFFER_REGIONS];
+    GLsizei region;
+    GLsizeiptr offset;
+    GLsizeiptr storage_alignment;
+} ring_buffer_t;
+
+// Layout of GL_DRAW_INDIRECT_BUFFER entries for glMultiDrawElementsIndirect
+typedef struct draw_elements_indirect_command_t {
+    GLuint count;
+    GLuint instance_count;
+    GLuint first_index;
+    GLint base_vertex;
+    GLuint base_instance;
+} draw_elements_indirect_command_t;
+
+// Meshes sharing one vertex layout and index type in fixed size buffers behind a single vertex array.
+// Vertices and indices are sub-allocated in units of vertices and indices, so base_vertex needs no alignment.
+// Queued draws go out in one glMultiDrawElementsIndirect, base_instance is the draw's index in matrices.
+typedef struct geometry_pool_t {
+    GLuint id;
+    GLuint vertex_buffer;
+    GLuint index_buffer;
+    vertex_layout_t layout;
+    GLenum index_type;
+    tlsf_t vertices;
+    tlsf_t indices;
+    draw_elements_indirect_command_t* commands;
+    mat4* matrices;
+    GLsizei draws_count;
+    GLsizei draws_capacity;
+    ring_buffer_t stream;
+    GLuint draw_id_buffer;
+    GLsizei buffers_capacity;
+} geometry_pool_t;
+
+// A mesh inside a geometry_pool_t, submeshes and lods already point at its place in the pool's buffers
+typedef struct geometry_t {
+    int32_t vertices_block;
+    int32_t indices_block;
+    submesh_t* submeshes;
+    GLsizei submeshes_count;
+    mesh_lod_t* lods;
+    GLsizei lods_count;
+} geometry_t;
+
+typedef enum animation_path {
+    ANIMATION_PATH_TRANSLATION,
+    ANIMATION_PATH_ROTATION,
+    ANIMATION_PATH_SCALE
+} animation_path;
+
+// Keys of one joint property, values holds 3 floats per key, 4 (xyzw) for rotations.
+// Cubic spline keys keep their values only and are interpolated linearly.
+typedef struct animation_channel_t {
+    GLsizei joint;
+    animation_path path;
+    bool step;
+    size_t keys_count;
+    float* times;
+    float* values;
+} animation_channel_t;
+
+typedef struct animation_t {
+    char* name;
+    animation_channel_t* channels;
+    size_t channels_count;
+    float duration;
+} animation_t;
+
+// Joints keep the order of the glTF skin, which JOINTS_0 indexes, order lists them parents first.
+// Root joints (parent -1) start from root_matrices, the world transform of the nodes above the skin.
+typedef struct skeleton_t {
+    GLsizei joints_count;
+    GLint* parents;
+    GLsizei* order;
+    mat4* inverse_bind_matrices;
+    mat4* root_matrices;
+    vec3* translations;
+    versor* rotations;
+    vec3* scales;
+    animation_t* animations;
+    size_t animations_count;
+} skeleton_t;
+
+// animation is -1 for the rest pose, palette_offset is the first joint matrix of the instance in the animator's palette
+typedef struct animator_instance_t {
+    const skeleton_t* skeleton;
+    GLsizei animation;
+    float time;
+    GLsizei palette_offset;
+} animator_instance_t;
+
+typedef struct animator_t animator_t;
+
+// Scratch memory of one batch of instances, kept between updates
+typedef struct animator_job_t {
+    animator_t* animator;
+    size_t first_instance;
+    size_t instances_count;
+    vec3* translations;
+    versor* rotations;
+    vec3* scales;
+    mat4* globals;
+    size_t joints_capacity;
+    versor* slerp_from;
+    versor* slerp_to;
+    float* slerp_factors;
+    versor* slerp_results;
+    float** slerp_targets;
+    size_t slerps_capacity;
+} animator_job_t;
+
+// Joint matrices of every instance end up in one shader storage buffer, bound with animator_bind
+struct animator_t {
+    job_pool_t* job_pool;
+    animator_instance_t* instances;
+    size_t instances_count;
+    size_t instances_capacity;
+    mat4* palette;
+    GLsizei palette_count;
+    GLsizei palette_capacity;
+    animator_job_t* jobs;
+    size_t jobs_count;
+    ring_buffer_t stream;
+    GLintptr palette_offset;
+};
+
+// One element of the instance_data block of shader.vs (std430), drawn by object_draw_instanced
+typedef struct instance_t {
+    mat4 matrix;
+    vec4 color;
+} instance_t;
+
+// CPU copy of the instances, uploaded to a shader storage buffer on the next draw after a change
+typedef struct instance_buffer_t {
+    instance_t* instances;
+    GLsizei instances_count;
+    GLsizei instances_capacity;
+    GLuint buffer;
+    GLsizei buffer_capacity;
+    bool dirty;
+} instance_buffer_t;
+
 typedef struct object_t {
     vec3 position;
     vec3 rotation;
     vec3 scale;
     mat4 matrix;
     program_t program;
+    shader_compiler_task_t* task;
     mesh_t mesh;
+    GLint joints_offset;
     texture_t* textures;
     int textures_count;
 } object_t;
@@ -299,8 +1207,317 @@ typedef struct camera_t {
     vec3 rotation;
     vec3 direction;
     vec3 center;
+    float viewport_height;
+    float lod_threshold;
 } camera_t;
 
+// Keys camera_simulate reacts to, sampled on the main thread since GLFW input is not thread safe
+typedef enum camera_input {
+    CAMERA_INPUT_FAST     = 1 << 0,
+    CAMERA_INPUT_LEFT     = 1 << 1,
+    CAMERA_INPUT_RIGHT    = 1 << 2,
+    CAMERA_INPUT_UP       = 1 << 3,
+    CAMERA_INPUT_DOWN     = 1 << 4,
+    CAMERA_INPUT_STRAFE_L = 1 << 5,
+    CAMERA_INPUT_STRAFE_R = 1 << 6,
+    CAMERA_INPUT_LOWER    = 1 << 7,
+    CAMERA_INPUT_RAISE    = 1 << 8,
+    CAMERA_INPUT_FORWARD  = 1 << 9,
+    CAMERA_INPUT_BACKWARD = 1 << 10,
+    CAMERA_INPUT_RESET    = 1 << 11,
+    CAMERA_INPUT_2D       = 1 << 12,
+    CAMERA_INPUT_3D       = 1 << 13
+} camera_input;
+
+#define ECS_MAX_COMPONENTS 64
+#define ECS_CHUNK_SIZE 16384
+#define ECS_COLUMN_ALIGNMENT 16
+
+// Index in the low 32 bits, generation in the high ones, so a despawned entity's handle stops resolving
+typedef uint64_t entity_t;
+
+// Every world registers these first, their ids are the enum values
+typedef enum ecs_builtin_component {
+    ECS_COMPONENT_TRANSFORM,
+    ECS_COMPONENT_RENDER,
+    ECS_BUILTIN_COMPONENTS_COUNT
+} ecs_builtin_component;
+
+// Euler angles in radians like object_t, matrix is written by world_update_transforms
+typedef struct transform_component_t {
+    vec3 position;
+    vec3 rotation;
+    vec3 scale;
+    mat4 matrix;
+} transform_component_t;
+
+// object provides the mesh, program and textures and is shared by every entity drawn with it, it must outlive them.
+// joints_offset (animator_get_joints_offset) only applies when skinned is set, so a zeroed component draws unskinned.
+typedef struct render_component_t {
+    object_t* object;
+    bool skinned;
+    GLint joints_offset;
+} render_component_t;
+
+// Entities with the same component set. Chunks are ECS_CHUNK_SIZE blocks (larger only when one row does not fit)
+// holding capacity entity ids followed by one column per component, so systems walk plain arrays.
+typedef struct archetype_t {
+    uint64_t mask;
+    uint32_t offsets[ECS_MAX_COMPONENTS];
+    uint32_t capacity;
+    size_t chunk_size;
+    uint8_t** chunks;
+    uint32_t* counts;
+    uint32_t chunks_count;
+    uint32_t chunks_capacity;
+} archetype_t;
+
+// Where a live entity is stored, next_free links dead records
+typedef struct entity_record_t {
+    uint32_t generation;
+    int32_t archetype;
+    uint32_t chunk;
+    uint32_t row;
+    int32_t next_free;
+} entity_record_t;
+
+// The rows of one chunk as a system sees them
+typedef struct ecs_view_t {
+    const archetype_t* archetype;
+    uint8_t* chunk;
+    uint32_t count;
+} ecs_view_t;
+
+typedef void (*ecs_system_t)(const ecs_view_t* view, void* data);
+
+typedef struct ecs_job_t {
+    ecs_view_t view;
+    ecs_system_t system;
+    void* data;
+} ecs_job_t;
+
+// Nodes are addressed by stable handles, their data lives in SoA arrays in depth-first order, so every subtree
+// is the range [index, index + subtree_sizes[index]) and children always follow their parent.
+// Setting a local transform queues the node, transform_hierarchy_update only recomputes queued subtrees.
+typedef struct transform_hierarchy_t {
+    GLsizei count;
+    GLsizei capacity;
+    GLint* handles;
+    GLint* parents;
+    GLint* parent_handles;
+    GLsizei* subtree_sizes;
+    vec3* translations;
+    versor* rotations;
+    vec3* scales;
+    mat4* locals;
+    mat4* worlds;
+    bool* local_dirty;
+    GLint* indices;
+    GLsizei handles_count;
+    GLsizei handles_capacity;
+    GLint free_handle;
+    GLint* dirty;
+    GLsizei dirty_count;
+    GLsizei dirty_capacity;
+    bool sort_pending;
+} transform_hierarchy_t;
+
+typedef enum frustum_test {
+    FRUSTUM_TEST_OUTSIDE,
+    FRUSTUM_TEST_INTERSECTING,
+    FRUSTUM_TEST_INSIDE
+} frustum_test;
+
+#define OCCLUSION_WIDTH 320
+#define OCCLUSION_HEIGHT 192
+#define OCCLUSION_TILE 64
+#define OCCLUSION_BLOCK 8
+#define OCCLUSION_TILES_X (OCCLUSION_WIDTH / OCCLUSION_TILE)
+#define OCCLUSION_TILES_Y (OCCLUSION_HEIGHT / OCCLUSION_TILE)
+#define OCCLUSION_BLOCKS_X (OCCLUSION_WIDTH / OCCLUSION_BLOCK)
+#define OCCLUSION_BLOCKS_Y (OCCLUSION_HEIGHT / OCCLUSION_BLOCK)
+
+// CPU copy of a simple mesh that hides what is behind it, only positions and triangles
+typedef struct occluder_t {
+    vec3* positions;
+    size_t positions_count;
+    uint32_t* indices;
+    size_t indices_count;
+} occluder_t;
+
+// Screen space triangle, x and y in pixels with y up, z the [0, 1] depth. bounds is the pixel rect min x, min y, max x, max y.
+typedef struct occlusion_triangle_t {
+    float x[3];
+    float y[3];
+    float z[3];
+    int32_t bounds[4];
+} occlusion_triangle_t;
+
+typedef struct occlusion_draw_t {
+    mat4 matrix;
+    const occluder_t* occluder;
+    size_t first_triangle;
+    size_t triangles_count;
+} occlusion_draw_t;
+
+typedef struct occlusion_buffer_t occlusion_buffer_t;
+
+typedef struct occlusion_job_t {
+    occlusion_buffer_t* buffer;
+    size_t index;
+} occlusion_job_t;
+
+// Low resolution depth of the occluders queued each frame, rasterized tile by tile on job_pool, and its hierarchical-Z:
+// the farthest depth of every OCCLUSION_BLOCK square. Bounds nearer than that somewhere in their screen rect are visible.
+struct occlusion_buffer_t {
+    job_pool_t* job_pool;
+    mat4 view_projection;
+    float* depth;
+    float* hiz;
+    occlusion_draw_t* draws;
+    size_t draws_count;
+    size_t draws_capacity;
+    occlusion_triangle_t* triangles;
+    size_t triangles_capacity;
+    occlusion_job_t* jobs;
+    size_t jobs_capacity;
+};
+
+#define RENDER_KEY_PASS_SHIFT 62
+#define RENDER_KEY_TRANSLUCENT_SHIFT 61
+#define RENDER_KEY_ID_BITS 12
+#define RENDER_KEY_DEPTH_BITS 24
+
+// One queued draw, the key decides its place in the frame
+typedef struct render_draw_t {
+    mat4 matrix;
+    object_t* object;
+    GLint joints_offset;
+} render_draw_t;
+
+// Draws recorded by one thread, recording makes no GL calls
+typedef struct command_list_t {
+    render_draw_t* draws;
+    uint64_t* keys;
+    GLsizei count;
+    GLsizei capacity;
+} command_list_t;
+
+// Draws collected between render_queue_begin and render_queue_submit, culled on push and drawn in key order.
+// Set occlusion to an occlusion buffer rendered for the same camera to also skip hidden static draws.
+// Every thread of job_pool records into its own command list, render_queue_submit merges them on the GL thread.
+// Key bits from the top: pass (2), translucent (1), then program, texture set and mesh (12 each) and depth (24) for opaque
+// draws, front to back, or inverted depth before program, texture set and mesh for translucent ones, back to front.
+typedef struct render_queue_t {
+    const camera_t* camera;
+    vec4 planes[6];
+    const occlusion_buffer_t* occlusion;
+    const job_pool_t* job_pool;
+    pthread_t owner;
+    atomic_bool foreign_reported;
+    command_list_t* lists;
+    size_t lists_count;
+    render_draw_t** draws;
+    uint64_t* keys;
+    uint32_t* order;
+    uint64_t* keys_temporary;
+    uint32_t* order_temporary;
+    GLsizei count;
+    GLsizei capacity;
+} render_queue_t;
+
+#define SPRITE_BATCH_CAPACITY 65536
+
+// position is the center and uv the (u0, v0, u1, v1) rect with v0 at the top, like the quad of object_create.
+// layer becomes the z coordinate, so overlapping sprites are ordered by the depth test.
+typedef struct sprite_t {
+    vec2 position;
+    vec2 size;
+    vec4 uv;
+    vec4 color;
+    float layer;
+} sprite_t;
+
+// Matches sprite_batch_t.layout, the attribute locations of shader.vs
+typedef struct sprite_vertex_t {
+    GLfloat position[3];
+    GLfloat tex_coord[2];
+    uint8_t color[4];
+} sprite_vertex_t;
+
+// Quads are written straight into a ring buffer with regions of at least SPRITE_BATCH_CAPACITY sprites, one region per frame.
+// Runs of up to SPRITE_BATCH_CAPACITY sprites with the same program and texture go out in one draw call.
+typedef struct sprite_batch_t {
+    GLuint id;
+    GLuint index_buffer;
+    vertex_layout_t layout;
+    ring_buffer_t vertices;
+    GLint first;
+    GLsizei count;
+    const camera_t* camera;
+    const program_t* program;
+    const texture_t* texture;
+} sprite_batch_t;
+
+#define PROFILER_FRAMES 4
+#define PROFILER_ZONES 256
+#define PROFILER_MAX_DEPTH 32
+#define PROFILER_MAX_EVENTS (1 << 20)
+#define PROFILER_GPU_THREAD 1024
+
+// A finished zone on the CPU clock in nanoseconds, GPU zones are moved onto it. name must outlive the profiler.
+typedef struct profiler_event_t {
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+    uint32_t thread;
+} profiler_event_t;
+
+// GL_TIMESTAMP queries of the GPU zones of one frame, a begin and an end query per zone
+typedef struct profiler_frame_t {
+    GLuint queries[PROFILER_ZONES * 2];
+    const char* names[PROFILER_ZONES];
+    bool ended[PROFILER_ZONES];
+    GLsizei count;
+    GLuint last;
+    int64_t gpu_base;
+    uint64_t cpu_base;
+} profiler_frame_t;
+
+// GPU zones are read back PROFILER_FRAMES - 1 frames later and dropped rather than waited for when still unavailable.
+// CPU zones may be recorded from any thread, job threads show up by their job_thread_get_id.
+// GPU zones nested deeper than PROFILER_MAX_DEPTH only count in depth and are not measured.
+typedef struct profiler_t {
+    profiler_frame_t frames[PROFILER_FRAMES];
+    GLsizei frame;
+    GLint stack[PROFILER_MAX_DEPTH];
+    GLsizei depth;
+    profiler_event_t* events;
+    size_t events_count;
+    size_t events_capacity;
+    pthread_mutex_t mutex;
+    uint64_t frame_begin;
+    uint64_t cpu_frame_time;
+    uint64_t gpu_frame_time;
+    size_t frames_dropped;
+} profiler_t;
+
+// Systems run chunk by chunk on job_pool (inline when NULL), spawning, despawning or changing components during world_run is not allowed
+typedef struct world_t {
+    job_pool_t* job_pool;
+    uint32_t component_sizes[ECS_MAX_COMPONENTS];
+    uint32_t components_count;
+    archetype_t* archetypes;
+    uint32_t archetypes_count;
+    uint32_t archetypes_capacity;
+    entity_record_t* records;
+    uint32_t records_count;
+    uint32_t records_capacity;
+    int32_t free_record;
+    ecs_job_t* jobs;
+    size_t jobs_capacity;
+} world_t;
+
 
 GLenum gl_debug() {
     GLenum result = glGetError();
@@ -486,33 +1703,112 @@ void animated_texture_destroy(animated_texture_t* self) {
     self->current_time = 0.0;
 }
 
-void animated_texture_update(animated_texture_t* self, double time) {
+// Returns whether the frame changed
+bool animated_texture_update(animated_texture_t* self, double time) {
     if ((time - self->current_time) * 1000.0 >= self->delays[self->current_frame]) {
         self->current_frame = (self->current_frame + 1) % self->frames_count;
         self->current_time = time;
+
+        return true;
     }
+
+    return false;
+}
+
+// When the next frame is due, in the time base of animated_texture_update
+double animated_texture_get_deadline(const animated_texture_t* self) {
+    return self->current_time + self->delays[self->current_frame] / 1000.0;
 }
 
 
-shader_t shader_create(const char* file_name, shader_type type) {
+GLenum shader_get_stage(shader_type type) {
+    return
+        type == SHADER_TYPE_VERTEX ? GL_VERTEX_SHADER :
+        type == SHADER_TYPE_GEOMETRY ? GL_GEOMETRY_SHADER :
+        GL_FRAGMENT_SHADER;
+}
+
+shader_t shader_create_glsl(const char* file_name, shader_type type, const shader_specialization_t* specialization) {
     shader_t result = {
         .id = 0
     };
     file_t file = file_load(file_name, FILE_TYPE_TEXT);
 
     if (file.data) {
-        result.id = glCreateShader(
-            type == SHADER_TYPE_VERTEX ? GL_VERTEX_SHADER :
-            type == SHADER_TYPE_GEOMETRY ? GL_GEOMETRY_SHADER :
-            GL_FRAGMENT_SHADER
-        );
+        result.id = glCreateShader(shader_get_stage(type));
         gl_debug();
 
         if (result.id) {
-            glShaderSource(result.id, 1, (const GLchar* const*)&file.data, NULL);
+            const GLchar* source = (const GLchar*)file.data;
+            const GLchar* body = source;
+            char* defines = NULL;
+
+            // Defines have to follow the #version line
+            if (specialization && specialization->constants_count && file.size > 8 && !strncmp(source, "#version", 8)) {
+                size_t defines_size = (size_t)specialization->constants_count * 48 + 1;
+
+                body = memchr(source, '\n', file.size);
+                body = body ? body + 1 : source + file.size;
+                defines = (char*)calloc(defines_size, sizeof(char));
+
+                if (defines) {
+                    size_t offset = 0;
+
+                    for (GLuint i = 0; i < specialization->constants_count; ++i) {
+                        offset += (size_t)snprintf(
+                            defines + offset, defines_size - offset,
+                            "#define CONSTANT_ID_%u %u\n",
+                            specialization->constant_indices[i], specialization->constant_values[i]
+                        );
+                    }
+                }
+            }
+
+            const GLchar* sources[3] = { source, defines ? defines : "", body };
+            GLint lengths[3] = { (GLint)(body - source), -1, (GLint)(file.size - (size_t)(body - source)) };
+
+            glShaderSource(result.id, 3, sources, lengths);
             gl_debug();
             glCompileShader(result.id);
             gl_debug();
+
+            if (defines) {
+                free(defines);
+            }
+        }
+        else {
+            puts("glCreateShader error");
+        }
+
+        file_free(&file);
+    }
+
+    return result;
+}
+
+shader_t shader_create_spirv(const char* file_name, shader_type type, const shader_specialization_t* specialization, gl_specialize_shader_t specialize_shader) {
+    shader_t result = {
+        .id = 0
+    };
+    file_t file = file_load(file_name, FILE_TYPE_BINARY);
+
+    if (file.data) {
+        result.id = glCreateShader(shader_get_stage(type));
+        gl_debug();
+
+        if (result.id) {
+            glShaderBinary(1, &result.id, GL_SHADER_BINARY_FORMAT_SPIR_V_ARB, file.data, (GLsizei)file.size);
+            gl_debug();
+
+            // Specialization replaces glCompileShader, GL_COMPILE_STATUS reports its result
+            specialize_shader(
+                result.id,
+                specialization && specialization->entry_point ? specialization->entry_point : "main",
+                specialization ? specialization->constants_count : 0,
+                specialization ? specialization->constant_indices : NULL,
+                specialization ? specialization->constant_values : NULL
+            );
+            gl_debug();
         }
         else {
             puts("glCreateShader error");
@@ -524,6 +1820,52 @@ shader_t shader_create(const char* file_name, shader_type type) {
     return result;
 }
 
+// *.spv files go through GL_ARB_gl_spirv, without it the GLSL source next to them ("shader.vs.spv" -> "shader.vs") is compiled
+shader_t shader_create_specialized(const char* file_name, shader_type type, const shader_specialization_t* specialization) {
+    shader_t result = {
+        .id = 0
+    };
+
+    if (file_check_extension(file_name, "spv")) {
+        gl_specialize_shader_t specialize_shader = NULL;
+
+        if (glfwExtensionSupported("GL_ARB_gl_spirv")) {
+            specialize_shader = (gl_specialize_shader_t)glfwGetProcAddress("glSpecializeShaderARB");
+
+            if (!specialize_shader) {
+                specialize_shader = (gl_specialize_shader_t)glfwGetProcAddress("glSpecializeShader");
+            }
+        }
+
+        if (specialize_shader) {
+            result = shader_create_spirv(file_name, type, specialization, specialize_shader);
+        }
+        else {
+            size_t size = strlen(file_name) - strlen(".spv");
+            char* glsl_file_name = (char*)calloc(size + 1, sizeof(char));
+
+            if (glsl_file_name) {
+                memcpy(glsl_file_name, file_name, size);
+
+                printf("GL_ARB_gl_spirv is not supported, fallback:\n    %s\n", glsl_file_name);
+
+                result = shader_create_glsl(glsl_file_name, type, specialization);
+
+                free(glsl_file_name);
+            }
+        }
+    }
+    else {
+        result = shader_create_glsl(file_name, type, specialization);
+    }
+
+    return result;
+}
+
+shader_t shader_create(const char* file_name, shader_type type) {
+    return shader_create_specialized(file_name, type, NULL);
+}
+
 void shader_destroy(shader_t* self) {
     glDeleteShader(self->id);
     gl_debug();
@@ -633,598 +1975,7077 @@ void program_unuse() {
 }
 
 
-GLuint _mesh_create_(GLuint vertices_count, const GLfloat* positions, const GLfloat* normals, const GLfloat* texture_coords, const GLfloat* colors, const GLfloat* tangents, const GLfloat* bitangents, GLsizei indices_count, const GLuint* indices) {
-    GLuint result = 0;
-    GLuint vbo_positions = 0;
-    GLuint vbo_normals = 0;
-    GLuint vbo_tex_coords = 0;
-    GLuint vbo_colors = 0;
-    GLuint vbo_tangents = 0;
-    GLuint vbo_bitangents = 0;
-    GLuint ebo = 0;
+// Creates the shaders and the program and only kicks off compilation and linking, nothing here waits for the driver
+void shader_compiler_task_submit(shader_compiler_task_t* self) {
+    for (int i = 0; i < 3; ++i) {
+        if (self->file_names[i]) {
+            self->shaders[i] = shader_create(self->file_names[i], (shader_type)i);
+        }
+    }
 
-    glCreateVertexArrays(1, &result);
-    gl_debug();
-    glBindVertexArray(result);
-    gl_debug();
+    self->program = program_create(
+        self->shaders[SHADER_TYPE_VERTEX].id ? &self->shaders[SHADER_TYPE_VERTEX] : NULL,
+        self->shaders[SHADER_TYPE_GEOMETRY].id ? &self->shaders[SHADER_TYPE_GEOMETRY] : NULL,
+        self->shaders[SHADER_TYPE_FRAGMENT].id ? &self->shaders[SHADER_TYPE_FRAGMENT] : NULL
+    );
+}
 
-    if (positions) {
-        glGenBuffers(1, &vbo_positions);
-        gl_debug();
-        glBindBuffer(GL_ARRAY_BUFFER, vbo_positions);
-        gl_debug();
-        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)((int)sizeof(GLfloat) * vertices_count * 3), positions, GL_STATIC_DRAW);
-        gl_debug();
-        glEnableVertexAttribArray(0);
-        gl_debug();
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-        gl_debug();
-    }
-    if (normals) {
-        glGenBuffers(1, &vbo_normals);
-        gl_debug();
-        glBindBuffer(GL_ARRAY_BUFFER, vbo_normals);
-        gl_debug();
-        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)((int)sizeof(GLfloat) * vertices_count * 3), normals, GL_STATIC_DRAW);
-        gl_debug();
-        glEnableVertexAttribArray(1);
-        gl_debug();
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-        gl_debug();
-    }
-    if (texture_coords) {
-        glGenBuffers(1, &vbo_tex_coords);
-        gl_debug();
-        glBindBuffer(GL_ARRAY_BUFFER, vbo_tex_coords);
-        gl_debug();
-        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)((int)sizeof(GLfloat) * vertices_count * 2), texture_coords, GL_STATIC_DRAW);
-        gl_debug();
-        glEnableVertexAttribArray(2);
-        gl_debug();
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, NULL);
-        gl_debug();
-    }
-    if (colors) {
-        glGenBuffers(1, &vbo_colors);
-        gl_debug();
-        glBindBuffer(GL_ARRAY_BUFFER, vbo_colors);
-        gl_debug();
-        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)((int)sizeof(GLfloat) * vertices_count * 4), colors, GL_STATIC_DRAW);
-        gl_debug();
-        glEnableVertexAttribArray(3);
-        gl_debug();
-        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 0, NULL);
-        gl_debug();
-    }
-    if (tangents) {
-        glGenBuffers(1, &vbo_tangents);
-        gl_debug();
-        glBindBuffer(GL_ARRAY_BUFFER, vbo_tangents);
-        gl_debug();
-        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)((int)sizeof(GLfloat) * vertices_count * 3), tangents, GL_STATIC_DRAW);
-        gl_debug();
-        glEnableVertexAttribArray(4);
-        gl_debug();
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-        gl_debug();
-    }
-    if (bitangents) {
-        glGenBuffers(1, &vbo_bitangents);
-        gl_debug();
-        glBindBuffer(GL_ARRAY_BUFFER, vbo_bitangents);
-        gl_debug();
-        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)((int)sizeof(GLfloat) * vertices_count * 3), bitangents, GL_STATIC_DRAW);
-        gl_debug();
-        glEnableVertexAttribArray(5);
-        gl_debug();
-        glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-        gl_debug();
+// Blocks until the driver is done with the task, reports errors and releases the shaders
+program_status shader_compiler_task_resolve(shader_compiler_task_t* self) {
+    program_status result = PROGRAM_STATUS_READY;
+
+    for (int i = 0; i < 3; ++i) {
+        if (self->file_names[i]) {
+            if (!self->shaders[i].id) {
+                printf("Error load:\n    %s\n", self->file_names[i]);
+                result = PROGRAM_STATUS_FAILED;
+            }
+            else if (!shader_check(&self->shaders[i], (shader_type)i)) {
+                result = PROGRAM_STATUS_FAILED;
+            }
+        }
     }
-    if (indices) {
-        glCreateBuffers(1, &ebo);
-        gl_debug();
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-        gl_debug();
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)((int)sizeof(int) * indices_count), indices, GL_STATIC_DRAW);
-        gl_debug();
+
+    if (result == PROGRAM_STATUS_READY && (!self->program.id || !program_check(&self->program))) {
+        result = PROGRAM_STATUS_FAILED;
     }
 
-    glBindVertexArray(0);
-    gl_debug();
+    for (int i = 0; i < 3; ++i) {
+        if (self->shaders[i].id) {
+            if (self->program.id) {
+                glDetachShader(self->program.id, self->shaders[i].id);
+                gl_debug();
+            }
 
-    if (indices) {
-        glDeleteBuffers(1, &ebo);
-        gl_debug();
-    }
-    if (bitangents) {
-        glDeleteBuffers(1, &vbo_bitangents);
-        gl_debug();
-    }
-    if (tangents) {
-        glDeleteBuffers(1, &vbo_tangents);
-        gl_debug();
-    }
-    if (colors) {
-        glDeleteBuffers(1, &vbo_colors);
-        gl_debug();
-    }
-    if (texture_coords) {
-        glDeleteBuffers(1, &vbo_tex_coords);
-        gl_debug();
+            shader_destroy(&self->shaders[i]);
+        }
     }
-    if (normals) {
-        glDeleteBuffers(1, &vbo_normals);
-        gl_debug();
+
+    if (result == PROGRAM_STATUS_FAILED && self->program.id) {
+        program_destroy(&self->program);
     }
-    if (positions) {
-        glDeleteBuffers(1, &vbo_positions);
+
+    // Other contexts may only use the program once the compile context has finished it, so that comes before READY
+    if (self->compiler && self->compiler->mode == SHADER_COMPILER_MODE_THREADED) {
+        glFinish();
         gl_debug();
     }
 
+    atomic_store(&self->status, result);
+
     return result;
 }
 
-void mesh_destroy(mesh_t* self) {
-    glDeleteVertexArrays(1, &self->id);
-    gl_debug();
+void* shader_compiler_thread(void* data) {
+    shader_compiler_t* self = (shader_compiler_t*)data;
+    shader_compiler_task_t* task = NULL;
 
-    self->id = 0;
-    self->indices_count = 0;
-}
+    glfwMakeContextCurrent(self->context);
 
-mesh_t mesh_create(const char* file_name) {
-    #define load_accessor(type, nbcomp, acc, dst) { \
-        cgltf_size n = 0; \
-        type* buf = (type*)acc->buffer_view->buffer->data + acc->buffer_view->offset / sizeof(type) + acc->offset / sizeof(type); \
-        for (cgltf_size k = 0; k < acc->count; ++k) { \
-            for (size_t l = 0; l < nbcomp; ++l) { \
-                dst[nbcomp * k + l] = buf[n + l]; \
-            } \
-            n += (cgltf_size)(acc->stride / sizeof(type)); \
-        } \
-    }
+    pthread_mutex_lock(&self->mutex);
 
-    mesh_t result = {
-        .id = 0,
-        .indices_count = 0
-    };
-    cgltf_options options = {
-        .type = cgltf_file_type_invalid,
-        .json_token_count = 0,
-        .memory = {
-            .alloc = NULL,
-            .free = NULL,
-            .user_data = NULL
-        },
-        .file = {
-            .read = NULL,
-            .release = NULL,
-            .user_data = NULL
+    while (true) {
+        while (self->running && self->tasks_next == self->tasks_count) {
+            pthread_cond_wait(&self->work, &self->mutex);
         }
-    };
-    cgltf_data* data = NULL;
 
-    if (file_name) {
-        if (cgltf_parse_file(&options, file_name, &data) == cgltf_result_success) {
-            if (cgltf_load_buffers(&options, data, file_name) == cgltf_result_success) {
+        if (!self->running) {
+            break;
+        }
 
+        task = self->tasks[self->tasks_next++];
 
-                cgltf_size primitives_count = 0;
+        pthread_mutex_unlock(&self->mutex);
 
-                for (cgltf_size i = 0; i < data->meshes_count; ++i) {
-                    for (cgltf_size j = 0; j < data->meshes[i].primitives_count; ++j) {
-                        ++primitives_count;
-                    }
-                }
+        shader_compiler_task_submit(task);
+        shader_compiler_task_resolve(task);
 
-                float* positions = NULL;
-                float* normals = NULL;
-                float* tangents = NULL;
-                float* texcoords = NULL;
-                float* colors = NULL;
-                float* joints = NULL;
-                float* weights = NULL;
-                uint32_t* indices = NULL;
-                cgltf_size vertices_count = 0;
-                cgltf_size indices_count = 0;
+        pthread_mutex_lock(&self->mutex);
+        pthread_cond_broadcast(&self->done);
+    }
 
-                for (cgltf_size i = 0; i < data->meshes_count; ++i) {
-                    for (cgltf_size p = 0; p < data->meshes[i].primitives_count; ++p) {
-                        for (cgltf_size j = 0; j < data->meshes[i].primitives[p].attributes_count; ++j) {
-                            switch (data->meshes[i].primitives[p].attributes[j].type) {
-                                case cgltf_attribute_type_invalid: {
-                                } break;
-                                case cgltf_attribute_type_position: {
-                                    cgltf_accessor* acc = data->meshes[i].primitives[p].attributes[j].data;
-
-                                    positions = (float*)calloc(acc->count * 3, sizeof(float));
-                                    vertices_count = acc->count;
-
-                                    if (positions) {
-                                        load_accessor(float, 3, acc, positions)
-                                    }
-                                } break;
-                                case cgltf_attribute_type_normal: {
-                                } break;
-                                case cgltf_attribute_type_tangent: {
-                                } break;
-                                case cgltf_attribute_type_texcoord: {
-                                    cgltf_accessor* acc = data->meshes[i].primitives[p].attributes[j].data;
-
-                                    switch (acc->component_type) {
-                                        case cgltf_component_type_invalid: {
-                                        } break;
-                                        case cgltf_component_type_r_8: {
-                                        } break;
-                                        case cgltf_component_type_r_8u: {
-                                        } break;
-                                        case cgltf_component_type_r_16: {
-                                        } break;
-                                        case cgltf_component_type_r_16u: {
-                                        } break;
-                                        case cgltf_component_type_r_32u: {
-                                        } break;
-                                        case cgltf_component_type_r_32f: {
-                                            texcoords = (float*)calloc(acc->count * 2, sizeof(float));
-
-                                            if (texcoords) {
-                                                load_accessor(float, 2, acc, texcoords)
-                                            }
-                                        } break;
-                                        default: {
-                                        } break;
-                                    }
-                                } break;
-                                case cgltf_attribute_type_color: {
-                                    cgltf_accessor* acc = data->meshes[i].primitives[p].attributes[j].data;
-
-                                    switch (acc->component_type) {
-                                        case cgltf_component_type_invalid: {
-                                        } break;
-                                        case cgltf_component_type_r_8: {
-                                        } break;
-                                        case cgltf_component_type_r_8u: {
-                                        } break;
-                                        case cgltf_component_type_r_16: {
-                                        } break;
-                                        case cgltf_component_type_r_16u: {
-                                            colors = (float*)calloc(acc->count * 4, sizeof(float));
-
-                                            if (colors) {
-                                                uint16_t _colors_[acc->count * 4 * sizeof(uint16_t)];
-                                                uint32_t _col_count = array_size(_colors_) / sizeof(uint16_t);
-
-                                                load_accessor(uint16_t, 4, acc, _colors_)
-
-                                                for (int x = 0; x < _col_count; ++x) {
-                                                    colors[x] = _colors_[x] == 0 ? 0.0f : 256.0f / (_colors_[x] / 256.0f);
-                                                }
-                                            }
-                                        } break;
-                                        case cgltf_component_type_r_32u: {
-                                        } break;
-                                        case cgltf_component_type_r_32f: {
-                                        } break;
-                                        default: {
-                                        } break;
-                                    }
-                                } break;
-                                case cgltf_attribute_type_joints: {
-                                } break;
-                                case cgltf_attribute_type_weights: {
-                                } break;
-                                default: {
-                                } break;
-                            }
-                        }
-                        if (data->meshes[i].primitives[p].indices->count) {
-                            cgltf_accessor* acc = data->meshes[i].primitives[p].indices;
-
-                            indices_count = data->meshes[i].primitives[p].indices->count;
-
-                            switch (acc->component_type) {
-                                case cgltf_component_type_invalid: {
-                                } break;
-                                case cgltf_component_type_r_8: {
-                                } break;
-                                case cgltf_component_type_r_8u: {
-                                } break;
-                                case cgltf_component_type_r_16: {
-                                } break;
-                                case cgltf_component_type_r_16u: {
-                                    indices = (uint32_t*)calloc(vertices_count, sizeof(uint32_t));
-
-                                    if (indices) {
-                                        load_accessor(uint16_t, 1, acc, indices)
-                                    }
-                                } break;
-                                case cgltf_component_type_r_32u: {
-                                } break;
-                                case cgltf_component_type_r_32f: {
-                                } break;
-                                default: {
-                                } break;
-                            }
-                        }
-                    }
+    pthread_mutex_unlock(&self->mutex);
 
-                    if (result.id) {
-                        mesh_destroy(&result);
-                    }
+    glfwMakeContextCurrent(NULL);
 
-                    result.id = _mesh_create_((GLuint)vertices_count, positions, normals, texcoords, colors, tangents, NULL, (GLsizei)indices_count, (const GLuint*)indices);
-                    result.indices_count = (GLsizei)indices_count;
+    return NULL;
+}
 
-                    if (positions) {
-                        free(positions);
-                        positions = NULL;
-                    }
-                    if (normals) {
-                        free(normals);
-                        normals = NULL;
-                    }
-                    if (tangents) {
-                        free(tangents);
-                        tangents = NULL;
-                    }
-                    if (texcoords) {
-                        free(texcoords);
-                        texcoords = NULL;
-                    }
-                    if (colors) {
-                        free(colors);
-                        colors = NULL;
-                    }
-                    if (joints) {
-                        free(joints);
-                        joints = NULL;
-                    }
-                    if (weights) {
-                        free(weights);
-                        weights = NULL;
-                    }
+// Must be called from the thread that owns the window, the window's context has to be current
+shader_compiler_t shader_compiler_create(GLFWwindow* window) {
+    shader_compiler_t result = {
+        .mode = SHADER_COMPILER_MODE_SYNCHRONOUS,
+        .tasks = NULL,
+        .tasks_count = 0,
+        .tasks_capacity = 0,
+        .tasks_next = 0,
+        .context = NULL,
+        .running = false
+    };
 
-                    vertices_count = 0;
-                    indices_count = 0;
-                }
+    if (glfwExtensionSupported("GL_KHR_parallel_shader_compile") || glfwExtensionSupported("GL_ARB_parallel_shader_compile")) {
+        gl_max_shader_compiler_threads_t max_shader_compiler_threads = (gl_max_shader_compiler_threads_t)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
 
+        if (!max_shader_compiler_threads) {
+            max_shader_compiler_threads = (gl_max_shader_compiler_threads_t)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+        }
 
-            }
-            else {
-                puts("Failed to cgltf_load_buffers()");
-            }
+        if (max_shader_compiler_threads) {
+            // 0xFFFFFFFF - let the driver pick the number of threads
+            max_shader_compiler_threads(0xFFFFFFFF);
+            gl_debug();
 
-            cgltf_free(data);
+            result.mode = SHADER_COMPILER_MODE_PARALLEL;
+
+            return result;
+        }
+    }
+
+    if (window) {
+        // Sharing needs the same context API and profile as the window, e.g. EGL or OSMesa for window_create_headless
+        glfwDefaultWindowHints();
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_CLIENT_API, glfwGetWindowAttrib(window, GLFW_CLIENT_API));
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, glfwGetWindowAttrib(window, GLFW_CONTEXT_CREATION_API));
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MAJOR));
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MINOR));
+        glfwWindowHint(GLFW_OPENGL_PROFILE, glfwGetWindowAttrib(window, GLFW_OPENGL_PROFILE));
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, glfwGetWindowAttrib(window, GLFW_OPENGL_FORWARD_COMPAT));
+
+        result.context = glfwCreateWindow(1, 1, "Shader compiler", NULL, window);
+
+        glfwDefaultWindowHints();
+
+        if (result.context) {
+            result.mode = SHADER_COMPILER_MODE_THREADED;
         }
         else {
-            puts("Failed to cgltf_parse_file()");
+            puts("Failed to create shared context, shaders are compiled synchronously");
         }
     }
     else {
-        printf("Failed to %s\n", file_name);
+        puts("No window to share a context with, shaders are compiled synchronously");
     }
 
     return result;
 }
 
-void mesh_draw(const mesh_t* self) {
-    glBindVertexArray(self->id);
-    gl_debug();
-    glDrawElements(GL_TRIANGLES, self->indices_count, GL_UNSIGNED_INT, NULL);
-    gl_debug();
-    glBindVertexArray(0);
-    gl_debug();
-}
+// Started by the first submit: the worker keeps a pointer to the compiler, so it must not be moved after that
+bool shader_compiler_start(shader_compiler_t* self) {
+    if (self->mode != SHADER_COMPILER_MODE_THREADED || self->running) {
+        return true;
+    }
 
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->work, NULL);
+    pthread_cond_init(&self->done, NULL);
 
-object_t object_default() {
-    object_t result = {
-        .position = GLM_VEC3_ZERO_INIT,
-        .rotation = GLM_VEC3_ZERO_INIT,
-        .scale = GLM_VEC3_ONE_INIT,
-        .matrix = GLM_MAT4_IDENTITY_INIT,
-        .program.id = 0,
-        .mesh = {
-            .id = 0,
-            .indices_count = 0
-        },
-        .textures = NULL,
-        .textures_count = 0
-    };
+    self->running = true;
 
-    return result;
-}
+    if (pthread_create(&self->thread, NULL, shader_compiler_thread, self)) {
+        puts("Failed to pthread_create(), shaders are compiled synchronously");
 
-object_t object_create(
-    const char* vertex_shader_file_name,
-    const char* geometry_shader_file_name,
-    const char* fragment_shader_file_name,
-    const char* mesh_file_name,
-    const char** texture_file_names,
-    int textures_count
-) {
-    object_t result = object_default();
-    texture_t textures[textures_count];
+        pthread_cond_destroy(&self->done);
+        pthread_cond_destroy(&self->work);
+        pthread_mutex_destroy(&self->mutex);
 
-    shader_t vertex_shader = { .id = 0 };
-    shader_t geometry_shader = { .id = 0 };
-    shader_t fragment_shader = { .id = 0 };
+        glfwDestroyWindow(self->context);
 
-    if (vertex_shader_file_name) {
-        vertex_shader = shader_create(vertex_shader_file_name, SHADER_TYPE_VERTEX);
+        self->context = NULL;
+        self->mode = SHADER_COMPILER_MODE_SYNCHRONOUS;
+        self->running = false;
 
-        if (!shader_check(&vertex_shader, SHADER_TYPE_VERTEX)) {
-            return object_default();
-        }
+        return false;
     }
-    if (geometry_shader_file_name) {
-        geometry_shader = shader_create(geometry_shader_file_name, SHADER_TYPE_GEOMETRY);
 
-        if (!shader_check(&geometry_shader, SHADER_TYPE_GEOMETRY)) {
-            if (vertex_shader_file_name) {
-                shader_destroy(&vertex_shader);
-            }
+    return true;
+}
 
-            return object_default();
-        }
+shader_compiler_task_t* shader_compiler_submit(shader_compiler_t* self, const char* vertex_shader_file_name, const char* geometry_shader_file_name, const char* fragment_shader_file_name) {
+    shader_compiler_task_t* result = (shader_compiler_task_t*)calloc(1, sizeof(shader_compiler_task_t));
+    const char* file_names[3] = { vertex_shader_file_name, geometry_shader_file_name, fragment_shader_file_name };
+
+    if (!result) {
+        return NULL;
     }
-    if (fragment_shader_file_name) {
-        fragment_shader = shader_create(fragment_shader_file_name, SHADER_TYPE_FRAGMENT);
 
-        if (!shader_check(&fragment_shader, SHADER_TYPE_FRAGMENT)) {
-            if (vertex_shader_file_name) {
-                shader_destroy(&vertex_shader);
-            }
+    shader_compiler_start(self);
 
-            if (geometry_shader_file_name) {
-                shader_destroy(&geometry_shader);
-            }
+    result->compiler = self;
+    result->claimed = false;
+    atomic_init(&result->status, PROGRAM_STATUS_COMPILING);
 
-            return object_default();
-        }
-    }
+    for (int i = 0; i < 3; ++i) {
+        if (file_names[i]) {
+            size_t size = strlen(file_names[i]);
 
-    result.program = program_create(
-        vertex_shader.id && shader_check(&vertex_shader, SHADER_TYPE_VERTEX) ? &vertex_shader : NULL,
-        geometry_shader.id && shader_check(&vertex_shader, SHADER_TYPE_GEOMETRY) ? &geometry_shader : NULL,
-        fragment_shader.id && shader_check(&vertex_shader, SHADER_TYPE_FRAGMENT) ? &fragment_shader : NULL
+            result->file_names[i] = (char*)calloc(size + 1, sizeof(char));
+
+            if (result->file_names[i]) {
+                memcpy(result->file_names[i], file_names[i], size + 1);
+            }
+        }
+    }
+
+    if (self->mode == SHADER_COMPILER_MODE_THREADED) {
+        pthread_mutex_lock(&self->mutex);
+    }
+
+    if (self->tasks_count == self->tasks_capacity) {
+        size_t capacity = self->tasks_capacity ? self->tasks_capacity * 2 : 16;
+        shader_compiler_task_t** tasks = (shader_compiler_task_t**)realloc(self->tasks, capacity * sizeof(shader_compiler_task_t*));
+
+        if (!tasks) {
+            if (self->mode == SHADER_COMPILER_MODE_THREADED) {
+                pthread_mutex_unlock(&self->mutex);
+            }
+
+            for (int i = 0; i < 3; ++i) {
+                free(result->file_names[i]);
+            }
+
+            free(result);
+
+            return NULL;
+        }
+
+        self->tasks = tasks;
+        self->tasks_capacity = capacity;
+    }
+
+    self->tasks[self->tasks_count++] = result;
+
+    switch (self->mode) {
+        case SHADER_COMPILER_MODE_SYNCHRONOUS: {
+            shader_compiler_task_submit(result);
+            shader_compiler_task_resolve(result);
+        } break;
+        case SHADER_COMPILER_MODE_PARALLEL: {
+            shader_compiler_task_submit(result);
+        } break;
+        case SHADER_COMPILER_MODE_THREADED: {
+            pthread_cond_signal(&self->work);
+            pthread_mutex_unlock(&self->mutex);
+        } break;
+    }
+
+    return result;
+}
+
+// Never blocks: call once per frame until the task leaves PROGRAM_STATUS_COMPILING
+program_status shader_compiler_task_poll(shader_compiler_task_t* self) {
+    program_status result = (program_status)atomic_load(&self->status);
+
+    if (result == PROGRAM_STATUS_COMPILING && self->compiler->mode == SHADER_COMPILER_MODE_PARALLEL) {
+        GLint completed = GL_FALSE;
+
+        if (self->program.id) {
+            glGetProgramiv(self->program.id, GL_COMPLETION_STATUS_KHR, &completed);
+            gl_debug();
+        }
+
+        if (completed || !self->program.id) {
+            result = shader_compiler_task_resolve(self);
+        }
+    }
+
+    return result;
+}
+
+program_status shader_compiler_task_wait(shader_compiler_task_t* self) {
+    shader_compiler_t* compiler = self->compiler;
+
+    if (compiler->mode == SHADER_COMPILER_MODE_THREADED) {
+        pthread_mutex_lock(&compiler->mutex);
+
+        while (compiler->running && atomic_load(&self->status) == PROGRAM_STATUS_COMPILING) {
+            pthread_cond_wait(&compiler->done, &compiler->mutex);
+        }
+
+        pthread_mutex_unlock(&compiler->mutex);
+    }
+    else if (atomic_load(&self->status) == PROGRAM_STATUS_COMPILING) {
+        shader_compiler_task_resolve(self);
+    }
+
+    return (program_status)atomic_load(&self->status);
+}
+
+// Hands the program over to the caller, the compiler no longer destroys it
+program_t shader_compiler_task_claim(shader_compiler_task_t* self) {
+    program_t result = {
+        .id = 0
+    };
+
+    if (!self->claimed && atomic_load(&self->status) == PROGRAM_STATUS_READY) {
+        result = self->program;
+        self->claimed = true;
+    }
+
+    return result;
+}
+
+void shader_compiler_wait(shader_compiler_t* self) {
+    for (size_t i = 0; i < self->tasks_count; ++i) {
+        shader_compiler_task_wait(self->tasks[i]);
+    }
+}
+
+void shader_compiler_destroy(shader_compiler_t* self) {
+    if (self->mode == SHADER_COMPILER_MODE_THREADED && self->running) {
+        pthread_mutex_lock(&self->mutex);
+        self->running = false;
+        pthread_cond_broadcast(&self->work);
+        pthread_cond_broadcast(&self->done);
+        pthread_mutex_unlock(&self->mutex);
+
+        pthread_join(self->thread, NULL);
+
+        pthread_cond_destroy(&self->done);
+        pthread_cond_destroy(&self->work);
+        pthread_mutex_destroy(&self->mutex);
+    }
+
+    for (size_t i = 0; i < self->tasks_count; ++i) {
+        shader_compiler_task_t* task = self->tasks[i];
+
+        if (self->mode == SHADER_COMPILER_MODE_PARALLEL && atomic_load(&task->status) == PROGRAM_STATUS_COMPILING) {
+            shader_compiler_task_resolve(task);
+        }
+
+        if (!task->claimed && task->program.id) {
+            program_destroy(&task->program);
+        }
+
+        for (int j = 0; j < 3; ++j) {
+            free(task->file_names[j]);
+        }
+
+        free(task);
+    }
+
+    if (self->tasks) {
+        free(self->tasks);
+        self->tasks = NULL;
+    }
+
+    if (self->context) {
+        glfwDestroyWindow(self->context);
+        self->context = NULL;
+    }
+
+    self->tasks_count = 0;
+    self->tasks_capacity = 0;
+    self->tasks_next = 0;
+    self->mode = SHADER_COMPILER_MODE_SYNCHRONOUS;
+}
+
+
+uint16_t float_to_half(float value) {
+    uint32_t bits = 0;
+    uint32_t sign = 0;
+    uint32_t mantissa = 0;
+    int32_t exponent = 0;
+    uint32_t result = 0;
+    uint32_t rest = 0;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    sign = (bits >> 16) & 0x8000;
+    mantissa = bits & 0x7FFFFF;
+    exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+
+    if (((bits >> 23) & 0xFF) == 0xFF) {
+        return (uint16_t)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+    }
+
+    if (exponent >= 31) {
+        return (uint16_t)(sign | 0x7C00);
+    }
+
+    if (exponent <= 0) {
+        uint32_t shift = 0;
+        uint32_t half = 0;
+
+        if (exponent < -10) {
+            return (uint16_t)sign;
+        }
+
+        mantissa |= 0x800000;
+        shift = (uint32_t)(14 - exponent);
+        result = mantissa >> shift;
+        half = 1u << (shift - 1);
+        rest = mantissa & ((half << 1) - 1);
+
+        if (rest > half || (rest == half && (result & 1))) {
+            ++result;
+        }
+
+        return (uint16_t)(sign | result);
+    }
+
+    // Rounding may carry into the exponent, which is still the correctly rounded value
+    result = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+    rest = mantissa & 0x1FFF;
+
+    if (rest > 0x1000 || (rest == 0x1000 && (result & 1))) {
+        ++result;
+    }
+
+    return (uint16_t)result;
+}
+
+uint32_t float_to_snorm_10_10_10_2(float x, float y, float z, float w) {
+    float values[4] = { x, y, z, w };
+    float scales[4] = { 511.0f, 511.0f, 511.0f, 1.0f };
+    uint32_t masks[4] = { 0x3FF, 0x3FF, 0x3FF, 0x3 };
+    uint32_t result = 0;
+
+    for (int i = 0; i < 4; ++i) {
+        float value = values[i] < -1.0f ? -1.0f : values[i] > 1.0f ? 1.0f : values[i];
+
+        result |= ((uint32_t)(int32_t)lroundf(value * scales[i]) & masks[i]) << (i * 10);
+    }
+
+    return result;
+}
+
+uint8_t float_to_unorm_8(float value) {
+    return (uint8_t)lroundf((value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value) * 255.0f);
+}
+
+uint16_t float_to_unorm_16(float value) {
+    return (uint16_t)lroundf((value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value) * 65535.0f);
+}
+
+
+GLuint vertex_format_get_size(vertex_format format) {
+    switch (format) {
+        case VERTEX_FORMAT_FLOAT_2: return sizeof(GLfloat) * 2;
+        case VERTEX_FORMAT_FLOAT_3: return sizeof(GLfloat) * 3;
+        case VERTEX_FORMAT_FLOAT_4: return sizeof(GLfloat) * 4;
+        case VERTEX_FORMAT_HALF_2: return sizeof(uint16_t) * 2;
+        case VERTEX_FORMAT_HALF_4: return sizeof(uint16_t) * 4;
+        case VERTEX_FORMAT_SNORM_10_10_10_2: return sizeof(uint32_t);
+        case VERTEX_FORMAT_UNORM_8_4: return sizeof(uint8_t) * 4;
+        case VERTEX_FORMAT_UNORM_16_4: return sizeof(uint16_t) * 4;
+        case VERTEX_FORMAT_UINT_16_4: return sizeof(uint16_t) * 4;
+        default: return 0;
+    }
+}
+
+GLint vertex_format_get_components(vertex_format format) {
+    switch (format) {
+        case VERTEX_FORMAT_FLOAT_2: return 2;
+        case VERTEX_FORMAT_FLOAT_3: return 3;
+        case VERTEX_FORMAT_HALF_2: return 2;
+        case VERTEX_FORMAT_NONE: return 0;
+        default: return 4;
+    }
+}
+
+// Number of floats per vertex the caller passes for the attribute
+GLuint vertex_attribute_get_components(vertex_attribute_type type) {
+    switch (type) {
+        case VERTEX_ATTRIBUTE_TYPE_POSITION: return 3;
+        case VERTEX_ATTRIBUTE_TYPE_NORMAL: return 3;
+        case VERTEX_ATTRIBUTE_TYPE_TEX_COORD: return 2;
+        case VERTEX_ATTRIBUTE_TYPE_COLOR: return 4;
+        case VERTEX_ATTRIBUTE_TYPE_TANGENT: return 4;
+        case VERTEX_ATTRIBUTE_TYPE_JOINTS: return 4;
+        case VERTEX_ATTRIBUTE_TYPE_WEIGHTS: return 4;
+        default: return 0;
+    }
+}
+
+vertex_layout_t vertex_layout_create(const vertex_format formats[VERTEX_ATTRIBUTE_TYPE_COUNT]) {
+    vertex_layout_t result = {
+        .formats = { VERTEX_FORMAT_NONE },
+        .offsets = { 0 },
+        .stride = 0
+    };
+
+    for (int i = 0; i < VERTEX_ATTRIBUTE_TYPE_COUNT; ++i) {
+        result.formats[i] = formats[i];
+        result.offsets[i] = result.stride;
+        result.stride += vertex_format_get_size(formats[i]);
+    }
+
+    result.stride = (result.stride + 3) & ~3u;
+
+    return result;
+}
+
+// 28 bytes per vertex instead of 72 for the same attributes as plain floats, skinned meshes add 16 bytes of joints and weights.
+// Bitangents are not stored: cross(normal, tangent.xyz) * tangent.w in the shader.
+vertex_layout_t vertex_layout_default() {
+    const vertex_format formats[VERTEX_ATTRIBUTE_TYPE_COUNT] = {
+        [VERTEX_ATTRIBUTE_TYPE_POSITION] = VERTEX_FORMAT_FLOAT_3,
+        [VERTEX_ATTRIBUTE_TYPE_NORMAL] = VERTEX_FORMAT_SNORM_10_10_10_2,
+        [VERTEX_ATTRIBUTE_TYPE_TEX_COORD] = VERTEX_FORMAT_HALF_2,
+        [VERTEX_ATTRIBUTE_TYPE_COLOR] = VERTEX_FORMAT_UNORM_8_4,
+        [VERTEX_ATTRIBUTE_TYPE_TANGENT] = VERTEX_FORMAT_SNORM_10_10_10_2,
+        [VERTEX_ATTRIBUTE_TYPE_JOINTS] = VERTEX_FORMAT_UINT_16_4,
+        [VERTEX_ATTRIBUTE_TYPE_WEIGHTS] = VERTEX_FORMAT_UNORM_16_4
+    };
+
+    return vertex_layout_create(formats);
+}
+
+void vertex_layout_apply(const vertex_layout_t* self, GLuint vertex_array, GLuint binding) {
+    for (GLuint i = 0; i < VERTEX_ATTRIBUTE_TYPE_COUNT; ++i) {
+        GLenum type = GL_FLOAT;
+        GLboolean normalized = GL_FALSE;
+
+        switch (self->formats[i]) {
+            case VERTEX_FORMAT_NONE: continue;
+            case VERTEX_FORMAT_HALF_2:
+            case VERTEX_FORMAT_HALF_4: type = GL_HALF_FLOAT; break;
+            case VERTEX_FORMAT_SNORM_10_10_10_2: type = GL_INT_2_10_10_10_REV; normalized = GL_TRUE; break;
+            case VERTEX_FORMAT_UNORM_8_4: type = GL_UNSIGNED_BYTE; normalized = GL_TRUE; break;
+            case VERTEX_FORMAT_UNORM_16_4: type = GL_UNSIGNED_SHORT; normalized = GL_TRUE; break;
+            case VERTEX_FORMAT_UINT_16_4: type = GL_UNSIGNED_SHORT; break;
+            default: type = GL_FLOAT; break;
+        }
+
+        glEnableVertexArrayAttrib(vertex_array, i);
+        gl_debug();
+
+        // Integer attributes reach the shader as ints, not as converted floats
+        if (self->formats[i] == VERTEX_FORMAT_UINT_16_4) {
+            glVertexArrayAttribIFormat(vertex_array, i, vertex_format_get_components(self->formats[i]), type, self->offsets[i]);
+        }
+        else {
+            glVertexArrayAttribFormat(vertex_array, i, vertex_format_get_components(self->formats[i]), type, normalized, self->offsets[i]);
+        }
+
+        gl_debug();
+        glVertexArrayAttribBinding(vertex_array, i, binding);
+        gl_debug();
+    }
+}
+
+// Missing source components are 0, except alpha, which is 1
+void vertex_layout_pack(const vertex_layout_t* self, GLuint vertices_count, const GLfloat* const sources[VERTEX_ATTRIBUTE_TYPE_COUNT], void* destination) {
+    for (int i = 0; i < VERTEX_ATTRIBUTE_TYPE_COUNT; ++i) {
+        GLuint components = vertex_attribute_get_components((vertex_attribute_type)i);
+
+        if (self->formats[i] == VERTEX_FORMAT_NONE || !sources[i]) {
+            continue;
+        }
+
+        for (GLuint j = 0; j < vertices_count; ++j) {
+            const GLfloat* source = &sources[i][j * components];
+            uint8_t* vertex = (uint8_t*)destination + (size_t)j * self->stride + self->offsets[i];
+            GLfloat value[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+            memcpy(value, source, components * sizeof(GLfloat));
+
+            switch (self->formats[i]) {
+                case VERTEX_FORMAT_FLOAT_2:
+                case VERTEX_FORMAT_FLOAT_3:
+                case VERTEX_FORMAT_FLOAT_4: {
+                    memcpy(vertex, value, vertex_format_get_size(self->formats[i]));
+                } break;
+                case VERTEX_FORMAT_HALF_2:
+                case VERTEX_FORMAT_HALF_4: {
+                    uint16_t half[4];
+
+                    for (int k = 0; k < 4; ++k) {
+                        half[k] = float_to_half(value[k]);
+                    }
+
+                    memcpy(vertex, half, vertex_format_get_size(self->formats[i]));
+                } break;
+                case VERTEX_FORMAT_SNORM_10_10_10_2: {
+                    uint32_t packed = float_to_snorm_10_10_10_2(value[0], value[1], value[2], components == 4 ? value[3] : 0.0f);
+
+                    memcpy(vertex, &packed, sizeof(packed));
+                } break;
+                case VERTEX_FORMAT_UNORM_8_4: {
+                    for (int k = 0; k < 4; ++k) {
+                        vertex[k] = float_to_unorm_8(value[k]);
+                    }
+                } break;
+                case VERTEX_FORMAT_UNORM_16_4: {
+                    uint16_t unorm[4];
+
+                    for (int k = 0; k < 4; ++k) {
+                        unorm[k] = float_to_unorm_16(value[k]);
+                    }
+
+                    memcpy(vertex, unorm, sizeof(unorm));
+                } break;
+                case VERTEX_FORMAT_UINT_16_4: {
+                    uint16_t integer[4];
+
+                    for (int k = 0; k < 4; ++k) {
+                        integer[k] = (uint16_t)lroundf(value[k] < 0.0f ? 0.0f : value[k] > 65535.0f ? 65535.0f : value[k]);
+                    }
+
+                    memcpy(vertex, integer, sizeof(integer));
+                } break;
+                default: {
+                } break;
+            }
+        }
+    }
+}
+
+
+// Attributes without data are dropped from the layout, layout may be NULL for vertex_layout_default()
+vertex_layout_t vertex_layout_select(const vertex_layout_t* layout, const GLfloat* const sources[VERTEX_ATTRIBUTE_TYPE_COUNT]) {
+    vertex_layout_t result = layout ? *layout : vertex_layout_default();
+
+    for (int i = 0; i < VERTEX_ATTRIBUTE_TYPE_COUNT; ++i) {
+        if (!sources[i]) {
+            result.formats[i] = VERTEX_FORMAT_NONE;
+        }
+    }
+
+    return vertex_layout_create(result.formats);
+}
+
+// Indices are relative to the base vertex of their submesh, so 16 bits suffice whenever no submesh has more than 65536 vertices
+GLenum mesh_select_index_type(const GLuint* indices, size_t indices_count) {
+    GLuint maximum = 0;
+
+    for (size_t i = 0; i < indices_count; ++i) {
+        maximum = indices[i] > maximum ? indices[i] : maximum;
+    }
+
+    return maximum <= UINT16_MAX ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+size_t mesh_get_index_size(GLenum index_type) {
+    return index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+}
+
+void mesh_pack_indices(GLenum index_type, const GLuint* indices, size_t indices_count, void* destination) {
+    if (index_type == GL_UNSIGNED_SHORT) {
+        GLushort* shorts = (GLushort*)destination;
+
+        for (size_t i = 0; i < indices_count; ++i) {
+            shorts[i] = (GLushort)indices[i];
+        }
+    }
+    else {
+        memcpy(destination, indices, indices_count * sizeof(GLuint));
+    }
+}
+
+// Zero sized at the origin without positions
+void mesh_compute_bounds(const GLfloat* positions, size_t vertices_count, vec3 bounds[2]) {
+    glm_vec3_zero(bounds[0]);
+    glm_vec3_zero(bounds[1]);
+
+    if (!positions || !vertices_count) {
+        return;
+    }
+
+    glm_vec3_copy((GLfloat*)positions, bounds[0]);
+    glm_vec3_copy((GLfloat*)positions, bounds[1]);
+
+    for (size_t i = 1; i < vertices_count; ++i) {
+        glm_vec3_minv(bounds[0], (GLfloat*)&positions[i * 3], bounds[0]);
+        glm_vec3_maxv(bounds[1], (GLfloat*)&positions[i * 3], bounds[1]);
+    }
+}
+
+// vertices are already packed with layout and indices with index_type. submeshes may be NULL for a single range over all indices.
+mesh_t mesh_upload(const vertex_layout_t* layout, GLuint vertices_count, const void* vertices, GLenum index_type, GLsizei indices_count, const void* indices, GLsizei submeshes_count, const submesh_t* submeshes) {
+    mesh_t result = {
+        .id = 0,
+        .vertex_buffer = 0,
+        .index_buffer = 0,
+        .layout = *layout,
+        .indices_count = 0,
+        .index_type = GL_UNSIGNED_INT,
+        .submeshes = NULL,
+        .submeshes_count = 0,
+        .lods = NULL,
+        .lods_count = 0,
+        .meshlets = NULL,
+        .meshlet_ranges = NULL,
+        .meshlets_count = 0
+    };
+
+    if (!vertices_count || !layout->stride) {
+        return result;
+    }
+
+    glCreateBuffers(1, &result.vertex_buffer);
+    gl_debug();
+    glNamedBufferStorage(result.vertex_buffer, (GLsizeiptr)vertices_count * layout->stride, vertices, 0);
+    gl_debug();
+
+    glCreateVertexArrays(1, &result.id);
+    gl_debug();
+    glVertexArrayVertexBuffer(result.id, 0, result.vertex_buffer, 0, (GLsizei)layout->stride);
+    gl_debug();
+
+    vertex_layout_apply(layout, result.id, 0);
+
+    if (indices) {
+        glCreateBuffers(1, &result.index_buffer);
+        gl_debug();
+        glNamedBufferStorage(result.index_buffer, (GLsizeiptr)mesh_get_index_size(index_type) * indices_count, indices, 0);
+        gl_debug();
+        glVertexArrayElementBuffer(result.id, result.index_buffer);
+        gl_debug();
+
+        result.indices_count = indices_count;
+        result.index_type = index_type;
+        result.submeshes_count = submeshes ? submeshes_count : 1;
+        result.submeshes = (submesh_t*)calloc((size_t)result.submeshes_count, sizeof(submesh_t));
+
+        if (result.submeshes) {
+            if (submeshes) {
+                memcpy(result.submeshes, submeshes, (size_t)submeshes_count * sizeof(submesh_t));
+            }
+            else {
+                result.submeshes[0] = (submesh_t) {
+                    .base_vertex = 0,
+                    .first_index = 0,
+                    .indices_count = indices_count,
+                    .material = -1
+                };
+            }
+        }
+        else {
+            result.submeshes_count = 0;
+        }
+    }
+
+    return result;
+}
+
+// layout may be NULL for vertex_layout_default(), attributes without data are dropped from it.
+// submeshes may be NULL for a single range over all indices.
+mesh_t _mesh_create_(const vertex_layout_t* layout, GLuint vertices_count, const GLfloat* positions, const GLfloat* normals, const GLfloat* texture_coords, const GLfloat* colors, const GLfloat* tangents, const GLfloat* joints, const GLfloat* weights, GLsizei indices_count, const GLuint* indices, GLsizei submeshes_count, const submesh_t* submeshes) {
+    mesh_t result = {
+        .id = 0,
+        .vertex_buffer = 0,
+        .index_buffer = 0,
+        .indices_count = 0,
+        .index_type = GL_UNSIGNED_INT,
+        .submeshes = NULL,
+        .submeshes_count = 0,
+        .lods = NULL,
+        .lods_count = 0,
+        .meshlets = NULL,
+        .meshlet_ranges = NULL,
+        .meshlets_count = 0
+    };
+    const GLfloat* const sources[VERTEX_ATTRIBUTE_TYPE_COUNT] = { positions, normals, texture_coords, colors, tangents, joints, weights };
+    vertex_layout_t selected = vertex_layout_select(layout, sources);
+    void* vertices = NULL;
+    void* shorts = NULL;
+    GLenum index_type = GL_UNSIGNED_INT;
+
+    if (!vertices_count || !selected.stride) {
+        return result;
+    }
+
+    vertices = calloc(vertices_count, selected.stride);
+    index_type = indices ? mesh_select_index_type(indices, (size_t)indices_count) : GL_UNSIGNED_INT;
+
+    if (index_type == GL_UNSIGNED_SHORT) {
+        shorts = calloc((size_t)indices_count, sizeof(GLushort));
+        index_type = shorts ? index_type : GL_UNSIGNED_INT;
+    }
+
+    if (vertices) {
+        vertex_layout_pack(&selected, vertices_count, sources, vertices);
+
+        if (shorts) {
+            mesh_pack_indices(index_type, indices, (size_t)indices_count, shorts);
+        }
+
+        result = mesh_upload(&selected, vertices_count, vertices, index_type, indices_count, shorts ? shorts : (const void*)indices, submeshes_count, submeshes);
+        mesh_compute_bounds(positions, vertices_count, result.bounds);
+
+        free(vertices);
+    }
+
+    if (shorts) {
+        free(shorts);
+    }
+
+    return result;
+}
+
+void mesh_destroy(mesh_t* self) {
+    glDeleteVertexArrays(1, &self->id);
+    gl_debug();
+    glDeleteBuffers(1, &self->vertex_buffer);
+    gl_debug();
+    glDeleteBuffers(1, &self->index_buffer);
+    gl_debug();
+
+    if (self->submeshes) {
+        free(self->submeshes);
+        self->submeshes = NULL;
+    }
+
+    if (self->lods) {
+        for (GLsizei i = 0; i < self->lods_count; ++i) {
+            free(self->lods[i].submeshes);
+        }
+
+        free(self->lods);
+        self->lods = NULL;
+    }
+
+    if (self->meshlets) {
+        free(self->meshlets);
+        free(self->meshlet_ranges);
+        self->meshlets = NULL;
+        self->meshlet_ranges = NULL;
+    }
+
+    self->meshlets_count = 0;
+    self->lods_count = 0;
+    self->id = 0;
+    self->vertex_buffer = 0;
+    self->index_buffer = 0;
+    self->indices_count = 0;
+    self->submeshes_count = 0;
+}
+
+// Start of the accessor's first element, NULL when the buffer is not loaded
+const uint8_t* accessor_get_data(const cgltf_accessor* accessor) {
+    const cgltf_buffer_view* view = accessor->buffer_view;
+
+    if (!view) {
+        return NULL;
+    }
+
+    if (view->data) {
+        return (const uint8_t*)view->data + accessor->offset;
+    }
+
+    if (!view->buffer || !view->buffer->data) {
+        return NULL;
+    }
+
+    return (const uint8_t*)view->buffer->data + view->offset + accessor->offset;
+}
+
+size_t accessor_get_component_size(cgltf_component_type type) {
+    switch (type) {
+        case cgltf_component_type_r_8: return 1;
+        case cgltf_component_type_r_8u: return 1;
+        case cgltf_component_type_r_16: return 2;
+        case cgltf_component_type_r_16u: return 2;
+        case cgltf_component_type_r_32u: return 4;
+        case cgltf_component_type_r_32f: return 4;
+        default: return 0;
+    }
+}
+
+// Copies element_size bytes of every element between two strided arrays
+void accessor_gather(const uint8_t* source, size_t source_stride, uint8_t* destination, size_t destination_stride, size_t element_size, size_t count) {
+    if (source_stride == element_size && destination_stride == element_size) {
+        memcpy(destination, source, count * element_size);
+        return;
+    }
+
+    switch (element_size) {
+        case 4:
+            for (size_t i = 0; i < count; ++i) {
+                memcpy(destination + i * destination_stride, source + i * source_stride, 4);
+            }
+            break;
+        case 8:
+            for (size_t i = 0; i < count; ++i) {
+                memcpy(destination + i * destination_stride, source + i * source_stride, 8);
+            }
+            break;
+        case 12:
+            for (size_t i = 0; i < count; ++i) {
+                memcpy(destination + i * destination_stride, source + i * source_stride, 12);
+            }
+            break;
+#if defined(__SSE2__)
+        case 16:
+            for (size_t i = 0; i < count; ++i) {
+                _mm_storeu_si128((__m128i*)(destination + i * destination_stride), _mm_loadu_si128((const __m128i*)(source + i * source_stride)));
+            }
+            break;
+#endif
+        default:
+            for (size_t i = 0; i < count; ++i) {
+                memcpy(destination + i * destination_stride, source + i * source_stride, element_size);
+            }
+            break;
+    }
+}
+
+// Integer to float kernels over tightly packed components. Signed values clamp at minimum, -1 for normalized data as glTF requires.
+void accessor_convert_u8(const uint8_t* source, GLfloat* destination, size_t count, GLfloat scale) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    __m256 factor = _mm256_set1_ps(scale);
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i value = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&source[i]));
+
+        _mm256_storeu_ps(&destination[i], _mm256_mul_ps(_mm256_cvtepi32_ps(value), factor));
+    }
+#elif defined(__SSE2__)
+    __m128 factor = _mm_set1_ps(scale);
+    __m128i zero = _mm_setzero_si128();
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i value = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)&source[i]), zero);
+
+        _mm_storeu_ps(&destination[i], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(value, zero)), factor));
+        _mm_storeu_ps(&destination[i + 4], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(value, zero)), factor));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        destination[i] = (GLfloat)source[i] * scale;
+    }
+}
+
+void accessor_convert_s8(const int8_t* source, GLfloat* destination, size_t count, GLfloat scale, GLfloat minimum) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    __m256 factor = _mm256_set1_ps(scale);
+    __m256 low = _mm256_set1_ps(minimum);
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i value = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)&source[i]));
+
+        _mm256_storeu_ps(&destination[i], _mm256_max_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(value), factor), low));
+    }
+#elif defined(__SSE2__)
+    __m128 factor = _mm_set1_ps(scale);
+    __m128 low = _mm_set1_ps(minimum);
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i bytes = _mm_loadl_epi64((const __m128i*)&source[i]);
+        __m128i value = _mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8);
+        __m128i first = _mm_srai_epi32(_mm_unpacklo_epi16(value, value), 16);
+        __m128i second = _mm_srai_epi32(_mm_unpackhi_epi16(value, value), 16);
+
+        _mm_storeu_ps(&destination[i], _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(first), factor), low));
+        _mm_storeu_ps(&destination[i + 4], _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(second), factor), low));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        GLfloat value = (GLfloat)source[i] * scale;
+
+        destination[i] = value < minimum ? minimum : value;
+    }
+}
+
+void accessor_convert_u16(const uint16_t* source, GLfloat* destination, size_t count, GLfloat scale) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    __m256 factor = _mm256_set1_ps(scale);
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i value = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&source[i]));
+
+        _mm256_storeu_ps(&destination[i], _mm256_mul_ps(_mm256_cvtepi32_ps(value), factor));
+    }
+#elif defined(__SSE2__)
+    __m128 factor = _mm_set1_ps(scale);
+    __m128i zero = _mm_setzero_si128();
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i value = _mm_loadu_si128((const __m128i*)&source[i]);
+
+        _mm_storeu_ps(&destination[i], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(value, zero)), factor));
+        _mm_storeu_ps(&destination[i + 4], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(value, zero)), factor));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        destination[i] = (GLfloat)source[i] * scale;
+    }
+}
+
+void accessor_convert_s16(const int16_t* source, GLfloat* destination, size_t count, GLfloat scale, GLfloat minimum) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    __m256 factor = _mm256_set1_ps(scale);
+    __m256 low = _mm256_set1_ps(minimum);
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i value = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)&source[i]));
+
+        _mm256_storeu_ps(&destination[i], _mm256_max_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(value), factor), low));
+    }
+#elif defined(__SSE2__)
+    __m128 factor = _mm_set1_ps(scale);
+    __m128 low = _mm_set1_ps(minimum);
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i value = _mm_loadu_si128((const __m128i*)&source[i]);
+        __m128i first = _mm_srai_epi32(_mm_unpacklo_epi16(value, value), 16);
+        __m128i second = _mm_srai_epi32(_mm_unpackhi_epi16(value, value), 16);
+
+        _mm_storeu_ps(&destination[i], _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(first), factor), low));
+        _mm_storeu_ps(&destination[i + 4], _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(second), factor), low));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        GLfloat value = (GLfloat)source[i] * scale;
+
+        destination[i] = value < minimum ? minimum : value;
+    }
+}
+
+void accessor_convert_u32(const uint32_t* source, GLfloat* destination, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        destination[i] = (GLfloat)source[i];
+    }
+}
+
+void accessor_convert(const void* source, cgltf_component_type type, bool normalized, GLfloat* destination, size_t count) {
+    switch (type) {
+        case cgltf_component_type_r_8:
+            accessor_convert_s8((const int8_t*)source, destination, count, normalized ? 1.0f / 127.0f : 1.0f, normalized ? -1.0f : -128.0f);
+            break;
+        case cgltf_component_type_r_8u:
+            accessor_convert_u8((const uint8_t*)source, destination, count, normalized ? 1.0f / 255.0f : 1.0f);
+            break;
+        case cgltf_component_type_r_16:
+            accessor_convert_s16((const int16_t*)source, destination, count, normalized ? 1.0f / 32767.0f : 1.0f, normalized ? -1.0f : -32768.0f);
+            break;
+        case cgltf_component_type_r_16u:
+            accessor_convert_u16((const uint16_t*)source, destination, count, normalized ? 1.0f / 65535.0f : 1.0f);
+            break;
+        case cgltf_component_type_r_32u:
+            accessor_convert_u32((const uint32_t*)source, destination, count);
+            break;
+        case cgltf_component_type_r_32f:
+            memcpy(destination, source, count * sizeof(GLfloat));
+            break;
+        default:
+            break;
+    }
+}
+
+// Decodes up to count elements with components floats each, components the accessor does not have are left untouched.
+// Returns the number of decoded elements.
+size_t accessor_read_floats(const cgltf_accessor* accessor, GLfloat* destination, size_t components, size_t count) {
+    const uint8_t* source = accessor_get_data(accessor);
+    size_t accessor_components = cgltf_num_components(accessor->type);
+    size_t used = accessor_components < components ? accessor_components : components;
+    size_t component_size = accessor_get_component_size(accessor->component_type);
+    size_t element_size = used * component_size;
+    uint8_t* packed = NULL;
+    GLfloat* converted = NULL;
+
+    if (count > accessor->count) {
+        count = accessor->count;
+    }
+
+    if (!count || !used) {
+        return 0;
+    }
+
+    // Sparse and matrix accessors are rare enough for the generic path
+    if (source && !accessor->is_sparse && accessor->type < cgltf_type_mat2 && component_size) {
+        if (accessor->component_type == cgltf_component_type_r_32f) {
+            accessor_gather(source, accessor->stride, (uint8_t*)destination, components * sizeof(GLfloat), element_size, count);
+
+            return count;
+        }
+
+        if (accessor->stride != element_size) {
+            packed = (uint8_t*)malloc(count * element_size);
+        }
+
+        if (used != components) {
+            converted = (GLfloat*)malloc(count * used * sizeof(GLfloat));
+        }
+
+        if ((accessor->stride == element_size || packed) && (used == components || converted)) {
+            if (packed) {
+                accessor_gather(source, accessor->stride, packed, element_size, element_size, count);
+            }
+
+            accessor_convert(packed ? packed : source, accessor->component_type, accessor->normalized, converted ? converted : destination, count * used);
+
+            if (converted) {
+                accessor_gather((const uint8_t*)converted, used * sizeof(GLfloat), (uint8_t*)destination, components * sizeof(GLfloat), used * sizeof(GLfloat), count);
+            }
+
+            free(packed);
+            free(converted);
+
+            return count;
+        }
+
+        free(packed);
+        free(converted);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        GLfloat element[16] = { 0.0f };
+
+        if (cgltf_accessor_read_float(accessor, i, element, 16)) {
+            memcpy(&destination[i * components], element, used * sizeof(GLfloat));
+        }
+    }
+
+    return count;
+}
+
+void accessor_widen_u8(const uint8_t* source, GLuint* destination, size_t count) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256((__m256i*)&destination[i], _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&source[i])));
+    }
+#elif defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i value = _mm_loadu_si128((const __m128i*)&source[i]);
+        __m128i low = _mm_unpacklo_epi8(value, zero);
+        __m128i high = _mm_unpackhi_epi8(value, zero);
+
+        _mm_storeu_si128((__m128i*)&destination[i], _mm_unpacklo_epi16(low, zero));
+        _mm_storeu_si128((__m128i*)&destination[i + 4], _mm_unpackhi_epi16(low, zero));
+        _mm_storeu_si128((__m128i*)&destination[i + 8], _mm_unpacklo_epi16(high, zero));
+        _mm_storeu_si128((__m128i*)&destination[i + 12], _mm_unpackhi_epi16(high, zero));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        destination[i] = source[i];
+    }
+}
+
+void accessor_widen_u16(const uint16_t* source, GLuint* destination, size_t count) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256((__m256i*)&destination[i], _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&source[i])));
+    }
+#elif defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i value = _mm_loadu_si128((const __m128i*)&source[i]);
+
+        _mm_storeu_si128((__m128i*)&destination[i], _mm_unpacklo_epi16(value, zero));
+        _mm_storeu_si128((__m128i*)&destination[i + 4], _mm_unpackhi_epi16(value, zero));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        destination[i] = source[i];
+    }
+}
+
+// Returns the number of decoded indices
+size_t accessor_read_indices(const cgltf_accessor* accessor, GLuint* destination, size_t count) {
+    const uint8_t* source = accessor_get_data(accessor);
+    size_t component_size = accessor_get_component_size(accessor->component_type);
+
+    if (count > accessor->count) {
+        count = accessor->count;
+    }
+
+    if (source && !accessor->is_sparse && accessor->type == cgltf_type_scalar && accessor->stride == component_size) {
+        switch (accessor->component_type) {
+            case cgltf_component_type_r_8u:
+                accessor_widen_u8(source, destination, count);
+                return count;
+            case cgltf_component_type_r_16u:
+                accessor_widen_u16((const uint16_t*)source, destination, count);
+                return count;
+            case cgltf_component_type_r_32u:
+                memcpy(destination, source, count * sizeof(GLuint));
+                return count;
+            default:
+                break;
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        destination[i] = (GLuint)cgltf_accessor_read_index(accessor, i);
+    }
+
+    return count;
+}
+
+
+// Only the first texture coordinate, color, joint and weight sets are used, so at most 4 joints influence a vertex
+vertex_attribute_type mesh_get_attribute_type(const cgltf_attribute* attribute) {
+    switch (attribute->type) {
+        case cgltf_attribute_type_position: return VERTEX_ATTRIBUTE_TYPE_POSITION;
+        case cgltf_attribute_type_normal: return VERTEX_ATTRIBUTE_TYPE_NORMAL;
+        case cgltf_attribute_type_tangent: return VERTEX_ATTRIBUTE_TYPE_TANGENT;
+        case cgltf_attribute_type_texcoord: return attribute->index == 0 ? VERTEX_ATTRIBUTE_TYPE_TEX_COORD : VERTEX_ATTRIBUTE_TYPE_COUNT;
+        case cgltf_attribute_type_color: return attribute->index == 0 ? VERTEX_ATTRIBUTE_TYPE_COLOR : VERTEX_ATTRIBUTE_TYPE_COUNT;
+        case cgltf_attribute_type_joints: return attribute->index == 0 ? VERTEX_ATTRIBUTE_TYPE_JOINTS : VERTEX_ATTRIBUTE_TYPE_COUNT;
+        case cgltf_attribute_type_weights: return attribute->index == 0 ? VERTEX_ATTRIBUTE_TYPE_WEIGHTS : VERTEX_ATTRIBUTE_TYPE_COUNT;
+        default: return VERTEX_ATTRIBUTE_TYPE_COUNT;
+    }
+}
+
+const cgltf_accessor* mesh_get_positions(const cgltf_primitive* primitive) {
+    if (primitive->type != cgltf_primitive_type_triangles) {
+        return NULL;
+    }
+
+    for (cgltf_size i = 0; i < primitive->attributes_count; ++i) {
+        if (primitive->attributes[i].type == cgltf_attribute_type_position) {
+            return primitive->attributes[i].data;
+        }
+    }
+
+    return NULL;
+}
+
+#define MESH_OPTIMIZE_CACHE_SIZE 16
+
+
+// Tipsify (Sander, Nehab, Barczak 2007): fans around the vertex most likely still in the cache.
+// clusters receives the first triangle of every cluster, a cluster starts whenever the cache is effectively flushed.
+bool mesh_optimize_vertex_cache(GLuint* destination, const GLuint* indices, size_t indices_count, size_t vertices_count, size_t* clusters, size_t* clusters_count) {
+    size_t triangles_count = indices_count / 3;
+    GLuint* offsets = (GLuint*)calloc(vertices_count + 1, sizeof(GLuint));
+    GLuint* live = (GLuint*)calloc(vertices_count, sizeof(GLuint));
+    GLuint* adjacency = (GLuint*)calloc(indices_count, sizeof(GLuint));
+    size_t* timestamps = (size_t*)calloc(vertices_count, sizeof(size_t));
+    GLuint* dead_ends = (GLuint*)calloc(indices_count, sizeof(GLuint));
+    bool* emitted = (bool*)calloc(triangles_count, sizeof(bool));
+    bool result = offsets && live && adjacency && timestamps && dead_ends && emitted;
+
+    *clusters_count = 0;
+
+    if (result) {
+        size_t dead_ends_count = 0;
+        size_t timestamp = MESH_OPTIMIZE_CACHE_SIZE + 1;
+        size_t cursor = 0;
+        size_t written = 0;
+        long fanning = 0;
+        bool flushed = true;
+
+        for (size_t i = 0; i < triangles_count * 3; ++i) {
+            ++live[indices[i]];
+        }
+
+        for (size_t i = 0; i < vertices_count; ++i) {
+            offsets[i + 1] = offsets[i] + live[i];
+        }
+
+        for (size_t i = 0; i < triangles_count * 3; ++i) {
+            adjacency[offsets[indices[i]]++] = (GLuint)(i / 3);
+        }
+
+        for (size_t i = vertices_count; i > 0; --i) {
+            offsets[i] = offsets[i - 1];
+        }
+
+        offsets[0] = 0;
+
+        while (fanning < (long)vertices_count && !live[fanning]) {
+            ++fanning;
+        }
+
+        while (fanning >= 0 && fanning < (long)vertices_count) {
+            long best = -1;
+            size_t best_priority = 0;
+            size_t candidates_first = dead_ends_count;
+
+            if (flushed) {
+                clusters[(*clusters_count)++] = written / 3;
+                flushed = false;
+            }
+
+            for (GLuint i = offsets[fanning]; i < offsets[fanning + 1]; ++i) {
+                GLuint triangle = adjacency[i];
+
+                if (emitted[triangle]) {
+                    continue;
+                }
+
+                for (int j = 0; j < 3; ++j) {
+                    GLuint vertex = indices[triangle * 3 + (GLuint)j];
+
+                    destination[written++] = vertex;
+                    dead_ends[dead_ends_count++] = vertex;
+                    --live[vertex];
+
+                    if (timestamp - timestamps[vertex] > MESH_OPTIMIZE_CACHE_SIZE) {
+                        timestamps[vertex] = timestamp++;
+                    }
+                }
+
+                emitted[triangle] = true;
+            }
+
+            for (size_t i = candidates_first; i < dead_ends_count; ++i) {
+                GLuint vertex = dead_ends[i];
+
+                if (live[vertex]) {
+                    size_t priority = 0;
+
+                    // Vertices whose remaining fan still fits into the cache are preferred by age
+                    if (timestamp - timestamps[vertex] + 2 * live[vertex] <= MESH_OPTIMIZE_CACHE_SIZE) {
+                        priority = timestamp - timestamps[vertex];
+                    }
+
+                    if (best < 0 || priority > best_priority) {
+                        best = vertex;
+                        best_priority = priority;
+                    }
+                }
+            }
+
+            if (best < 0) {
+                while (dead_ends_count && best < 0) {
+                    GLuint vertex = dead_ends[--dead_ends_count];
+
+                    if (live[vertex]) {
+                        best = vertex;
+                    }
+                }
+
+                while (best < 0 && cursor < vertices_count) {
+                    if (live[cursor]) {
+                        best = (long)cursor;
+                    }
+
+                    ++cursor;
+                }
+
+                flushed = true;
+            }
+
+            fanning = best;
+        }
+    }
+
+    free(offsets);
+    free(live);
+    free(adjacency);
+    free(timestamps);
+    free(dead_ends);
+    free(emitted);
+
+    return result;
+}
+
+typedef struct mesh_cluster_t {
+    float sort_key;
+    size_t first;
+    size_t count;
+} mesh_cluster_t;
+
+int mesh_cluster_compare(const void* a, const void* b) {
+    float left = ((const mesh_cluster_t*)a)->sort_key;
+    float right = ((const mesh_cluster_t*)b)->sort_key;
+
+    return left < right ? 1 : left > right ? -1 : 0;
+}
+
+// Clusters facing away from the mesh center are drawn first, they tend to occlude the rest
+bool mesh_optimize_overdraw(GLuint* destination, const GLuint* indices, size_t indices_count, const GLfloat* positions, const size_t* clusters, size_t clusters_count) {
+    mesh_cluster_t* sorted = (mesh_cluster_t*)calloc(clusters_count, sizeof(mesh_cluster_t));
+    vec3* centers = (vec3*)calloc(clusters_count, sizeof(vec3));
+    vec3* normals = (vec3*)calloc(clusters_count, sizeof(vec3));
+    size_t triangles_count = indices_count / 3;
+    vec3 mesh_center = GLM_VEC3_ZERO_INIT;
+    float mesh_area = 0.0f;
+    bool result = sorted && centers && normals;
+
+    if (result) {
+        for (size_t i = 0; i < clusters_count; ++i) {
+            float area = 0.0f;
+
+            sorted[i].first = clusters[i];
+            sorted[i].count = (i + 1 < clusters_count ? clusters[i + 1] : triangles_count) - clusters[i];
+
+            for (size_t j = sorted[i].first; j < sorted[i].first + sorted[i].count; ++j) {
+                const GLfloat* a = &positions[indices[j * 3 + 0] * 3];
+                const GLfloat* b = &positions[indices[j * 3 + 1] * 3];
+                const GLfloat* c = &positions[indices[j * 3 + 2] * 3];
+                vec3 ab = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+                vec3 ac = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+                vec3 cross;
+                float triangle_area = 0.0f;
+
+                glm_vec3_cross(ab, ac, cross);
+                triangle_area = glm_vec3_norm(cross) * 0.5f;
+
+                for (int k = 0; k < 3; ++k) {
+                    centers[i][k] += (a[k] + b[k] + c[k]) / 3.0f * triangle_area;
+                    normals[i][k] += cross[k];
+                }
+
+                area += triangle_area;
+            }
+
+            glm_vec3_add(mesh_center, centers[i], mesh_center);
+            mesh_area += area;
+
+            if (area > 0.0f) {
+                glm_vec3_scale(centers[i], 1.0f / area, centers[i]);
+            }
+
+            glm_vec3_normalize(normals[i]);
+        }
+
+        if (mesh_area > 0.0f) {
+            glm_vec3_scale(mesh_center, 1.0f / mesh_area, mesh_center);
+        }
+
+        for (size_t i = 0; i < clusters_count; ++i) {
+            glm_vec3_sub(centers[i], mesh_center, centers[i]);
+            sorted[i].sort_key = glm_vec3_dot(centers[i], normals[i]);
+        }
+
+        qsort(sorted, clusters_count, sizeof(mesh_cluster_t), mesh_cluster_compare);
+
+        for (size_t i = 0, written = 0; i < clusters_count; ++i) {
+            memcpy(&destination[written], &indices[sorted[i].first * 3], sorted[i].count * 3 * sizeof(GLuint));
+            written += sorted[i].count * 3;
+        }
+    }
+
+    free(sorted);
+    free(centers);
+    free(normals);
+
+    return result;
+}
+
+// remap receives the new position of every vertex: first use order, unused vertices go last
+void mesh_optimize_vertex_fetch(GLuint* remap, GLuint* indices, size_t indices_count, size_t vertices_count) {
+    GLuint next = 0;
+
+    for (size_t i = 0; i < vertices_count; ++i) {
+        remap[i] = UINT32_MAX;
+    }
+
+    for (size_t i = 0; i < indices_count; ++i) {
+        if (remap[indices[i]] == UINT32_MAX) {
+            remap[indices[i]] = next++;
+        }
+
+        indices[i] = remap[indices[i]];
+    }
+
+    for (size_t i = 0; i < vertices_count; ++i) {
+        if (remap[i] == UINT32_MAX) {
+            remap[i] = next++;
+        }
+    }
+}
+
+bool mesh_remap_attribute(GLfloat* attribute, GLuint components, const GLuint* remap, size_t vertices_count) {
+    GLfloat* copy = (GLfloat*)calloc(vertices_count * components, sizeof(GLfloat));
+
+    if (!copy) {
+        return false;
+    }
+
+    for (size_t i = 0; i < vertices_count; ++i) {
+        memcpy(&copy[remap[i] * components], &attribute[i * components], components * sizeof(GLfloat));
+    }
+
+    memcpy(attribute, copy, vertices_count * components * sizeof(GLfloat));
+    free(copy);
+
+    return true;
+}
+
+
+typedef struct mesh_optimize_job_t {
+    GLfloat* attributes[VERTEX_ATTRIBUTE_TYPE_COUNT];
+    GLuint* indices;
+    GLuint* remap;
+    size_t indices_count;
+    size_t vertices_count;
+} mesh_optimize_job_t;
+
+// Every job owns one submesh: a disjoint slice of the attributes, indices and remap table
+void mesh_optimize_job(void* data) {
+    mesh_optimize_job_t* self = (mesh_optimize_job_t*)data;
+    size_t triangles_count = self->indices_count / 3;
+    GLuint* ordered = (GLuint*)calloc(self->indices_count, sizeof(GLuint));
+    size_t* clusters = (size_t*)calloc(triangles_count + 1, sizeof(size_t));
+    size_t clusters_count = 0;
+
+    for (size_t i = 0; i < self->indices_count; ++i) {
+        if (self->indices[i] >= self->vertices_count) {
+            puts("Mesh optimization skipped: index out of range");
+
+            // Identity, so the cached remap leaves this submesh untouched
+            for (size_t j = 0; j < self->vertices_count; ++j) {
+                self->remap[j] = (GLuint)j;
+            }
+
+            free(ordered);
+            free(clusters);
+            return;
+        }
+    }
+
+    if (ordered && clusters && triangles_count) {
+        if (mesh_optimize_vertex_cache(ordered, self->indices, triangles_count * 3, self->vertices_count, clusters, &clusters_count)) {
+            mesh_optimize_overdraw(self->indices, ordered, triangles_count * 3, self->attributes[VERTEX_ATTRIBUTE_TYPE_POSITION], clusters, clusters_count);
+        }
+    }
+
+    free(ordered);
+    free(clusters);
+
+    mesh_optimize_vertex_fetch(self->remap, self->indices, self->indices_count, self->vertices_count);
+
+    for (int i = 0; i < VERTEX_ATTRIBUTE_TYPE_COUNT; ++i) {
+        if (self->attributes[i]) {
+            mesh_remap_attribute(self->attributes[i], vertex_attribute_get_components((vertex_attribute_type)i), self->remap, self->vertices_count);
+        }
+    }
+}
+
+typedef struct mesh_optimize_cache_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+    uint64_t vertices_count;
+    uint64_t indices_count;
+} mesh_optimize_cache_header_t;
+
+#define MESH_OPTIMIZE_CACHE_MAGIC 0x4D4F5043 // "CPOM"
+#define MESH_OPTIMIZE_CACHE_VERSION 1
+
+// Vertex cache, overdraw and vertex fetch order for every submesh, the vertex count of a submesh is the distance to the next base vertex.
+// The cache stores the remap table and the final indices under a hash of the input.
+void mesh_optimize(const mesh_options_t* options, GLfloat* const attributes[VERTEX_ATTRIBUTE_TYPE_COUNT], size_t vertices_count, GLuint* indices, size_t indices_count, const submesh_t* submeshes, size_t submeshes_count) {
+    GLuint* remap = (GLuint*)calloc(vertices_count, sizeof(GLuint));
+    mesh_optimize_job_t* jobs = (mesh_optimize_job_t*)calloc(submeshes_count, sizeof(mesh_optimize_job_t));
+    char cache_file_name[4096] = { 0 };
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    if (!remap || !jobs || !attributes[VERTEX_ATTRIBUTE_TYPE_POSITION]) {
+        free(remap);
+        free(jobs);
+        return;
+    }
+
+    if (options->cache_directory) {
+        file_t cache = { .data = NULL, .size = 0 };
+
+        hash = hash_fnv1a(indices, indices_count * sizeof(GLuint), hash);
+        hash = hash_fnv1a(attributes[VERTEX_ATTRIBUTE_TYPE_POSITION], vertices_count * 3 * sizeof(GLfloat), hash);
+        hash = hash_fnv1a(submeshes, submeshes_count * sizeof(submesh_t), hash);
+
+        snprintf(cache_file_name, sizeof(cache_file_name), "%s/%016llx.mesh_optimize", options->cache_directory, (unsigned long long)hash);
+
+        cache = file_load(cache_file_name, FILE_TYPE_BINARY);
+
+        if (cache.data) {
+            const mesh_optimize_cache_header_t* header = (const mesh_optimize_cache_header_t*)cache.data;
+
+            if (
+                cache.size == sizeof(mesh_optimize_cache_header_t) + (vertices_count + indices_count) * sizeof(GLuint) &&
+                header->magic == MESH_OPTIMIZE_CACHE_MAGIC && header->version == MESH_OPTIMIZE_CACHE_VERSION &&
+                header->hash == hash && header->vertices_count == vertices_count && header->indices_count == indices_count
+            ) {
+                memcpy(remap, header + 1, vertices_count * sizeof(GLuint));
+                memcpy(indices, (const GLuint*)(header + 1) + vertices_count, indices_count * sizeof(GLuint));
+
+                for (int i = 0; i < VERTEX_ATTRIBUTE_TYPE_COUNT; ++i) {
+                    if (attributes[i]) {
+                        mesh_remap_attribute(attributes[i], vertex_attribute_get_components((vertex_attribute_type)i), remap, vertices_count);
+                    }
+                }
+
+                file_free(&cache);
+                free(remap);
+                free(jobs);
+
+                return;
+            }
+
+            file_free(&cache);
+        }
+    }
+
+    for (size_t i = 0; i < submeshes_count; ++i) {
+        size_t first_vertex = (size_t)submeshes[i].base_vertex;
+        size_t last_vertex = i + 1 < submeshes_count ? (size_t)submeshes[i + 1].base_vertex : vertices_count;
+
+        for (int j = 0; j < VERTEX_ATTRIBUTE_TYPE_COUNT; ++j) {
+            jobs[i].attributes[j] = attributes[j] ? attributes[j] + first_vertex * vertex_attribute_get_components((vertex_attribute_type)j) : NULL;
+        }
+
+        jobs[i].indices = indices + submeshes[i].first_index;
+        jobs[i].indices_count = (size_t)submeshes[i].indices_count;
+        jobs[i].remap = remap + first_vertex;
+        jobs[i].vertices_count = last_vertex - first_vertex;
+
+        if (options->job_pool) {
+            job_pool_push(options->job_pool, mesh_optimize_job, &jobs[i]);
+        }
+        else {
+            mesh_optimize_job(&jobs[i]);
+        }
+    }
+
+    if (options->job_pool) {
+        job_pool_wait(options->job_pool);
+    }
+
+    if (options->cache_directory) {
+        size_t size = sizeof(mesh_optimize_cache_header_t) + (vertices_count + indices_count) * sizeof(GLuint);
+        mesh_optimize_cache_header_t* header = (mesh_optimize_cache_header_t*)calloc(1, size);
+
+        if (header) {
+            *header = (mesh_optimize_cache_header_t) {
+                .magic = MESH_OPTIMIZE_CACHE_MAGIC,
+                .version = MESH_OPTIMIZE_CACHE_VERSION,
+                .hash = hash,
+                .vertices_count = vertices_count,
+                .indices_count = indices_count
+            };
+
+            // Remap is stored relative to the whole mesh
+            for (size_t i = 0; i < submeshes_count; ++i) {
+                size_t first_vertex = (size_t)submeshes[i].base_vertex;
+
+                for (size_t j = 0; j < jobs[i].vertices_count; ++j) {
+                    ((GLuint*)(header + 1))[first_vertex + j] = (GLuint)first_vertex + remap[first_vertex + j];
+                }
+            }
+
+            memcpy((GLuint*)(header + 1) + vertices_count, indices, indices_count * sizeof(GLuint));
+
+            if (!file_save(cache_file_name, header, size)) {
+                printf("Failed to save %s\n", cache_file_name);
+            }
+
+            free(header);
+        }
+    }
+
+    free(remap);
+    free(jobs);
+}
+
+#define MESH_SIMPLIFY_ATTRIBUTE_WEIGHT 0.05f
+
+
+// Garland-Heckbert error quadric, area is the area of the triangles accumulated into it
+typedef struct quadric_t {
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+    double area;
+} quadric_t;
+
+void quadric_add_plane(quadric_t* self, double a, double b, double c, double d, double weight) {
+    self->a2 += a * a * weight;
+    self->ab += a * b * weight;
+    self->ac += a * c * weight;
+    self->ad += a * d * weight;
+    self->b2 += b * b * weight;
+    self->bc += b * c * weight;
+    self->bd += b * d * weight;
+    self->c2 += c * c * weight;
+    self->cd += c * d * weight;
+    self->d2 += d * d * weight;
+    self->area += weight;
+}
+
+void quadric_merge(quadric_t* self, const quadric_t* other) {
+    self->a2 += other->a2;
+    self->ab += other->ab;
+    self->ac += other->ac;
+    self->ad += other->ad;
+    self->b2 += other->b2;
+    self->bc += other->bc;
+    self->bd += other->bd;
+    self->c2 += other->c2;
+    self->cd += other->cd;
+    self->d2 += other->d2;
+    self->area += other->area;
+}
+
+double quadric_evaluate(const quadric_t* self, const GLfloat* position) {
+    double x = position[0];
+    double y = position[1];
+    double z = position[2];
+    double result =
+        self->a2 * x * x + self->b2 * y * y + self->c2 * z * z +
+        2.0 * (self->ab * x * y + self->ac * x * z + self->bc * y * z) +
+        2.0 * (self->ad * x + self->bd * y + self->cd * z) +
+        self->d2;
+
+    return result > 0.0 ? result : 0.0;
+}
+
+
+typedef struct mesh_simplify_vertex_t {
+    GLfloat position[3];
+    GLuint id;
+} mesh_simplify_vertex_t;
+
+typedef struct mesh_simplify_collapse_t {
+    double cost;
+    GLuint from;
+    GLuint to;
+} mesh_simplify_collapse_t;
+
+int mesh_simplify_vertex_compare(const void* a, const void* b) {
+    const GLfloat* left = ((const mesh_simplify_vertex_t*)a)->position;
+    const GLfloat* right = ((const mesh_simplify_vertex_t*)b)->position;
+
+    for (int i = 0; i < 3; ++i) {
+        if (left[i] != right[i]) {
+            return left[i] < right[i] ? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
+int mesh_simplify_collapse_compare(const void* a, const void* b) {
+    double left = ((const mesh_simplify_collapse_t*)a)->cost;
+    double right = ((const mesh_simplify_collapse_t*)b)->cost;
+
+    return left < right ? -1 : left > right ? 1 : 0;
+}
+
+// Vertex to triangle adjacency in compressed rows: triangles of vertex v are adjacency[offsets[v]..offsets[v + 1])
+void mesh_simplify_adjacency(GLuint* offsets, GLuint* adjacency, const GLuint* indices, size_t indices_count, size_t vertices_count) {
+    memset(offsets, 0, (vertices_count + 1) * sizeof(GLuint));
+
+    for (size_t i = 0; i < indices_count; ++i) {
+        ++offsets[indices[i] + 1];
+    }
+
+    for (size_t i = 0; i < vertices_count; ++i) {
+        offsets[i + 1] += offsets[i];
+    }
+
+    for (size_t i = 0; i < indices_count; ++i) {
+        adjacency[offsets[indices[i]]++] = (GLuint)(i / 3);
+    }
+
+    for (size_t i = vertices_count; i > 0; --i) {
+        offsets[i] = offsets[i - 1];
+    }
+
+    offsets[0] = 0;
+}
+
+double mesh_simplify_attribute_distance(GLfloat* const attributes[VERTEX_ATTRIBUTE_TYPE_COUNT], GLuint a, GLuint b) {
+    static const vertex_attribute_type types[] = { VERTEX_ATTRIBUTE_TYPE_NORMAL, VERTEX_ATTRIBUTE_TYPE_TEX_COORD, VERTEX_ATTRIBUTE_TYPE_COLOR };
+    double result = 0.0;
+
+    for (size_t i = 0; i < array_size(types); ++i) {
+        GLuint components = vertex_attribute_get_components(types[i]);
+
+        if (!attributes[types[i]]) {
+            continue;
+        }
+
+        for (GLuint j = 0; j < components; ++j) {
+            double difference = attributes[types[i]][a * components + j] - attributes[types[i]][b * components + j];
+
+            result += difference * difference;
+        }
+    }
+
+    return result;
+}
+
+// Half-edge collapses only: every vertex of the result already exists, so LODs share the vertex buffer.
+// Border and UV/normal seam vertices stay in place. error receives the object space error of the result.
+size_t mesh_simplify(GLuint* destination, const GLuint* indices, size_t indices_count, GLfloat* const attributes[VERTEX_ATTRIBUTE_TYPE_COUNT], size_t vertices_count, size_t target_indices_count, float* error) {
+    const GLfloat* positions = attributes[VERTEX_ATTRIBUTE_TYPE_POSITION];
+    quadric_t* quadrics = (quadric_t*)calloc(vertices_count, sizeof(quadric_t));
+    bool* locked = (bool*)calloc(vertices_count, sizeof(bool));
+    GLuint* remap = (GLuint*)calloc(vertices_count, sizeof(GLuint));
+    GLuint* touched = (GLuint*)calloc(vertices_count, sizeof(GLuint));
+    GLuint* offsets = (GLuint*)calloc(vertices_count + 1, sizeof(GLuint));
+    GLuint* adjacency = (GLuint*)calloc(indices_count, sizeof(GLuint));
+    mesh_simplify_vertex_t* sorted = (mesh_simplify_vertex_t*)calloc(vertices_count, sizeof(mesh_simplify_vertex_t));
+    mesh_simplify_collapse_t* collapses = (mesh_simplify_collapse_t*)calloc(indices_count * 2, sizeof(mesh_simplify_collapse_t));
+    size_t result = indices_count - indices_count % 3;
+    double attribute_weight = 0.0;
+    double max_error = 0.0;
+    GLuint pass = 0;
+
+    memcpy(destination, indices, result * sizeof(GLuint));
+
+    *error = 0.0f;
+
+    if (!positions || !quadrics || !locked || !remap || !touched || !offsets || !adjacency || !sorted || !collapses) {
+        target_indices_count = result;
+    }
+    else {
+        vec3 minimum = { FLT_MAX, FLT_MAX, FLT_MAX };
+        vec3 maximum = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+        for (size_t i = 0; i < vertices_count; ++i) {
+            glm_vec3_minv(minimum, (float*)&positions[i * 3], minimum);
+            glm_vec3_maxv(maximum, (float*)&positions[i * 3], maximum);
+
+            memcpy(sorted[i].position, &positions[i * 3], sizeof(sorted[i].position));
+            sorted[i].id = (GLuint)i;
+        }
+
+        attribute_weight = glm_vec3_distance(minimum, maximum) * MESH_SIMPLIFY_ATTRIBUTE_WEIGHT;
+        attribute_weight *= attribute_weight;
+
+        for (size_t i = 0; i < result; i += 3) {
+            const GLfloat* a = &positions[destination[i + 0] * 3];
+            const GLfloat* b = &positions[destination[i + 1] * 3];
+            const GLfloat* c = &positions[destination[i + 2] * 3];
+            vec3 ab = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+            vec3 ac = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+            vec3 normal;
+            float length = 0.0f;
+
+            glm_vec3_cross(ab, ac, normal);
+            length = glm_vec3_norm(normal);
+
+            if (length <= 0.0f) {
+                continue;
+            }
+
+            glm_vec3_scale(normal, 1.0f / length, normal);
+
+            for (int j = 0; j < 3; ++j) {
+                quadric_add_plane(&quadrics[destination[i + (size_t)j]], normal[0], normal[1], normal[2], -glm_vec3_dot(normal, (float*)a), length * 0.5);
+            }
+        }
+
+        // Vertices sharing a position with another vertex sit on an attribute seam
+        qsort(sorted, vertices_count, sizeof(mesh_simplify_vertex_t), mesh_simplify_vertex_compare);
+
+        for (size_t i = 1; i < vertices_count; ++i) {
+            if (!mesh_simplify_vertex_compare(&sorted[i - 1], &sorted[i])) {
+                locked[sorted[i - 1].id] = true;
+                locked[sorted[i].id] = true;
+            }
+        }
+
+        // Edges with a single triangle are borders
+        mesh_simplify_adjacency(offsets, adjacency, destination, result, vertices_count);
+
+        for (size_t i = 0; i < result; ++i) {
+            GLuint a = destination[i];
+            GLuint b = destination[i - i % 3 + (i + 1) % 3];
+            GLuint shared = 0;
+
+            for (GLuint j = offsets[a]; j < offsets[a + 1]; ++j) {
+                const GLuint* triangle = &destination[adjacency[j] * 3];
+
+                shared += triangle[0] == b || triangle[1] == b || triangle[2] == b;
+            }
+
+            if (shared == 1) {
+                locked[a] = true;
+                locked[b] = true;
+            }
+        }
+    }
+
+    while (result > target_indices_count) {
+        size_t collapses_count = 0;
+        size_t removed = 0;
+        size_t budget = (result - target_indices_count) / 3;
+        size_t written = 0;
+        bool collapsed = false;
+
+        ++pass;
+
+        mesh_simplify_adjacency(offsets, adjacency, destination, result, vertices_count);
+
+        for (size_t i = 0; i < result; ++i) {
+            GLuint ends[2] = { destination[i], destination[i - i % 3 + (i + 1) % 3] };
+
+            for (int j = 0; j < 2; ++j) {
+                GLuint from = ends[j];
+                GLuint to = ends[1 - j];
+
+                if (locked[from]) {
+                    continue;
+                }
+
+                collapses[collapses_count++] = (mesh_simplify_collapse_t) {
+                    .cost = quadric_evaluate(&quadrics[from], &positions[to * 3]) + quadrics[from].area * attribute_weight * mesh_simplify_attribute_distance(attributes, from, to),
+                    .from = from,
+                    .to = to
+                };
+            }
+        }
+
+        if (!collapses_count) {
+            break;
+        }
+
+        qsort(collapses, collapses_count, sizeof(mesh_simplify_collapse_t), mesh_simplify_collapse_compare);
+
+        for (size_t i = 0; i < vertices_count; ++i) {
+            remap[i] = (GLuint)i;
+        }
+
+        for (size_t i = 0; i < collapses_count && removed < budget; ++i) {
+            GLuint from = collapses[i].from;
+            GLuint to = collapses[i].to;
+            GLuint shared = 0;
+            bool flipped = false;
+
+            if (touched[from] == pass || touched[to] == pass) {
+                continue;
+            }
+
+            for (GLuint j = offsets[from]; j < offsets[from + 1] && !flipped; ++j) {
+                const GLuint* triangle = &destination[adjacency[j] * 3];
+                const GLfloat* before[3];
+                const GLfloat* after[3];
+                vec3 edges[4];
+                vec3 normals[2];
+
+                if (triangle[0] == to || triangle[1] == to || triangle[2] == to) {
+                    ++shared;
+                    continue;
+                }
+
+                for (int k = 0; k < 3; ++k) {
+                    before[k] = &positions[triangle[k] * 3];
+                    after[k] = triangle[k] == from ? &positions[to * 3] : before[k];
+                }
+
+                for (int k = 0; k < 3; ++k) {
+                    edges[0][k] = before[1][k] - before[0][k];
+                    edges[1][k] = before[2][k] - before[0][k];
+                    edges[2][k] = after[1][k] - after[0][k];
+                    edges[3][k] = after[2][k] - after[0][k];
+                }
+
+                glm_vec3_cross(edges[0], edges[1], normals[0]);
+                glm_vec3_cross(edges[2], edges[3], normals[1]);
+
+                flipped = glm_vec3_dot(normals[0], normals[1]) <= 0.0f;
+            }
+
+            if (flipped || !shared) {
+                continue;
+            }
+
+            remap[from] = to;
+            quadric_merge(&quadrics[to], &quadrics[from]);
+
+            if (quadrics[from].area > 0.0) {
+                double distance = sqrt(collapses[i].cost / quadrics[from].area);
+
+                max_error = distance > max_error ? distance : max_error;
+            }
+
+            // Triangles around the collapse changed, their vertices wait for the next pass
+            for (GLuint j = offsets[from]; j < offsets[from + 1]; ++j) {
+                for (int k = 0; k < 3; ++k) {
+                    touched[destination[adjacency[j] * 3 + (GLuint)k]] = pass;
+                }
+            }
+
+            touched[to] = pass;
+            removed += shared;
+            collapsed = true;
+        }
+
+        if (!collapsed) {
+            break;
+        }
+
+        for (size_t i = 0; i < result; i += 3) {
+            GLuint a = remap[destination[i + 0]];
+            GLuint b = remap[destination[i + 1]];
+            GLuint c = remap[destination[i + 2]];
+
+            if (a != b && b != c && a != c) {
+                destination[written++] = a;
+                destination[written++] = b;
+                destination[written++] = c;
+            }
+        }
+
+        result = written;
+    }
+
+    *error = (float)max_error;
+
+    free(quadrics);
+    free(locked);
+    free(remap);
+    free(touched);
+    free(offsets);
+    free(adjacency);
+    free(sorted);
+    free(collapses);
+
+    return result;
+}
+
+
+typedef struct mesh_lod_job_t {
+    GLfloat* attributes[VERTEX_ATTRIBUTE_TYPE_COUNT];
+    const GLuint* indices;
+    size_t indices_count;
+    size_t vertices_count;
+    bool optimize;
+    GLsizei lods_count;
+    GLuint** lods_indices;
+    size_t* lods_indices_count;
+    float* lods_errors;
+} mesh_lod_job_t;
+
+// A level that could not be reduced any further stays NULL and reuses the previous range
+void mesh_lod_job(void* data) {
+    mesh_lod_job_t* self = (mesh_lod_job_t*)data;
+    const GLuint* source = self->indices;
+    size_t source_count = self->indices_count;
+    float error = 0.0f;
+
+    for (GLsizei i = 0; i < self->lods_count; ++i) {
+        GLuint* destination = (GLuint*)calloc(source_count ? source_count : 1, sizeof(GLuint));
+        size_t target = source_count / 6 * 3;
+        float level_error = 0.0f;
+        size_t count = 0;
+
+        if (!destination) {
+            break;
+        }
+
+        count = mesh_simplify(destination, source, source_count, self->attributes, self->vertices_count, target, &level_error);
+
+        // Less than 10% fewer triangles is not worth another level
+        if (!count || count * 10 > source_count * 9) {
+            free(destination);
+            break;
+        }
+
+        if (self->optimize) {
+            GLuint* ordered = (GLuint*)calloc(count, sizeof(GLuint));
+            size_t* clusters = (size_t*)calloc(count / 3 + 1, sizeof(size_t));
+            size_t clusters_count = 0;
+
+            if (ordered && clusters && mesh_optimize_vertex_cache(ordered, destination, count, self->vertices_count, clusters, &clusters_count)) {
+                memcpy(destination, ordered, count * sizeof(GLuint));
+            }
+
+            free(ordered);
+            free(clusters);
+        }
+
+        error += level_error;
+
+        self->lods_indices[i] = destination;
+        self->lods_indices_count[i] = count;
+        self->lods_errors[i] = error;
+
+        source = destination;
+        source_count = count;
+    }
+}
+
+// Appends lods_count simplified levels of every submesh to the index buffer, indices is reallocated
+bool mesh_generate_lods(const mesh_options_t* options, GLfloat* const attributes[VERTEX_ATTRIBUTE_TYPE_COUNT], size_t vertices_count, GLuint** indices, size_t* indices_count, const submesh_t* submeshes, size_t submeshes_count, mesh_lod_t** lods) {
+    GLsizei lods_count = options->lods_count;
+    mesh_lod_job_t* jobs = (mesh_lod_job_t*)calloc(submeshes_count, sizeof(mesh_lod_job_t));
+    GLuint** lods_indices = (GLuint**)calloc(submeshes_count * (size_t)lods_count, sizeof(GLuint*));
+    size_t* lods_indices_count = (size_t*)calloc(submeshes_count * (size_t)lods_count, sizeof(size_t));
+    float* lods_errors = (float*)calloc(submeshes_count * (size_t)lods_count, sizeof(float));
+    bool result = jobs && lods_indices && lods_indices_count && lods_errors;
+
+    *lods = NULL;
+
+    if (result) {
+        size_t total = *indices_count;
+        GLuint* combined = NULL;
+
+        for (size_t i = 0; i < submeshes_count; ++i) {
+            size_t first_vertex = (size_t)submeshes[i].base_vertex;
+            size_t last_vertex = i + 1 < submeshes_count ? (size_t)submeshes[i + 1].base_vertex : vertices_count;
+
+            for (int j = 0; j < VERTEX_ATTRIBUTE_TYPE_COUNT; ++j) {
+                jobs[i].attributes[j] = attributes[j] ? attributes[j] + first_vertex * vertex_attribute_get_components((vertex_attribute_type)j) : NULL;
+            }
+
+            jobs[i].indices = *indices + submeshes[i].first_index;
+            jobs[i].indices_count = (size_t)submeshes[i].indices_count;
+            jobs[i].vertices_count = last_vertex - first_vertex;
+            jobs[i].optimize = options->optimize;
+            jobs[i].lods_count = lods_count;
+            jobs[i].lods_indices = &lods_indices[i * (size_t)lods_count];
+            jobs[i].lods_indices_count = &lods_indices_count[i * (size_t)lods_count];
+            jobs[i].lods_errors = &lods_errors[i * (size_t)lods_count];
+
+            if (options->job_pool) {
+                job_pool_push(options->job_pool, mesh_lod_job, &jobs[i]);
+            }
+            else {
+                mesh_lod_job(&jobs[i]);
+            }
+        }
+
+        if (options->job_pool) {
+            job_pool_wait(options->job_pool);
+        }
+
+        for (size_t i = 0; i < submeshes_count * (size_t)lods_count; ++i) {
+            total += lods_indices_count[i];
+        }
+
+        combined = (GLuint*)realloc(*indices, total * sizeof(GLuint));
+        *lods = (mesh_lod_t*)calloc((size_t)lods_count, sizeof(mesh_lod_t));
+        result = combined && *lods;
+
+        if (combined) {
+            *indices = combined;
+        }
+
+        for (GLsizei i = 0; i < lods_count && result; ++i) {
+            const submesh_t* previous = i ? (*lods)[i - 1].submeshes : submeshes;
+
+            (*lods)[i].submeshes = (submesh_t*)calloc(submeshes_count, sizeof(submesh_t));
+
+            if (!(*lods)[i].submeshes) {
+                result = false;
+                break;
+            }
+
+            for (size_t j = 0; j < submeshes_count; ++j) {
+                size_t level = j * (size_t)lods_count + (size_t)i;
+
+                (*lods)[i].submeshes[j] = previous[j];
+
+                if (lods_indices[level]) {
+                    memcpy(&combined[*indices_count], lods_indices[level], lods_indices_count[level] * sizeof(GLuint));
+
+                    (*lods)[i].submeshes[j].first_index = (GLuint)*indices_count;
+                    (*lods)[i].submeshes[j].indices_count = (GLsizei)lods_indices_count[level];
+
+                    *indices_count += lods_indices_count[level];
+                }
+
+                if (i && !lods_indices[level]) {
+                    lods_errors[level] = lods_errors[level - 1];
+                }
+
+                (*lods)[i].error = lods_errors[level] > (*lods)[i].error ? lods_errors[level] : (*lods)[i].error;
+            }
+        }
+
+        if (!result && *lods) {
+            for (GLsizei i = 0; i < lods_count; ++i) {
+                free((*lods)[i].submeshes);
+            }
+
+            free(*lods);
+            *lods = NULL;
+        }
+    }
+
+    for (size_t i = 0; lods_indices && i < submeshes_count * (size_t)lods_count; ++i) {
+        free(lods_indices[i]);
+    }
+
+    free(jobs);
+    free(lods_indices);
+    free(lods_indices_count);
+    free(lods_errors);
+
+    return result;
+}
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+// Bounding sphere around the box of the meshlet's vertices, normal cone from its face normals.
+// Triangles spread over more than ~84 degrees from the axis make the cone empty.
+void meshlet_compute_bounds(meshlet_t* self, const GLfloat* positions, const GLuint* indices) {
+    vec3 minimum = { FLT_MAX, FLT_MAX, FLT_MAX };
+    vec3 maximum = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    vec3 axis = GLM_VEC3_ZERO_INIT;
+    float minimum_dot = 1.0f;
+    GLsizei triangles_count = self->indices_count / 3;
+    vec3 normals[MESHLET_MAX_TRIANGLES];
+
+    self->radius = 0.0f;
+
+    for (GLsizei i = 0; i < self->indices_count; ++i) {
+        float* position = (float*)&positions[((size_t)self->base_vertex + indices[self->first_index + (GLuint)i]) * 3];
+
+        glm_vec3_minv(minimum, position, minimum);
+        glm_vec3_maxv(maximum, position, maximum);
+    }
+
+    glm_vec3_add(minimum, maximum, self->center);
+    glm_vec3_scale(self->center, 0.5f, self->center);
+
+    for (GLsizei i = 0; i < self->indices_count; ++i) {
+        float* position = (float*)&positions[((size_t)self->base_vertex + indices[self->first_index + (GLuint)i]) * 3];
+        float distance = glm_vec3_distance(self->center, position);
+
+        self->radius = distance > self->radius ? distance : self->radius;
+    }
+
+    for (GLsizei i = 0; i < triangles_count; ++i) {
+        const GLuint* triangle = &indices[self->first_index + (GLuint)i * 3];
+        float* a = (float*)&positions[((size_t)self->base_vertex + triangle[0]) * 3];
+        float* b = (float*)&positions[((size_t)self->base_vertex + triangle[1]) * 3];
+        float* c = (float*)&positions[((size_t)self->base_vertex + triangle[2]) * 3];
+        vec3 ab, ac;
+
+        glm_vec3_sub(b, a, ab);
+        glm_vec3_sub(c, a, ac);
+        glm_vec3_cross(ab, ac, normals[i]);
+
+        if (glm_vec3_norm(normals[i]) > FLT_EPSILON) {
+            glm_vec3_normalize(normals[i]);
+            glm_vec3_add(axis, normals[i], axis);
+        }
+        else {
+            glm_vec3_zero(normals[i]);
+        }
+    }
+
+    self->cone_cutoff = 1.0f;
+    glm_vec3_zero(self->cone_axis);
+
+    if (glm_vec3_norm(axis) <= FLT_EPSILON) {
+        return;
+    }
+
+    glm_vec3_normalize_to(axis, self->cone_axis);
+
+    for (GLsizei i = 0; i < triangles_count; ++i) {
+        if (glm_vec3_norm(normals[i]) > 0.0f) {
+            float dot = glm_vec3_dot(self->cone_axis, normals[i]);
+
+            minimum_dot = dot < minimum_dot ? dot : minimum_dot;
+        }
+    }
+
+    if (minimum_dot > 0.1f) {
+        self->cone_cutoff = sqrtf(1.0f - minimum_dot * minimum_dot);
+    }
+}
+
+// Splits the full detail range of every submesh in index order, so meshlets follow the vertex cache order from mesh_optimize.
+// Returns the number of meshlets.
+size_t mesh_build_meshlets(const GLfloat* positions, size_t vertices_count, const GLuint* indices, const submesh_t* submeshes, size_t submeshes_count, meshlet_t** meshlets) {
+    size_t result = 0;
+    size_t capacity = 0;
+    GLuint* marks = (GLuint*)calloc(vertices_count, sizeof(GLuint));
+
+    *meshlets = NULL;
+
+    if (!marks || !positions) {
+        free(marks);
+        return 0;
+    }
+
+    for (size_t i = 0; i < submeshes_count; ++i) {
+        GLsizei triangles_count = submeshes[i].indices_count / 3;
+        meshlet_t* meshlet = NULL;
+        GLuint meshlet_vertices = 0;
+
+        for (GLsizei j = 0; j < triangles_count; ++j) {
+            const GLuint* triangle = &indices[submeshes[i].first_index + (GLuint)j * 3];
+            GLuint added = 0;
+
+            for (int k = 0; k < 3; ++k) {
+                size_t vertex = (size_t)submeshes[i].base_vertex + triangle[k];
+
+                if (vertex >= vertices_count) {
+                    puts("Meshlets skipped: index out of range");
+                    free(marks);
+                    free(*meshlets);
+                    *meshlets = NULL;
+
+                    return 0;
+                }
+
+                // marks holds the number of the last meshlet that used the vertex
+                added += marks[vertex] != result ? 1 : 0;
+            }
+
+            if (!meshlet || meshlet_vertices + added > MESHLET_MAX_VERTICES || meshlet->indices_count / 3 >= MESHLET_MAX_TRIANGLES) {
+                if (result == capacity) {
+                    capacity = capacity ? capacity * 2 : 64;
+                    meshlet_t* grown = (meshlet_t*)realloc(*meshlets, capacity * sizeof(meshlet_t));
+
+                    if (!grown) {
+                        free(marks);
+                        free(*meshlets);
+                        *meshlets = NULL;
+
+                        return 0;
+                    }
+
+                    *meshlets = grown;
+                }
+
+                meshlet = &(*meshlets)[result++];
+                *meshlet = (meshlet_t) {
+                    .first_index = submeshes[i].first_index + (GLuint)j * 3,
+                    .indices_count = 0,
+                    .base_vertex = submeshes[i].base_vertex
+                };
+                meshlet_vertices = 0;
+            }
+
+            for (int k = 0; k < 3; ++k) {
+                size_t vertex = (size_t)submeshes[i].base_vertex + triangle[k];
+
+                if (marks[vertex] != result) {
+                    marks[vertex] = (GLuint)result;
+                    ++meshlet_vertices;
+                }
+            }
+
+            meshlet->indices_count += 3;
+        }
+    }
+
+    for (size_t i = 0; i < result; ++i) {
+        meshlet_compute_bounds(&(*meshlets)[i], positions, indices);
+    }
+
+    free(marks);
+
+    return result;
+}
+
+// Takes ownership of meshlets
+void mesh_attach_meshlets(mesh_t* self, meshlet_t* meshlets, GLsizei meshlets_count) {
+    self->meshlet_ranges = (submesh_t*)calloc((size_t)meshlets_count, sizeof(submesh_t));
+
+    if (!self->meshlet_ranges) {
+        free(meshlets);
+        return;
+    }
+
+    self->meshlets = meshlets;
+    self->meshlets_count = meshlets_count;
+}
+
+// One attribute or the indices of one primitive, accessor is NULL for missing attributes and non-indexed primitives
+typedef struct mesh_decode_job_t {
+    const cgltf_accessor* accessor;
+    GLfloat* attribute;
+    const GLfloat* defaults;
+    size_t components;
+    GLuint* indices;
+    size_t count;
+} mesh_decode_job_t;
+
+void mesh_decode_job(void* data) {
+    mesh_decode_job_t* self = (mesh_decode_job_t*)data;
+
+    if (self->indices) {
+        size_t decoded = self->accessor ? accessor_read_indices(self->accessor, self->indices, self->count) : 0;
+
+        for (size_t i = decoded; i < self->count; ++i) {
+            self->indices[i] = (GLuint)i;
+        }
+
+        return;
+    }
+
+    if (!self->accessor || cgltf_num_components(self->accessor->type) < self->components || self->accessor->count < self->count) {
+        for (size_t i = 0; i < self->count; ++i) {
+            memcpy(&self->attribute[i * self->components], self->defaults, self->components * sizeof(GLfloat));
+        }
+    }
+
+    if (self->accessor) {
+        accessor_read_floats(self->accessor, self->attribute, self->components, self->count);
+    }
+}
+
+// Decoded glTF data before packing, shared by mesh_create_ex and mesh_cook
+typedef struct mesh_data_t {
+    GLfloat* attributes[VERTEX_ATTRIBUTE_TYPE_COUNT];
+    size_t vertices_count;
+    GLuint* indices;
+    size_t indices_count;
+    submesh_t* submeshes;
+    size_t submeshes_count;
+    mesh_lod_t* lods;
+    GLsizei lods_count;
+    meshlet_t* meshlets;
+    size_t meshlets_count;
+} mesh_data_t;
+
+void mesh_data_free(mesh_data_t* self) {
+    for (int i = 0; i < VERTEX_ATTRIBUTE_TYPE_COUNT; ++i) {
+        if (self->attributes[i]) {
+            free(self->attributes[i]);
+            self->attributes[i] = NULL;
+        }
+    }
+
+    if (self->indices) {
+        free(self->indices);
+        self->indices = NULL;
+    }
+
+    if (self->submeshes) {
+        free(self->submeshes);
+        self->submeshes = NULL;
+    }
+
+    if (self->lods) {
+        for (GLsizei i = 0; i < self->lods_count; ++i) {
+            free(self->lods[i].submeshes);
+        }
+
+        free(self->lods);
+        self->lods = NULL;
+    }
+
+    if (self->meshlets) {
+        free(self->meshlets);
+        self->meshlets = NULL;
+    }
+
+    self->vertices_count = 0;
+    self->indices_count = 0;
+    self->submeshes_count = 0;
+    self->lods_count = 0;
+    self->meshlets_count = 0;
+}
+
+// One pass of mesh_split_submeshes, only counts vertices and submeshes while attributes is NULL
+bool mesh_split_pass(const mesh_data_t* self, size_t max_vertices, GLfloat* const attributes[VERTEX_ATTRIBUTE_TYPE_COUNT], GLuint* indices, submesh_t* submeshes, size_t* vertices_count, size_t* submeshes_count, GLuint* marks, GLuint* remap) {
+    GLuint chunk = 0;
+
+    *vertices_count = 0;
+    *submeshes_count = 0;
+    memset(marks, 0, self->vertices_count * sizeof(GLuint));
+
+    for (size_t i = 0; i < self->submeshes_count; ++i) {
+        const submesh_t* submesh = &self->submeshes[i];
+        size_t first_vertex = (size_t)submesh->base_vertex;
+        size_t count = (i + 1 < self->submeshes_count ? (size_t)self->submeshes[i + 1].base_vertex : self->vertices_count) - first_vertex;
+        GLsizei triangles_count = submesh->indices_count / 3;
+        size_t chunk_vertices = 0;
+        bool open = false;
+
+        if (count <= max_vertices) {
+            for (int a = 0; attributes && a < VERTEX_ATTRIBUTE_TYPE_COUNT; ++a) {
+                size_t components = vertex_attribute_get_components((vertex_attribute_type)a);
+
+                if (attributes[a]) {
+                    memcpy(&attributes[a][*vertices_count * components], &self->attributes[a][first_vertex * components], count * components * sizeof(GLfloat));
+                }
+            }
+
+            if (submeshes) {
+                submeshes[*submeshes_count] = *submesh;
+                submeshes[*submeshes_count].base_vertex = (GLint)*vertices_count;
+                memcpy(&indices[submesh->first_index], &self->indices[submesh->first_index], (size_t)submesh->indices_count * sizeof(GLuint));
+            }
+
+            *vertices_count += count;
+            ++*submeshes_count;
+            continue;
+        }
+
+        for (GLsizei j = 0; j < triangles_count; ++j) {
+            const GLuint* triangle = &self->indices[submesh->first_index + (GLuint)j * 3];
+            size_t added = 0;
+
+            for (int k = 0; k < 3; ++k) {
+                if (triangle[k] >= count) {
+                    return false;
+                }
+
+                // marks holds the last chunk that took the vertex
+                added += marks[first_vertex + triangle[k]] != chunk ? 1 : 0;
+            }
+
+            if (!open || chunk_vertices + added > max_vertices) {
+                if (submeshes) {
+                    submeshes[*submeshes_count] = (submesh_t) {
+                        .base_vertex = (GLint)*vertices_count,
+                        .first_index = submesh->first_index + (GLuint)j * 3,
+                        .indices_count = 0,
+                        .material = submesh->material
+                    };
+                }
+
+                ++*submeshes_count;
+                ++chunk;
+                chunk_vertices = 0;
+                open = true;
+            }
+
+            for (int k = 0; k < 3; ++k) {
+                size_t source = first_vertex + triangle[k];
+
+                if (marks[source] != chunk) {
+                    marks[source] = chunk;
+                    remap[source] = (GLuint)chunk_vertices++;
+
+                    for (int a = 0; attributes && a < VERTEX_ATTRIBUTE_TYPE_COUNT; ++a) {
+                        size_t components = vertex_attribute_get_components((vertex_attribute_type)a);
+
+                        if (attributes[a]) {
+                            memcpy(&attributes[a][*vertices_count * components], &self->attributes[a][source * components], components * sizeof(GLfloat));
+                        }
+                    }
+
+                    ++*vertices_count;
+                }
+
+                if (indices) {
+                    indices[submesh->first_index + (GLuint)j * 3 + (GLuint)k] = remap[source];
+                }
+            }
+
+            if (submeshes) {
+                submeshes[*submeshes_count - 1].indices_count += 3;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Submeshes with more than max_vertices vertices become chunks of whole triangles that each fit, vertices shared by two chunks are duplicated.
+// Keeps the vertex ranges of submeshes disjoint, mesh_optimize and mesh_generate_lods rely on it.
+bool mesh_split_submeshes(mesh_data_t* self, size_t max_vertices) {
+    GLfloat* attributes[VERTEX_ATTRIBUTE_TYPE_COUNT] = { NULL };
+    GLuint* marks = (GLuint*)calloc(self->vertices_count, sizeof(GLuint));
+    GLuint* remap = (GLuint*)calloc(self->vertices_count, sizeof(GLuint));
+    GLuint* indices = NULL;
+    submesh_t* submeshes = NULL;
+    size_t vertices_count = 0;
+    size_t submeshes_count = 0;
+    bool result = marks && remap && mesh_split_pass(self, max_vertices, NULL, NULL, NULL, &vertices_count, &submeshes_count, marks, remap);
+
+    if (result && submeshes_count == self->submeshes_count) {
+        free(marks);
+        free(remap);
+
+        return true;
+    }
+
+    if (result) {
+        indices = (GLuint*)calloc(self->indices_count, sizeof(GLuint));
+        submeshes = (submesh_t*)calloc(submeshes_count, sizeof(submesh_t));
+        result = indices && submeshes;
+
+        for (int i = 0; result && i < VERTEX_ATTRIBUTE_TYPE_COUNT; ++i) {
+            if (self->attributes[i]) {
+                attributes[i] = (GLfloat*)calloc(vertices_count * vertex_attribute_get_components((vertex_attribute_type)i), sizeof(GLfloat));
+                result = attributes[i] != NULL;
+            }
+        }
+    }
+
+    if (result) {
+        mesh_split_pass(self, max_vertices, attributes, indices, submeshes, &vertices_count, &submeshes_count, marks, remap);
+
+        for (int i = 0; i < VERTEX_ATTRIBUTE_TYPE_COUNT; ++i) {
+            free(self->attributes[i]);
+            self->attributes[i] = attributes[i];
+        }
+
+        free(self->indices);
+        free(self->submeshes);
+        self->indices = indices;
+        self->submeshes = submeshes;
+        self->vertices_count = vertices_count;
+        self->submeshes_count = submeshes_count;
+    }
+    else {
+        puts("Mesh split skipped");
+
+        for (int i = 0; i < VERTEX_ATTRIBUTE_TYPE_COUNT; ++i) {
+            free(attributes[i]);
+        }
+
+        free(indices);
+        free(submeshes);
+    }
+
+    free(marks);
+    free(remap);
+
+    return result;
+}
+
+// All triangle primitives of all meshes end up in one vertex/index array pair, one submesh per primitive
+mesh_data_t mesh_data_load(const char* file_name, const mesh_options_t* mesh_options) {
+    static const GLfloat defaults[VERTEX_ATTRIBUTE_TYPE_COUNT][4] = {
+        [VERTEX_ATTRIBUTE_TYPE_POSITION] = { 0.0f, 0.0f, 0.0f, 0.0f },
+        [VERTEX_ATTRIBUTE_TYPE_NORMAL] = { 0.0f, 0.0f, 1.0f, 0.0f },
+        [VERTEX_ATTRIBUTE_TYPE_TEX_COORD] = { 0.0f, 0.0f, 0.0f, 0.0f },
+        [VERTEX_ATTRIBUTE_TYPE_COLOR] = { 1.0f, 1.0f, 1.0f, 1.0f },
+        [VERTEX_ATTRIBUTE_TYPE_TANGENT] = { 1.0f, 0.0f, 0.0f, 1.0f },
+        [VERTEX_ATTRIBUTE_TYPE_JOINTS] = { 0.0f, 0.0f, 0.0f, 0.0f },
+        [VERTEX_ATTRIBUTE_TYPE_WEIGHTS] = { 1.0f, 0.0f, 0.0f, 0.0f }
+    };
+
+    mesh_data_t result = {
+        .attributes = { NULL },
+        .vertices_count = 0,
+        .indices = NULL,
+        .indices_count = 0,
+        .submeshes = NULL,
+        .submeshes_count = 0,
+        .lods = NULL,
+        .lods_count = 0,
+        .meshlets = NULL,
+        .meshlets_count = 0
+    };
+    cgltf_options options = {
+        .type = cgltf_file_type_invalid,
+        .json_token_count = 0,
+        .memory = {
+            .alloc = NULL,
+            .free = NULL,
+            .user_data = NULL
+        },
+        .file = {
+            .read = NULL,
+            .release = NULL,
+            .user_data = NULL
+        }
+    };
+    cgltf_data* data = NULL;
+
+    if (file_name) {
+        if (cgltf_parse_file(&options, file_name, &data) == cgltf_result_success) {
+            if (cgltf_load_buffers(&options, data, file_name) == cgltf_result_success) {
+                bool used[VERTEX_ATTRIBUTE_TYPE_COUNT] = { false };
+                bool allocated = true;
+                mesh_decode_job_t* jobs = NULL;
+
+                for (cgltf_size i = 0; i < data->meshes_count; ++i) {
+                    for (cgltf_size p = 0; p < data->meshes[i].primitives_count; ++p) {
+                        const cgltf_primitive* primitive = &data->meshes[i].primitives[p];
+                        const cgltf_accessor* positions = mesh_get_positions(primitive);
+
+                        if (positions) {
+                            result.vertices_count += positions->count;
+                            result.indices_count += primitive->indices ? primitive->indices->count : positions->count;
+                            ++result.submeshes_count;
+
+                            for (cgltf_size j = 0; j < primitive->attributes_count; ++j) {
+                                vertex_attribute_type type = mesh_get_attribute_type(&primitive->attributes[j]);
+
+                                if (type != VERTEX_ATTRIBUTE_TYPE_COUNT) {
+                                    used[type] = true;
+                                }
+                            }
+                        }
+                    }
+                }
+
+                for (int i = 0; i < VERTEX_ATTRIBUTE_TYPE_COUNT; ++i) {
+                    if (used[i]) {
+                        result.attributes[i] = (GLfloat*)calloc(result.vertices_count * vertex_attribute_get_components((vertex_attribute_type)i), sizeof(GLfloat));
+                        allocated = allocated && result.attributes[i];
+                    }
+                }
+
+                result.indices = (GLuint*)calloc(result.indices_count, sizeof(GLuint));
+                result.submeshes = (submesh_t*)calloc(result.submeshes_count, sizeof(submesh_t));
+                jobs = (mesh_decode_job_t*)calloc(result.submeshes_count * (VERTEX_ATTRIBUTE_TYPE_COUNT + 1), sizeof(mesh_decode_job_t));
+
+                if (allocated && result.indices && result.submeshes && jobs && result.submeshes_count) {
+                    job_pool_t* job_pool = mesh_options ? mesh_options->job_pool : NULL;
+                    GLfloat** attributes = result.attributes;
+                    GLuint* indices = result.indices;
+                    submesh_t* submeshes = result.submeshes;
+                    cgltf_size vertex = 0;
+                    cgltf_size index = 0;
+                    cgltf_size submesh = 0;
+
+                    for (cgltf_size i = 0; i < data->meshes_count; ++i) {
+                        for (cgltf_size p = 0; p < data->meshes[i].primitives_count; ++p) {
+                            const cgltf_primitive* primitive = &data->meshes[i].primitives[p];
+                            const cgltf_accessor* positions = mesh_get_positions(primitive);
+
+                            if (!positions) {
+                                continue;
+                            }
+
+                            mesh_decode_job_t* primitive_jobs = &jobs[submesh * (VERTEX_ATTRIBUTE_TYPE_COUNT + 1)];
+
+                            for (int j = 0; j < VERTEX_ATTRIBUTE_TYPE_COUNT; ++j) {
+                                GLuint components = vertex_attribute_get_components((vertex_attribute_type)j);
+
+                                primitive_jobs[j] = (mesh_decode_job_t) {
+                                    .accessor = NULL,
+                                    .attribute = attributes[j] ? &attributes[j][vertex * components] : NULL,
+                                    .defaults = defaults[j],
+                                    .components = components,
+                                    .indices = NULL,
+                                    .count = positions->count
+                                };
+                            }
+
+                            for (cgltf_size j = 0; j < primitive->attributes_count; ++j) {
+                                vertex_attribute_type type = mesh_get_attribute_type(&primitive->attributes[j]);
+
+                                if (type != VERTEX_ATTRIBUTE_TYPE_COUNT) {
+                                    primitive_jobs[type].accessor = primitive->attributes[j].data;
+                                }
+                            }
+
+                            submeshes[submesh] = (submesh_t) {
+                                .base_vertex = (GLint)vertex,
+                                .first_index = (GLuint)index,
+                                .indices_count = (GLsizei)(primitive->indices ? primitive->indices->count : positions->count),
+                                .material = primitive->material ? (GLint)(primitive->material - data->materials) : -1
+                            };
+
+                            primitive_jobs[VERTEX_ATTRIBUTE_TYPE_COUNT] = (mesh_decode_job_t) {
+                                .accessor = primitive->indices,
+                                .attribute = NULL,
+                                .defaults = NULL,
+                                .components = 1,
+                                .indices = &indices[index],
+                                .count = (size_t)submeshes[submesh].indices_count
+                            };
+
+                            for (int j = 0; j <= VERTEX_ATTRIBUTE_TYPE_COUNT; ++j) {
+                                if (!primitive_jobs[j].attribute && !primitive_jobs[j].indices) {
+                                    continue;
+                                }
+
+                                if (job_pool) {
+                                    job_pool_push(job_pool, mesh_decode_job, &primitive_jobs[j]);
+                                }
+                                else {
+                                    mesh_decode_job(&primitive_jobs[j]);
+                                }
+                            }
+
+                            vertex += positions->count;
+                            index += (cgltf_size)submeshes[submesh].indices_count;
+                            ++submesh;
+                        }
+                    }
+
+                    if (job_pool) {
+                        job_pool_wait(job_pool);
+                    }
+
+                    if (mesh_options && mesh_options->short_indices) {
+                        mesh_split_submeshes(&result, (size_t)UINT16_MAX + 1);
+                    }
+
+                    if (mesh_options && mesh_options->optimize) {
+                        mesh_optimize(mesh_options, result.attributes, result.vertices_count, result.indices, result.indices_count, result.submeshes, result.submeshes_count);
+                    }
+
+                    if (mesh_options && mesh_options->lods_count > 0) {
+                        mesh_generate_lods(mesh_options, result.attributes, result.vertices_count, &result.indices, &result.indices_count, result.submeshes, result.submeshes_count, &result.lods);
+
+                        if (result.lods) {
+                            result.lods_count = mesh_options->lods_count;
+                        }
+                    }
+
+                    if (mesh_options && mesh_options->meshlets) {
+                        result.meshlets_count = mesh_build_meshlets(result.attributes[VERTEX_ATTRIBUTE_TYPE_POSITION], result.vertices_count, result.indices, result.submeshes, result.submeshes_count, &result.meshlets);
+                    }
+                }
+                else {
+                    if (!result.submeshes_count) {
+                        printf("No triangles in %s\n", file_name);
+                    }
+
+                    mesh_data_free(&result);
+                }
+
+                if (jobs) {
+                    free(jobs);
+                }
+            }
+            else {
+                puts("Failed to cgltf_load_buffers()");
+            }
+
+            cgltf_free(data);
+        }
+        else {
+            puts("Failed to cgltf_parse_file()");
+        }
+    }
+    else {
+        printf("Failed to %s\n", file_name);
+    }
+
+    return result;
+}
+
+
+// Cooked mesh file: header, then (lods_count + 1) * submeshes_count submesh_t with full detail first,
+// lods_count float errors, meshlets, vertices packed with formats and indices, every block aligned to MESH_FILE_ALIGNMENT
+typedef struct mesh_file_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t formats[VERTEX_ATTRIBUTE_TYPE_COUNT];
+    uint32_t stride;
+    uint32_t index_type;
+    uint32_t vertices_count;
+    uint32_t indices_count;
+    uint32_t submeshes_count;
+    uint32_t lods_count;
+    uint32_t meshlets_count;
+    float bounds[6];
+    uint64_t submeshes_offset;
+    uint64_t errors_offset;
+    uint64_t meshlets_offset;
+    uint64_t vertices_offset;
+    uint64_t indices_offset;
+    uint64_t size;
+} mesh_file_header_t;
+
+#define MESH_FILE_MAGIC 0x48534D43 // "CMSH"
+#define MESH_FILE_VERSION 5
+#define MESH_FILE_ALIGNMENT 64
+
+uint64_t mesh_file_align(uint64_t offset) {
+    return (offset + MESH_FILE_ALIGNMENT - 1) & ~(uint64_t)(MESH_FILE_ALIGNMENT - 1);
+}
+
+// Block offsets and total size from the counts and stride already in the header
+void mesh_file_header_layout(mesh_file_header_t* self) {
+    self->submeshes_offset = mesh_file_align(sizeof(mesh_file_header_t));
+    self->errors_offset = mesh_file_align(self->submeshes_offset + (uint64_t)(self->lods_count + 1) * self->submeshes_count * sizeof(submesh_t));
+    self->meshlets_offset = mesh_file_align(self->errors_offset + (uint64_t)self->lods_count * sizeof(float));
+    self->vertices_offset = mesh_file_align(self->meshlets_offset + (uint64_t)self->meshlets_count * sizeof(meshlet_t));
+    self->indices_offset = mesh_file_align(self->vertices_offset + (uint64_t)self->vertices_count * self->stride);
+    self->size = self->indices_offset + (uint64_t)self->indices_count * mesh_get_index_size(self->index_type);
+}
+
+// A range of a cooked file must lie inside its indices and start at one of its vertices
+bool mesh_file_check_range(const mesh_file_header_t* self, GLint base_vertex, GLuint first_index, GLsizei indices_count) {
+    return base_vertex >= 0 && indices_count >= 0 &&
+        ((uint32_t)base_vertex < self->vertices_count || !indices_count) &&
+        (uint64_t)first_index + (uint64_t)indices_count <= self->indices_count;
+}
+
+// Converts a glTF file into the cooked format read by mesh_load, layout may be NULL for vertex_layout_default()
+bool mesh_cook(const char* source, const char* destination, const mesh_options_t* mesh_options, const vertex_layout_t* layout) {
+    bool result = false;
+    mesh_data_t data = mesh_data_load(source, mesh_options);
+    const GLfloat* sources[VERTEX_ATTRIBUTE_TYPE_COUNT] = { NULL };
+
+    if (!data.vertices_count) {
+        return result;
+    }
+
+    if (data.vertices_count > UINT32_MAX || data.indices_count > UINT32_MAX) {
+        printf("%s is too large to cook\n", source);
+        mesh_data_free(&data);
+
+        return result;
+    }
+
+    for (int i = 0; i < VERTEX_ATTRIBUTE_TYPE_COUNT; ++i) {
+        sources[i] = data.attributes[i];
+    }
+
+    vertex_layout_t selected = vertex_layout_select(layout, sources);
+    mesh_file_header_t header = {
+        .magic = MESH_FILE_MAGIC,
+        .version = MESH_FILE_VERSION,
+        .stride = selected.stride,
+        .index_type = mesh_select_index_type(data.indices, data.indices_count),
+        .vertices_count = (uint32_t)data.vertices_count,
+        .indices_count = (uint32_t)data.indices_count,
+        .submeshes_count = (uint32_t)data.submeshes_count,
+        .lods_count = (uint32_t)data.lods_count,
+        .meshlets_count = (uint32_t)data.meshlets_count
+    };
+    vec3 bounds[2];
+
+    for (int i = 0; i < VERTEX_ATTRIBUTE_TYPE_COUNT; ++i) {
+        header.formats[i] = (uint32_t)selected.formats[i];
+    }
+
+    mesh_compute_bounds(data.attributes[VERTEX_ATTRIBUTE_TYPE_POSITION], data.vertices_count, bounds);
+    memcpy(header.bounds, bounds, sizeof(header.bounds));
+
+    mesh_file_header_layout(&header);
+
+    uint8_t* blob = (uint8_t*)calloc(header.size, sizeof(uint8_t));
+
+    if (blob) {
+        submesh_t* submeshes = (submesh_t*)(blob + header.submeshes_offset);
+        float* errors = (float*)(blob + header.errors_offset);
+
+        memcpy(blob, &header, sizeof(header));
+        memcpy(submeshes, data.submeshes, data.submeshes_count * sizeof(submesh_t));
+
+        for (GLsizei i = 0; i < data.lods_count; ++i) {
+            memcpy(&submeshes[(size_t)(i + 1) * data.submeshes_count], data.lods[i].submeshes, data.submeshes_count * sizeof(submesh_t));
+            errors[i] = data.lods[i].error;
+        }
+
+        if (data.meshlets) {
+            memcpy(blob + header.meshlets_offset, data.meshlets, data.meshlets_count * sizeof(meshlet_t));
+        }
+
+        vertex_layout_pack(&selected, (GLuint)data.vertices_count, sources, blob + header.vertices_offset);
+        mesh_pack_indices(header.index_type, data.indices, data.indices_count, blob + header.indices_offset);
+
+        result = file_save(destination, blob, header.size);
+
+        if (!result) {
+            printf("Failed to save %s\n", destination);
+        }
+
+        free(blob);
+    }
+
+    mesh_data_free(&data);
+
+    return result;
+}
+
+// Maps a file written by mesh_cook and uploads it as is, no decoding happens on load
+mesh_t mesh_load(const char* file_name) {
+    mesh_t result = {
+        .id = 0,
+        .vertex_buffer = 0,
+        .index_buffer = 0,
+        .indices_count = 0,
+        .index_type = GL_UNSIGNED_INT,
+        .submeshes = NULL,
+        .submeshes_count = 0,
+        .lods = NULL,
+        .lods_count = 0,
+        .meshlets = NULL,
+        .meshlet_ranges = NULL,
+        .meshlets_count = 0
+    };
+    struct stat status;
+    int descriptor = open(file_name, O_RDONLY);
+
+    if (descriptor < 0) {
+        printf("Failed to open %s\n", file_name);
+
+        return result;
+    }
+
+    if (fstat(descriptor, &status) || (size_t)status.st_size < sizeof(mesh_file_header_t)) {
+        printf("%s is not a cooked mesh\n", file_name);
+        close(descriptor);
+
+        return result;
+    }
+
+    uint8_t* blob = (uint8_t*)mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+    close(descriptor);
+
+    if (blob == MAP_FAILED) {
+        printf("Failed to mmap %s\n", file_name);
+
+        return result;
+    }
+
+    mesh_file_header_t header = *(const mesh_file_header_t*)blob;
+    mesh_file_header_t expected = header;
+    vertex_format formats[VERTEX_ATTRIBUTE_TYPE_COUNT];
+    bool valid = header.magic == MESH_FILE_MAGIC && header.version == MESH_FILE_VERSION && header.submeshes_count > 0;
+
+    for (int i = 0; valid && i < VERTEX_ATTRIBUTE_TYPE_COUNT; ++i) {
+        valid = header.formats[i] <= VERTEX_FORMAT_UINT_16_4;
+        formats[i] = valid ? (vertex_format)header.formats[i] : VERTEX_FORMAT_NONE;
+    }
+
+    vertex_layout_t layout = vertex_layout_create(formats);
+
+    if (valid) {
+        mesh_file_header_layout(&expected);
+
+        valid = layout.stride == header.stride &&
+            (header.index_type == GL_UNSIGNED_SHORT || header.index_type == GL_UNSIGNED_INT) &&
+            memcmp(&expected, &header, sizeof(header)) == 0 &&
+            expected.size <= (uint64_t)status.st_size &&
+            header.indices_count <= INT32_MAX && header.meshlets_count <= INT32_MAX;
+    }
+
+    // Draws trust these ranges, so a corrupt file is rejected here rather than read out of bounds later
+    if (valid) {
+        const submesh_t* submeshes = (const submesh_t*)(blob + header.submeshes_offset);
+        const meshlet_t* meshlets = (const meshlet_t*)(blob + header.meshlets_offset);
+
+        for (size_t i = 0; valid && i < (size_t)(header.lods_count + 1) * header.submeshes_count; ++i) {
+            valid = mesh_file_check_range(&header, submeshes[i].base_vertex, submeshes[i].first_index, submeshes[i].indices_count);
+        }
+
+        for (uint32_t i = 0; valid && i < header.meshlets_count; ++i) {
+            valid = mesh_file_check_range(&header, meshlets[i].base_vertex, meshlets[i].first_index, meshlets[i].indices_count);
+        }
+    }
+
+    if (valid) {
+        const submesh_t* submeshes = (const submesh_t*)(blob + header.submeshes_offset);
+        const float* errors = (const float*)(blob + header.errors_offset);
+
+        result = mesh_upload(
+            &layout, header.vertices_count, blob + header.vertices_offset,
+            header.index_type, (GLsizei)header.indices_count, blob + header.indices_offset,
+            (GLsizei)header.submeshes_count, submeshes
+        );
+
+        memcpy(result.bounds, header.bounds, sizeof(header.bounds));
+
+        if (result.id && header.lods_count) {
+            result.lods = (mesh_lod_t*)calloc(header.lods_count, sizeof(mesh_lod_t));
+
+            for (uint32_t i = 0; result.lods && i < header.lods_count; ++i) {
+                result.lods[i].submeshes = (submesh_t*)calloc(header.submeshes_count, sizeof(submesh_t));
+                result.lods[i].error = errors[i];
+                result.lods_count = (GLsizei)i + 1;
+
+                if (!result.lods[i].submeshes) {
+                    break;
+                }
+
+                memcpy(result.lods[i].submeshes, &submeshes[(size_t)(i + 1) * header.submeshes_count], header.submeshes_count * sizeof(submesh_t));
+            }
+
+            // A partial LOD table is worse than none, mesh_select_lod expects every level
+            if (result.lods && result.lods[result.lods_count - 1].submeshes == NULL) {
+                for (GLsizei i = 0; i < result.lods_count; ++i) {
+                    free(result.lods[i].submeshes);
+                }
+
+                free(result.lods);
+                result.lods = NULL;
+                result.lods_count = 0;
+            }
+        }
+
+        if (result.id && header.meshlets_count) {
+            meshlet_t* meshlets = (meshlet_t*)malloc(header.meshlets_count * sizeof(meshlet_t));
+
+            if (meshlets) {
+                memcpy(meshlets, blob + header.meshlets_offset, header.meshlets_count * sizeof(meshlet_t));
+                mesh_attach_meshlets(&result, meshlets, (GLsizei)header.meshlets_count);
+            }
+        }
+    }
+    else {
+        printf("%s is not a cooked mesh\n", file_name);
+    }
+
+    munmap(blob, (size_t)status.st_size);
+
+    return result;
+}
+
+
+// Files with the .mesh extension are cooked by mesh_cook and loaded with mesh_load, mesh_options does not apply to them
+mesh_t mesh_create_ex(const char* file_name, const mesh_options_t* mesh_options) {
+    if (file_check_extension(file_name, "mesh")) {
+        return mesh_load(file_name);
+    }
+
+    mesh_data_t data = mesh_data_load(file_name, mesh_options);
+    mesh_t result = _mesh_create_(
+        NULL, (GLuint)data.vertices_count,
+        data.attributes[VERTEX_ATTRIBUTE_TYPE_POSITION],
+        data.attributes[VERTEX_ATTRIBUTE_TYPE_NORMAL],
+        data.attributes[VERTEX_ATTRIBUTE_TYPE_TEX_COORD],
+        data.attributes[VERTEX_ATTRIBUTE_TYPE_COLOR],
+        data.attributes[VERTEX_ATTRIBUTE_TYPE_TANGENT],
+        data.attributes[VERTEX_ATTRIBUTE_TYPE_JOINTS],
+        data.attributes[VERTEX_ATTRIBUTE_TYPE_WEIGHTS],
+        (GLsizei)data.indices_count, data.indices,
+        (GLsizei)data.submeshes_count, data.submeshes
     );
 
-    if (fragment_shader.id) {
-        shader_destroy(&fragment_shader);
+    if (result.id && data.lods) {
+        result.lods = data.lods;
+        result.lods_count = data.lods_count;
+        data.lods = NULL;
+        data.lods_count = 0;
+    }
+
+    if (result.id && data.meshlets) {
+        mesh_attach_meshlets(&result, data.meshlets, (GLsizei)data.meshlets_count);
+        data.meshlets = NULL;
+        data.meshlets_count = 0;
+    }
+
+    mesh_data_free(&data);
+
+    return result;
+}
+
+mesh_t mesh_create(const char* file_name) {
+    return mesh_create_ex(file_name, NULL);
+}
+
+void mesh_draw_submeshes(const mesh_t* self, const submesh_t* submeshes, GLsizei submeshes_count) {
+    if (submeshes_count <= 0) {
+        return;
+    }
+
+    GLsizei counts[submeshes_count];
+    const void* offsets[submeshes_count];
+    GLint base_vertices[submeshes_count];
+
+    for (GLsizei i = 0; i < submeshes_count; ++i) {
+        counts[i] = submeshes[i].indices_count;
+        offsets[i] = (const void*)((uintptr_t)submeshes[i].first_index * mesh_get_index_size(self->index_type));
+        base_vertices[i] = submeshes[i].base_vertex;
+    }
+
+    glBindVertexArray(self->id);
+    gl_debug();
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts, self->index_type, offsets, submeshes_count, base_vertices);
+    gl_debug();
+    glBindVertexArray(0);
+    gl_debug();
+}
+
+// Every submesh of the level of detail once per instance, gl_InstanceID indexes the instances in the shader
+void mesh_draw_instanced(const mesh_t* self, GLsizei lod, GLsizei instances_count) {
+    const submesh_t* submeshes = lod > 0 && lod <= self->lods_count ? self->lods[lod - 1].submeshes : self->submeshes;
+
+    if (instances_count <= 0) {
+        return;
+    }
+
+    glBindVertexArray(self->id);
+    gl_debug();
+
+    for (GLsizei i = 0; i < self->submeshes_count; ++i) {
+        const void* offset = (const void*)((uintptr_t)submeshes[i].first_index * mesh_get_index_size(self->index_type));
+
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, submeshes[i].indices_count, self->index_type, offset, instances_count, submeshes[i].base_vertex);
+        gl_debug();
+    }
+
+    glBindVertexArray(0);
+    gl_debug();
+}
+
+void mesh_draw(const mesh_t* self) {
+    mesh_draw_submeshes(self, self->submeshes, self->submeshes_count);
+}
+
+// 0 is the full detail mesh
+void mesh_draw_lod(const mesh_t* self, GLsizei lod) {
+    if (lod > 0 && lod <= self->lods_count) {
+        mesh_draw_submeshes(self, self->lods[lod - 1].submeshes, self->submeshes_count);
+    }
+    else {
+        mesh_draw(self);
+    }
+}
+
+// The coarsest level whose error projects to at most camera->lod_threshold pixels at the object's origin
+GLsizei mesh_select_lod(const mesh_t* self, const camera_t* camera, mat4 matrix) {
+    GLsizei result = 0;
+    float scale = 0.0f;
+    float pixels_per_unit = camera->projection[1][1] * camera->viewport_height * 0.5f;
+
+    if (!self->lods_count) {
+        return 0;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        float length = glm_vec3_norm(matrix[i]);
+
+        scale = length > scale ? length : scale;
+    }
+
+    // Perspective projections divide by the view depth
+    if (camera->projection[2][3] != 0.0f) {
+        vec4 center = { matrix[3][0], matrix[3][1], matrix[3][2], 1.0f };
+        vec4 view_center;
+
+        glm_mat4_mulv((vec4*)camera->view, center, view_center);
+
+        if (-view_center[2] <= FLT_EPSILON) {
+            return 0;
+        }
+
+        pixels_per_unit /= -view_center[2];
+    }
+
+    for (GLsizei i = 0; i < self->lods_count; ++i) {
+        if (self->lods[i].error * scale * pixels_per_unit > camera->lod_threshold) {
+            break;
+        }
+
+        result = i + 1;
+    }
+
+    return result;
+}
+
+// Visible meshlets of the full detail level as draw ranges, meshlets that follow each other in the index buffer merge into one range.
+// ranges needs room for self->meshlets_count entries. Back-face cone culling only applies to perspective projections.
+GLsizei mesh_cull_meshlets(const mesh_t* self, const camera_t* camera, mat4 matrix, submesh_t* ranges) {
+    GLsizei result = 0;
+    bool perspective = camera->projection[2][3] != 0.0f;
+    mat4 clip;
+    mat4 inverse;
+    vec4 planes[6];
+    vec4 eye = { camera->position[0], camera->position[1], camera->position[2], 1.0f };
+
+    glm_mat4_mul((vec4*)camera->projection, (vec4*)camera->view, clip);
+    glm_mat4_mul(clip, matrix, clip);
+    glm_frustum_planes(clip, planes);
+
+    // Planes and the eye in object space, the sphere and cone tests then need no per-meshlet transform
+    glm_mat4_inv(matrix, inverse);
+    glm_mat4_mulv(inverse, eye, eye);
+
+    for (GLsizei i = 0; i < self->meshlets_count; ++i) {
+        meshlet_t* meshlet = &self->meshlets[i];
+        bool visible = true;
+
+        for (int j = 0; visible && j < 6; ++j) {
+            visible = glm_vec3_dot(planes[j], meshlet->center) + planes[j][3] >= -meshlet->radius;
+        }
+
+        if (visible && perspective && meshlet->cone_cutoff < 1.0f) {
+            vec3 direction;
+
+            glm_vec3_sub(meshlet->center, eye, direction);
+
+            visible = glm_vec3_dot(direction, meshlet->cone_axis) < meshlet->cone_cutoff * glm_vec3_norm(direction) + meshlet->radius;
+        }
+
+        if (!visible) {
+            continue;
+        }
+
+        if (result && ranges[result - 1].base_vertex == meshlet->base_vertex && ranges[result - 1].first_index + (GLuint)ranges[result - 1].indices_count == meshlet->first_index) {
+            ranges[result - 1].indices_count += meshlet->indices_count;
+        }
+        else {
+            ranges[result++] = (submesh_t) {
+                .base_vertex = meshlet->base_vertex,
+                .first_index = meshlet->first_index,
+                .indices_count = meshlet->indices_count,
+                .material = -1
+            };
+        }
+    }
+
+    return result;
+}
+
+
+// Normalized planes of camera->projection * camera->view, a point is inside where dot(plane.xyz, point) + plane.w >= 0
+void camera_get_frustum(const camera_t* camera, vec4 planes[6]) {
+    mat4 clip;
+
+    glm_mat4_mul((vec4*)camera->projection, (vec4*)camera->view, clip);
+    glm_frustum_planes(clip, planes);
+}
+
+// Classifies count boxes given as six SoA arrays (center x, y, z, half extent x, y, z), each stride floats after the previous one.
+// A box is outside when it lies behind one plane and inside when it lies in front of all of them, 8 boxes per step with AVX2, 4 with SSE2.
+void frustum_test_boxes(const vec4 planes[6], const float* boxes, size_t stride, size_t count, uint8_t* results) {
+    const float* center_x = boxes;
+    const float* center_y = boxes + stride;
+    const float* center_z = boxes + stride * 2;
+    const float* extent_x = boxes + stride * 3;
+    const float* extent_y = boxes + stride * 4;
+    const float* extent_z = boxes + stride * 5;
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_loadu_ps(center_x + i), y = _mm256_loadu_ps(center_y + i), z = _mm256_loadu_ps(center_z + i);
+        __m256 ex = _mm256_loadu_ps(extent_x + i), ey = _mm256_loadu_ps(extent_y + i), ez = _mm256_loadu_ps(extent_z + i);
+        __m256 zero = _mm256_setzero_ps();
+        __m256 outside = zero;
+        __m256 intersecting = zero;
+
+        for (int j = 0; j < 6; ++j) {
+            __m256 distance = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes[j][0]), x), _mm256_mul_ps(_mm256_set1_ps(planes[j][1]), y)),
+                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes[j][2]), z), _mm256_set1_ps(planes[j][3]))
+            );
+            __m256 radius = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(fabsf(planes[j][0])), ex), _mm256_mul_ps(_mm256_set1_ps(fabsf(planes[j][1])), ey)),
+                _mm256_mul_ps(_mm256_set1_ps(fabsf(planes[j][2])), ez)
+            );
+
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_LT_OQ));
+            intersecting = _mm256_or_ps(intersecting, _mm256_cmp_ps(_mm256_sub_ps(distance, radius), zero, _CMP_LT_OQ));
+        }
+
+        int outside_mask = _mm256_movemask_ps(outside);
+        int intersecting_mask = _mm256_movemask_ps(intersecting);
+
+        for (int k = 0; k < 8; ++k) {
+            results[i + (size_t)k] = (uint8_t)((outside_mask >> k) & 1 ? FRUSTUM_TEST_OUTSIDE : (intersecting_mask >> k) & 1 ? FRUSTUM_TEST_INTERSECTING : FRUSTUM_TEST_INSIDE);
+        }
+    }
+#endif
+
+#if defined(__SSE2__)
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(center_x + i), y = _mm_loadu_ps(center_y + i), z = _mm_loadu_ps(center_z + i);
+        __m128 ex = _mm_loadu_ps(extent_x + i), ey = _mm_loadu_ps(extent_y + i), ez = _mm_loadu_ps(extent_z + i);
+        __m128 zero = _mm_setzero_ps();
+        __m128 outside = zero;
+        __m128 intersecting = zero;
+
+        for (int j = 0; j < 6; ++j) {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[j][0]), x), _mm_mul_ps(_mm_set1_ps(planes[j][1]), y)),
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[j][2]), z), _mm_set1_ps(planes[j][3]))
+            );
+            __m128 radius = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(fabsf(planes[j][0])), ex), _mm_mul_ps(_mm_set1_ps(fabsf(planes[j][1])), ey)),
+                _mm_mul_ps(_mm_set1_ps(fabsf(planes[j][2])), ez)
+            );
+
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+            intersecting = _mm_or_ps(intersecting, _mm_cmplt_ps(_mm_sub_ps(distance, radius), zero));
+        }
+
+        int outside_mask = _mm_movemask_ps(outside);
+        int intersecting_mask = _mm_movemask_ps(intersecting);
+
+        for (int k = 0; k < 4; ++k) {
+            results[i + (size_t)k] = (uint8_t)((outside_mask >> k) & 1 ? FRUSTUM_TEST_OUTSIDE : (intersecting_mask >> k) & 1 ? FRUSTUM_TEST_INTERSECTING : FRUSTUM_TEST_INSIDE);
+        }
+    }
+#endif
+
+    for (; i < count; ++i) {
+        uint8_t result = FRUSTUM_TEST_INSIDE;
+
+        for (int j = 0; j < 6; ++j) {
+            float distance = planes[j][0] * center_x[i] + planes[j][1] * center_y[i] + planes[j][2] * center_z[i] + planes[j][3];
+            float radius = fabsf(planes[j][0]) * extent_x[i] + fabsf(planes[j][1]) * extent_y[i] + fabsf(planes[j][2]) * extent_z[i];
+
+            if (distance + radius < 0.0f) {
+                result = FRUSTUM_TEST_OUTSIDE;
+                break;
+            }
+
+            if (distance - radius < 0.0f) {
+                result = FRUSTUM_TEST_INTERSECTING;
+            }
+        }
+
+        results[i] = result;
+    }
+}
+
+frustum_test frustum_test_box(const vec4 planes[6], vec3 bounds[2]) {
+    uint8_t result;
+    float box[6] = {
+        (bounds[0][0] + bounds[1][0]) * 0.5f,
+        (bounds[0][1] + bounds[1][1]) * 0.5f,
+        (bounds[0][2] + bounds[1][2]) * 0.5f,
+        (bounds[1][0] - bounds[0][0]) * 0.5f,
+        (bounds[1][1] - bounds[0][1]) * 0.5f,
+        (bounds[1][2] - bounds[0][2]) * 0.5f
+    };
+
+    frustum_test_boxes(planes, box, 1, 1, &result);
+
+    return (frustum_test)result;
+}
+
+// Tests the mesh bounds moved by matrix, skinned meshes can leave their bind pose bounds and should not be tested
+bool mesh_in_frustum(const mesh_t* self, const vec4 planes[6], mat4 matrix) {
+    vec3 bounds[2];
+
+    glm_aabb_transform((vec3*)self->bounds, matrix, bounds);
+
+    return frustum_test_box(planes, bounds) != FRUSTUM_TEST_OUTSIDE;
+}
+
+
+// Needs a current context, the storage itself is created by the first allocation
+ring_buffer_t ring_buffer_create() {
+    GLint alignment = 0;
+    ring_buffer_t result = {
+        .buffer = 0,
+        .data = NULL,
+        .region_size = 0,
+        .fences = { NULL },
+        .region = 0,
+        .offset = 0,
+        .storage_alignment = 16
+    };
+
+    // Queried once here, storage allocations are on the per-draw path
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    gl_debug();
+
+    if (alignment > result.storage_alignment) {
+        result.storage_alignment = alignment;
+    }
+
+    return result;
+}
+
+void ring_buffer_destroy(ring_buffer_t* self) {
+    for (int i = 0; i < RING_BUFFER_REGIONS; ++i) {
+        if (self->fences[i]) {
+            glDeleteSync(self->fences[i]);
+            gl_debug();
+        }
+    }
+
+    // Deleting unmaps it, the GL keeps the storage alive while submitted commands still read it
+    glDeleteBuffers(1, &self->buffer);
+    gl_debug();
+
+    *self = ring_buffer_create();
+}
+
+// Replaces the buffer by one with regions of at least region_size bytes, allocations already made stay valid for the GPU.
+// Rebind the buffer afterwards.
+bool ring_buffer_reserve(ring_buffer_t* self, GLsizeiptr region_size) {
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    if (region_size <= self->region_size) {
+        return true;
+    }
+
+    GLsizeiptr size = self->region_size ? self->region_size * 2 : 65536;
+
+    while (size < region_size) {
+        size *= 2;
+    }
+
+    ring_buffer_destroy(self);
+
+    glCreateBuffers(1, &self->buffer);
+    gl_debug();
+    glNamedBufferStorage(self->buffer, size * RING_BUFFER_REGIONS, NULL, flags);
+    gl_debug();
+    self->data = (uint8_t*)glMapNamedBufferRange(self->buffer, 0, size * RING_BUFFER_REGIONS, flags);
+    gl_debug();
+
+    if (!self->data) {
+        puts("Failed to map a ring buffer");
+        ring_buffer_destroy(self);
+        return false;
+    }
+
+    self->region_size = size;
+
+    return true;
+}
+
+// Fences the current region and moves to the next one, waiting while the GPU still reads it.
+// Called when a region runs full, per frame callers may also call it at the end of every frame.
+void ring_buffer_advance(ring_buffer_t* self) {
+    if (!self->buffer) {
+        return;
+    }
+
+    self->fences[self->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gl_debug();
+
+    self->region = (self->region + 1) % RING_BUFFER_REGIONS;
+    self->offset = 0;
+
+    if (self->fences[self->region]) {
+        while (glClientWaitSync(self->fences[self->region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+        }
+
+        gl_debug();
+        glDeleteSync(self->fences[self->region]);
+        gl_debug();
+        self->fences[self->region] = NULL;
+    }
+}
+
+GLintptr ring_buffer_align(const ring_buffer_t* self, GLsizeiptr alignment) {
+    GLintptr start = (GLintptr)self->region * self->region_size;
+
+    return (start + self->offset + alignment - 1) / alignment * alignment;
+}
+
+// Whether the allocation fits into what is left of the current region, otherwise allocating moves on to the next one
+bool ring_buffer_fits(const ring_buffer_t* self, GLsizeiptr size, GLsizeiptr alignment) {
+    return self->buffer && ring_buffer_align(self, alignment) + size <= (GLintptr)(self->region + 1) * self->region_size;
+}
+
+// Returns where to write size bytes at an offset that is a multiple of alignment (not necessarily a power of two), NULL when
+// out of memory. Moves to the next region when the current one is full and grows the buffer when size exceeds a region,
+// so issue the draws reading an allocation before making the next one.
+void* ring_buffer_allocate(ring_buffer_t* self, GLsizeiptr size, GLsizeiptr alignment, GLintptr* offset) {
+    if (!ring_buffer_reserve(self, size + alignment)) {
+        return NULL;
+    }
+
+    if (!ring_buffer_fits(self, size, alignment)) {
+        ring_buffer_advance(self);
+    }
+
+    GLintptr aligned = ring_buffer_align(self, alignment);
+
+    self->offset = aligned + size - (GLintptr)self->region * self->region_size;
+    *offset = aligned;
+
+    return self->data + aligned;
+}
+
+// Aligned for glBindBufferRange on GL_SHADER_STORAGE_BUFFER
+void* ring_buffer_allocate_storage(ring_buffer_t* self, GLsizeiptr size, GLintptr* offset) {
+    return ring_buffer_allocate(self, size, self->storage_alignment, offset);
+}
+
+
+#define GEOMETRY_POOL_MATRICES_BINDING 1
+
+// layout may be NULL for vertex_layout_default(), index_type is GL_UNSIGNED_SHORT or GL_UNSIGNED_INT.
+// Capacities are fixed for the lifetime of the pool.
+geometry_pool_t geometry_pool_create(const vertex_layout_t* layout, GLenum index_type, GLuint vertices_capacity, GLuint indices_capacity) {
+    geometry_pool_t result = {
+        .id = 0,
+        .vertex_buffer = 0,
+        .index_buffer = 0,
+        .layout = layout ? *layout : vertex_layout_default(),
+        .index_type = index_type == GL_UNSIGNED_SHORT ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+        .vertices = tlsf_create(vertices_capacity),
+        .indices = tlsf_create(indices_capacity),
+        .commands = NULL,
+        .matrices = NULL,
+        .draws_count = 0,
+        .draws_capacity = 0,
+        .stream = ring_buffer_create(),
+        .draw_id_buffer = 0,
+        .buffers_capacity = 0
+    };
+
+    if (!result.vertices.size || !result.indices.size) {
+        puts("Failed to create geometry pool allocators");
+        tlsf_destroy(&result.vertices);
+        tlsf_destroy(&result.indices);
+        return result;
+    }
+
+    glCreateBuffers(1, &result.vertex_buffer);
+    gl_debug();
+    glNamedBufferStorage(result.vertex_buffer, (GLsizeiptr)vertices_capacity * result.layout.stride, NULL, GL_DYNAMIC_STORAGE_BIT);
+    gl_debug();
+    glCreateBuffers(1, &result.index_buffer);
+    gl_debug();
+    glNamedBufferStorage(result.index_buffer, (GLsizeiptr)(indices_capacity * mesh_get_index_size(result.index_type)), NULL, GL_DYNAMIC_STORAGE_BIT);
+    gl_debug();
+
+    glCreateVertexArrays(1, &result.id);
+    gl_debug();
+    glVertexArrayVertexBuffer(result.id, 0, result.vertex_buffer, 0, (GLsizei)result.layout.stride);
+    gl_debug();
+    glVertexArrayElementBuffer(result.id, result.index_buffer);
+    gl_debug();
+
+    vertex_layout_apply(&result.layout, result.id, 0);
+
+    // The draw id follows the attributes, one per instance from binding 1, so it reads base_instance
+    glEnableVertexArrayAttrib(result.id, VERTEX_ATTRIBUTE_TYPE_COUNT);
+    gl_debug();
+    glVertexArrayAttribIFormat(result.id, VERTEX_ATTRIBUTE_TYPE_COUNT, 1, GL_UNSIGNED_INT, 0);
+    gl_debug();
+    glVertexArrayAttribBinding(result.id, VERTEX_ATTRIBUTE_TYPE_COUNT, 1);
+    gl_debug();
+    glVertexArrayBindingDivisor(result.id, 1, 1);
+    gl_debug();
+
+    return result;
+}
+
+// Copies the decoded mesh into the pool, an empty geometry (no submeshes) when it does not fit.
+// Attributes the mesh does not have are zero in the pool's layout.
+geometry_t geometry_pool_add(geometry_pool_t* self, const mesh_data_t* data) {
+    geometry_t result = {
+        .vertices_block = -1,
+        .indices_block = -1,
+        .submeshes = NULL,
+        .submeshes_count = 0,
+        .lods = NULL,
+        .lods_count = 0
+    };
+    GLuint base_vertex = 0;
+    GLuint first_index = 0;
+    void* vertices = NULL;
+    void* indices = NULL;
+
+    if (!data->vertices_count || !data->indices || !data->submeshes_count) {
+        return result;
+    }
+
+    if (self->index_type == GL_UNSIGNED_SHORT && mesh_select_index_type(data->indices, data->indices_count) != GL_UNSIGNED_SHORT) {
+        puts("Mesh needs 32-bit indices, load it with short_indices for this geometry pool");
+        return result;
+    }
+
+    result.vertices_block = tlsf_allocate(&self->vertices, (uint32_t)data->vertices_count, &base_vertex);
+    result.indices_block = tlsf_allocate(&self->indices, (uint32_t)data->indices_count, &first_index);
+    vertices = calloc(data->vertices_count, self->layout.stride);
+    indices = malloc(data->indices_count * mesh_get_index_size(self->index_type));
+    result.submeshes = (submesh_t*)malloc(data->submeshes_count * sizeof(submesh_t));
+    result.lods = data->lods_count ? (mesh_lod_t*)calloc((size_t)data->lods_count, sizeof(mesh_lod_t)) : NULL;
+
+    bool failed = result.vertices_block < 0 || result.indices_block < 0 || !vertices || !indices || !result.submeshes || (data->lods_count && !result.lods);
+
+    for (GLsizei i = 0; !failed && i < data->lods_count; ++i) {
+        result.lods[i].submeshes = (submesh_t*)malloc(data->submeshes_count * sizeof(submesh_t));
+        result.lods[i].error = data->lods[i].error;
+        result.lods_count = i + 1;
+        failed = !result.lods[i].submeshes;
+    }
+
+    if (failed) {
+        puts("Geometry pool is full");
+
+        tlsf_free(&self->vertices, result.vertices_block);
+        tlsf_free(&self->indices, result.indices_block);
+
+        for (GLsizei i = 0; i < result.lods_count; ++i) {
+            free(result.lods[i].submeshes);
+        }
+
+        free(result.lods);
+        free(result.submeshes);
+        free(vertices);
+        free(indices);
+
+        return (geometry_t) {
+            .vertices_block = -1,
+            .indices_block = -1
+        };
+    }
+
+    vertex_layout_pack(&self->layout, (GLuint)data->vertices_count, (const GLfloat* const*)data->attributes, vertices);
+    mesh_pack_indices(self->index_type, data->indices, data->indices_count, indices);
+
+    glNamedBufferSubData(self->vertex_buffer, (GLintptr)base_vertex * self->layout.stride, (GLsizeiptr)(data->vertices_count * self->layout.stride), vertices);
+    gl_debug();
+    glNamedBufferSubData(self->index_buffer, (GLintptr)(first_index * mesh_get_index_size(self->index_type)), (GLsizeiptr)(data->indices_count * mesh_get_index_size(self->index_type)), indices);
+    gl_debug();
+
+    free(vertices);
+    free(indices);
+
+    for (size_t i = 0; i < data->submeshes_count; ++i) {
+        result.submeshes[i] = data->submeshes[i];
+        result.submeshes[i].base_vertex += (GLint)base_vertex;
+        result.submeshes[i].first_index += first_index;
+
+        for (GLsizei j = 0; j < result.lods_count; ++j) {
+            result.lods[j].submeshes[i] = data->lods[j].submeshes[i];
+            result.lods[j].submeshes[i].base_vertex += (GLint)base_vertex;
+            result.lods[j].submeshes[i].first_index += first_index;
+        }
+    }
+
+    result.submeshes_count = (GLsizei)data->submeshes_count;
+
+    return result;
+}
+
+// Decodes a glTF file with mesh_options (may be NULL) straight into the pool
+geometry_t geometry_pool_load(geometry_pool_t* self, const char* file_name, const mesh_options_t* mesh_options) {
+    mesh_data_t data = mesh_data_load(file_name, mesh_options);
+    geometry_t result = geometry_pool_add(self, &data);
+
+    mesh_data_free(&data);
+
+    return result;
+}
+
+// Releases the geometry's ranges, draws of it still queued must be flushed first
+void geometry_pool_remove(geometry_pool_t* self, geometry_t* geometry) {
+    tlsf_free(&self->vertices, geometry->vertices_block);
+    tlsf_free(&self->indices, geometry->indices_block);
+
+    for (GLsizei i = 0; i < geometry->lods_count; ++i) {
+        free(geometry->lods[i].submeshes);
+    }
+
+    free(geometry->lods);
+    free(geometry->submeshes);
+
+    *geometry = (geometry_t) {
+        .vertices_block = -1,
+        .indices_block = -1
+    };
+}
+
+// Queues every submesh of the geometry at the level of detail, 0 is the full detail one
+bool geometry_pool_draw(geometry_pool_t* self, const geometry_t* geometry, GLsizei lod, mat4 matrix) {
+    const submesh_t* submeshes = lod > 0 && lod <= geometry->lods_count ? geometry->lods[lod - 1].submeshes : geometry->submeshes;
+
+    if (self->draws_count + geometry->submeshes_count > self->draws_capacity) {
+        GLsizei capacity = self->draws_capacity ? self->draws_capacity : 256;
+
+        while (capacity < self->draws_count + geometry->submeshes_count) {
+            capacity *= 2;
+        }
+
+        draw_elements_indirect_command_t* commands = (draw_elements_indirect_command_t*)realloc(self->commands, (size_t)capacity * sizeof(draw_elements_indirect_command_t));
+        mat4* matrices = (mat4*)aligned_alloc(32, (size_t)capacity * sizeof(mat4));
+
+        if (commands) {
+            self->commands = commands;
+        }
+
+        if (!commands || !matrices) {
+            free(matrices);
+            return false;
+        }
+
+        if (self->matrices) {
+            memcpy(matrices, self->matrices, (size_t)self->draws_count * sizeof(mat4));
+            free(self->matrices);
+        }
+
+        self->matrices = matrices;
+        self->draws_capacity = capacity;
+    }
+
+    for (GLsizei i = 0; i < geometry->submeshes_count; ++i) {
+        GLsizei draw = self->draws_count++;
+
+        self->commands[draw] = (draw_elements_indirect_command_t) {
+            .count = (GLuint)submeshes[i].indices_count,
+            .instance_count = 1,
+            .first_index = submeshes[i].first_index,
+            .base_vertex = submeshes[i].base_vertex,
+            .base_instance = (GLuint)draw
+        };
+        glm_mat4_copy(matrix, self->matrices[draw]);
+    }
+
+    return true;
+}
+
+// Draws everything queued since the last flush with the program, which reads the draw's matrix when draw_indirect is set
+void geometry_pool_flush(geometry_pool_t* self, const program_t* program, const camera_t* camera) {
+    mat4 identity = GLM_MAT4_IDENTITY_INIT;
+
+    if (!self->draws_count) {
+        return;
+    }
+
+    if (self->draws_capacity > self->buffers_capacity) {
+        GLuint* draw_ids = (GLuint*)malloc((size_t)self->draws_capacity * sizeof(GLuint));
+
+        if (!draw_ids) {
+            self->draws_count = 0;
+            return;
+        }
+
+        for (GLsizei i = 0; i < self->draws_capacity; ++i) {
+            draw_ids[i] = (GLuint)i;
+        }
+
+        glDeleteBuffers(1, &self->draw_id_buffer);
+        gl_debug();
+
+        glCreateBuffers(1, &self->draw_id_buffer);
+        gl_debug();
+        glNamedBufferStorage(self->draw_id_buffer, (GLsizeiptr)sizeof(GLuint) * self->draws_capacity, draw_ids, 0);
+        gl_debug();
+        glVertexArrayVertexBuffer(self->id, 1, self->draw_id_buffer, 0, sizeof(GLuint));
+        gl_debug();
+
+        free(draw_ids);
+
+        self->buffers_capacity = self->draws_capacity;
+    }
+
+    // Matrices first, then the commands, in one allocation so both land in the same region
+    GLsizeiptr matrices_size = (GLsizeiptr)sizeof(mat4) * self->draws_count;
+    GLsizeiptr commands_size = (GLsizeiptr)sizeof(draw_elements_indirect_command_t) * self->draws_count;
+    GLintptr matrices_offset = 0;
+    uint8_t* data = (uint8_t*)ring_buffer_allocate_storage(&self->stream, matrices_size + commands_size, &matrices_offset);
+    GLintptr commands_offset = matrices_offset + matrices_size;
+
+    if (!data) {
+        self->draws_count = 0;
+        return;
+    }
+
+    memcpy(data, self->matrices, (size_t)matrices_size);
+    memcpy(data + matrices_size, self->commands, (size_t)commands_size);
+
+    program_use(program, camera, identity);
+    glUniform1i(glGetUniformLocation(program->id, "draw_indirect"), 1);
+    gl_debug();
+    glUniform1i(glGetUniformLocation(program->id, "joints_offset"), -1);
+    gl_debug();
+
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, GEOMETRY_POOL_MATRICES_BINDING, self->stream.buffer, matrices_offset, matrices_size);
+    gl_debug();
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, self->stream.buffer);
+    gl_debug();
+    glBindVertexArray(self->id);
+    gl_debug();
+    glMultiDrawElementsIndirect(GL_TRIANGLES, self->index_type, (const void*)commands_offset, self->draws_count, 0);
+    gl_debug();
+    glBindVertexArray(0);
+    gl_debug();
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    gl_debug();
+
+    glUniform1i(glGetUniformLocation(program->id, "draw_indirect"), 0);
+    gl_debug();
+
+    self->draws_count = 0;
+}
+
+void geometry_pool_destroy(geometry_pool_t* self) {
+    glDeleteVertexArrays(1, &self->id);
+    gl_debug();
+    glDeleteBuffers(1, &self->vertex_buffer);
+    gl_debug();
+    glDeleteBuffers(1, &self->index_buffer);
+    gl_debug();
+    ring_buffer_destroy(&self->stream);
+    glDeleteBuffers(1, &self->draw_id_buffer);
+    gl_debug();
+
+    tlsf_destroy(&self->vertices);
+    tlsf_destroy(&self->indices);
+
+    free(self->commands);
+    free(self->matrices);
+
+    self->id = 0;
+    self->vertex_buffer = 0;
+    self->index_buffer = 0;
+    self->commands = NULL;
+    self->matrices = NULL;
+    self->draws_count = 0;
+    self->draws_capacity = 0;
+    self->draw_id_buffer = 0;
+    self->buffers_capacity = 0;
+}
+
+
+// Approximate slerp (Kapoulkine, "Approximating slerp"): nlerp with a corrected factor, within 1e-3 radians of slerp.
+// Runs over arrays of xyzw quaternions so batches of channels from many instances go through the SIMD path together.
+void quat_slerp_batch(const versor* from, const versor* to, const float* factors, versor* results, size_t count) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 ax = _mm_loadu_ps(from[i]), ay = _mm_loadu_ps(from[i + 1]), az = _mm_loadu_ps(from[i + 2]), aw = _mm_loadu_ps(from[i + 3]);
+        __m128 bx = _mm_loadu_ps(to[i]), by = _mm_loadu_ps(to[i + 1]), bz = _mm_loadu_ps(to[i + 2]), bw = _mm_loadu_ps(to[i + 3]);
+        __m128 t = _mm_loadu_ps(&factors[i]);
+
+        _MM_TRANSPOSE4_PS(ax, ay, az, aw);
+        _MM_TRANSPOSE4_PS(bx, by, bz, bw);
+
+        __m128 cosine = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+        __m128 sign = _mm_and_ps(cosine, sign_mask);
+        __m128 d = _mm_andnot_ps(sign_mask, cosine);
+        __m128 a = _mm_add_ps(_mm_set1_ps(1.0904f), _mm_mul_ps(d, _mm_add_ps(_mm_set1_ps(-3.2452f), _mm_mul_ps(d, _mm_sub_ps(_mm_set1_ps(3.55645f), _mm_mul_ps(d, _mm_set1_ps(1.43519f)))))));
+        __m128 b = _mm_add_ps(_mm_set1_ps(0.848013f), _mm_mul_ps(d, _mm_add_ps(_mm_set1_ps(-1.06021f), _mm_mul_ps(d, _mm_set1_ps(0.215638f)))));
+        __m128 centered = _mm_sub_ps(t, half);
+        __m128 k = _mm_add_ps(_mm_mul_ps(a, _mm_mul_ps(centered, centered)), b);
+        __m128 corrected = _mm_add_ps(t, _mm_mul_ps(_mm_mul_ps(t, centered), _mm_mul_ps(_mm_sub_ps(t, one), k)));
+        __m128 weight_a = _mm_sub_ps(one, corrected);
+        __m128 weight_b = _mm_xor_ps(corrected, sign);
+        __m128 x = _mm_add_ps(_mm_mul_ps(ax, weight_a), _mm_mul_ps(bx, weight_b));
+        __m128 y = _mm_add_ps(_mm_mul_ps(ay, weight_a), _mm_mul_ps(by, weight_b));
+        __m128 z = _mm_add_ps(_mm_mul_ps(az, weight_a), _mm_mul_ps(bz, weight_b));
+        __m128 w = _mm_add_ps(_mm_mul_ps(aw, weight_a), _mm_mul_ps(bw, weight_b));
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w))));
+        __m128 scale = _mm_div_ps(one, length);
+
+        x = _mm_mul_ps(x, scale);
+        y = _mm_mul_ps(y, scale);
+        z = _mm_mul_ps(z, scale);
+        w = _mm_mul_ps(w, scale);
+
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+
+        _mm_storeu_ps(results[i], x);
+        _mm_storeu_ps(results[i + 1], y);
+        _mm_storeu_ps(results[i + 2], z);
+        _mm_storeu_ps(results[i + 3], w);
+    }
+#endif
+
+    for (; i < count; ++i) {
+        float t = factors[i];
+        float cosine = glm_vec4_dot((float*)from[i], (float*)to[i]);
+        float d = fabsf(cosine);
+        float a = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+        float b = 0.848013f + d * (-1.06021f + d * 0.215638f);
+        float k = a * (t - 0.5f) * (t - 0.5f) + b;
+        float corrected = t + t * (t - 0.5f) * (t - 1.0f) * k;
+        float weight_b = cosine < 0.0f ? -corrected : corrected;
+        float length = 0.0f;
+
+        for (int j = 0; j < 4; ++j) {
+            results[i][j] = from[i][j] * (1.0f - corrected) + to[i][j] * weight_b;
+            length += results[i][j] * results[i][j];
+        }
+
+        glm_vec4_scale(results[i], 1.0f / sqrtf(length), results[i]);
+    }
+}
+
+
+void animation_destroy(animation_t* self) {
+    for (size_t i = 0; i < self->channels_count; ++i) {
+        free(self->channels[i].times);
+        free(self->channels[i].values);
+    }
+
+    if (self->channels) {
+        free(self->channels);
+        self->channels = NULL;
+    }
+
+    if (self->name) {
+        free(self->name);
+        self->name = NULL;
+    }
+
+    self->channels_count = 0;
+    self->duration = 0.0f;
+}
+
+// joints maps node indices of the file to joint indices, -1 for nodes outside the skin
+animation_t animation_load(const cgltf_data* data, const cgltf_animation* animation, const GLint* joints) {
+    animation_t result = {
+        .name = NULL,
+        .channels = NULL,
+        .channels_count = 0,
+        .duration = 0.0f
+    };
+
+    result.channels = (animation_channel_t*)calloc(animation->channels_count, sizeof(animation_channel_t));
+
+    if (!result.channels) {
+        return result;
+    }
+
+    if (animation->name) {
+        size_t size = strlen(animation->name);
+
+        result.name = (char*)calloc(size + 1, sizeof(char));
+
+        if (result.name) {
+            memcpy(result.name, animation->name, size);
+        }
+    }
+
+    for (size_t i = 0; i < animation->channels_count; ++i) {
+        const cgltf_animation_channel* channel = &animation->channels[i];
+        const cgltf_animation_sampler* sampler = channel->sampler;
+        animation_channel_t* destination = &result.channels[result.channels_count];
+        size_t components = channel->target_path == cgltf_animation_path_type_rotation ? 4 : 3;
+        size_t values_per_key = sampler->interpolation == cgltf_interpolation_type_cubic_spline ? 3 : 1;
+        GLint joint = channel->target_node ? joints[channel->target_node - data->nodes] : -1;
+        float* values = NULL;
+
+        if (joint < 0 || !sampler->input->count || sampler->output->count < sampler->input->count * values_per_key) {
+            continue;
+        }
+
+        switch (channel->target_path) {
+            case cgltf_animation_path_type_translation: destination->path = ANIMATION_PATH_TRANSLATION; break;
+            case cgltf_animation_path_type_rotation: destination->path = ANIMATION_PATH_ROTATION; break;
+            case cgltf_animation_path_type_scale: destination->path = ANIMATION_PATH_SCALE; break;
+            default: continue;
+        }
+
+        destination->joint = joint;
+        destination->step = sampler->interpolation == cgltf_interpolation_type_step;
+        destination->keys_count = sampler->input->count;
+        destination->times = (float*)calloc(destination->keys_count, sizeof(float));
+        destination->values = (float*)calloc(destination->keys_count * components, sizeof(float));
+        values = (float*)calloc(sampler->output->count * components, sizeof(float));
+
+        if (!destination->times || !destination->values || !values) {
+            free(destination->times);
+            free(destination->values);
+            free(values);
+            continue;
+        }
+
+        accessor_read_floats(sampler->input, destination->times, 1, destination->keys_count);
+        accessor_read_floats(sampler->output, values, components, sampler->output->count);
+
+        // Cubic spline outputs are in-tangent, value, out-tangent triples
+        for (size_t j = 0; j < destination->keys_count; ++j) {
+            memcpy(&destination->values[j * components], &values[(j * values_per_key + values_per_key / 2) * components], components * sizeof(float));
+        }
+
+        free(values);
+
+        if (destination->times[destination->keys_count - 1] > result.duration) {
+            result.duration = destination->times[destination->keys_count - 1];
+        }
+
+        ++result.channels_count;
+    }
+
+    return result;
+}
+
+void skeleton_destroy(skeleton_t* self) {
+    for (size_t i = 0; i < self->animations_count; ++i) {
+        animation_destroy(&self->animations[i]);
+    }
+
+    free(self->animations);
+    free(self->parents);
+    free(self->order);
+    free(self->inverse_bind_matrices);
+    free(self->root_matrices);
+    free(self->translations);
+    free(self->rotations);
+    free(self->scales);
+
+    *self = (skeleton_t) {
+        .joints_count = 0,
+        .parents = NULL,
+        .order = NULL,
+        .inverse_bind_matrices = NULL,
+        .root_matrices = NULL,
+        .translations = NULL,
+        .rotations = NULL,
+        .scales = NULL,
+        .animations = NULL,
+        .animations_count = 0
+    };
+}
+
+// The first skin of the file with its rest pose and every animation that moves its joints
+skeleton_t skeleton_create(const char* file_name) {
+    skeleton_t result = {
+        .joints_count = 0,
+        .parents = NULL,
+        .order = NULL,
+        .inverse_bind_matrices = NULL,
+        .root_matrices = NULL,
+        .translations = NULL,
+        .rotations = NULL,
+        .scales = NULL,
+        .animations = NULL,
+        .animations_count = 0
+    };
+    cgltf_options options = {
+        .type = cgltf_file_type_invalid,
+        .json_token_count = 0,
+        .memory = {
+            .alloc = NULL,
+            .free = NULL,
+            .user_data = NULL
+        },
+        .file = {
+            .read = NULL,
+            .release = NULL,
+            .user_data = NULL
+        }
+    };
+    cgltf_data* data = NULL;
+
+    if (!file_name || cgltf_parse_file(&options, file_name, &data) != cgltf_result_success) {
+        puts("Failed to cgltf_parse_file()");
+        return result;
+    }
+
+    if (cgltf_load_buffers(&options, data, file_name) != cgltf_result_success || !data->skins_count || !data->skins[0].joints_count) {
+        printf("No skin in %s\n", file_name);
+        cgltf_free(data);
+        return result;
+    }
+
+    const cgltf_skin* skin = &data->skins[0];
+    size_t count = skin->joints_count;
+    GLint* joints = (GLint*)malloc(data->nodes_count * sizeof(GLint));
+    GLsizei* depths = (GLsizei*)calloc(count, sizeof(GLsizei));
+
+    result.parents = (GLint*)calloc(count, sizeof(GLint));
+    result.order = (GLsizei*)calloc(count, sizeof(GLsizei));
+    result.inverse_bind_matrices = (mat4*)aligned_alloc(32, count * sizeof(mat4));
+    result.root_matrices = (mat4*)aligned_alloc(32, count * sizeof(mat4));
+    result.translations = (vec3*)calloc(count, sizeof(vec3));
+    result.rotations = (versor*)calloc(count, sizeof(versor));
+    result.scales = (vec3*)calloc(count, sizeof(vec3));
+    result.animations = (animation_t*)calloc(data->animations_count ? data->animations_count : 1, sizeof(animation_t));
+
+    if (!joints || !depths || !result.parents || !result.order || !result.inverse_bind_matrices || !result.root_matrices || !result.translations || !result.rotations || !result.scales || !result.animations) {
+        free(joints);
+        free(depths);
+        skeleton_destroy(&result);
+        cgltf_free(data);
+        return result;
+    }
+
+    result.joints_count = (GLsizei)count;
+
+    for (size_t i = 0; i < data->nodes_count; ++i) {
+        joints[i] = -1;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        joints[skin->joints[i] - data->nodes] = (GLint)i;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const cgltf_node* node = skin->joints[i];
+
+        result.parents[i] = node->parent ? joints[node->parent - data->nodes] : -1;
+
+        glm_mat4_identity(result.root_matrices[i]);
+        glm_mat4_identity(result.inverse_bind_matrices[i]);
+
+        if (result.parents[i] < 0 && node->parent) {
+            cgltf_node_transform_world(node->parent, &result.root_matrices[i][0][0]);
+        }
+
+        if (skin->inverse_bind_matrices) {
+            cgltf_accessor_read_float(skin->inverse_bind_matrices, i, &result.inverse_bind_matrices[i][0][0], 16);
+        }
+
+        if (node->has_matrix) {
+            mat4 matrix;
+            mat4 rotation;
+            vec4 translation;
+
+            memcpy(matrix, node->matrix, sizeof(matrix));
+            glm_decompose(matrix, translation, rotation, result.scales[i]);
+            glm_vec3_copy(translation, result.translations[i]);
+            glm_mat4_quat(rotation, result.rotations[i]);
+        }
+        else {
+            glm_vec3_zero(result.translations[i]);
+            glm_quat_identity(result.rotations[i]);
+            glm_vec3_one(result.scales[i]);
+
+            if (node->has_translation) {
+                memcpy(result.translations[i], node->translation, sizeof(vec3));
+            }
+
+            if (node->has_rotation) {
+                memcpy(result.rotations[i], node->rotation, sizeof(versor));
+            }
+
+            if (node->has_scale) {
+                memcpy(result.scales[i], node->scale, sizeof(vec3));
+            }
+        }
+    }
+
+    // Sorting by depth puts every parent before its children
+    for (size_t i = 0; i < count; ++i) {
+        for (GLint parent = result.parents[i]; parent >= 0 && depths[i] < (GLsizei)count; parent = result.parents[parent]) {
+            ++depths[i];
+        }
+    }
+
+    for (GLsizei depth = 0, next = 0; next < (GLsizei)count && depth <= (GLsizei)count; ++depth) {
+        for (size_t i = 0; i < count; ++i) {
+            if (depths[i] == depth) {
+                result.order[next++] = (GLsizei)i;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < data->animations_count; ++i) {
+        animation_t animation = animation_load(data, &data->animations[i], joints);
+
+        if (animation.channels_count) {
+            result.animations[result.animations_count++] = animation;
+        }
+        else {
+            animation_destroy(&animation);
+        }
+    }
+
+    free(joints);
+    free(depths);
+    cgltf_free(data);
+
+    return result;
+}
+
+// -1 when the skeleton has no animation with that name
+GLsizei skeleton_find_animation(const skeleton_t* self, const char* name) {
+    for (size_t i = 0; i < self->animations_count; ++i) {
+        if (self->animations[i].name && strcmp(self->animations[i].name, name) == 0) {
+            return (GLsizei)i;
+        }
+    }
+
+    return -1;
+}
+
+
+#define ANIMATOR_BATCH_SIZE 16
+
+animator_t animator_create(job_pool_t* job_pool) {
+    animator_t result = {
+        .job_pool = job_pool,
+        .instances = NULL,
+        .instances_count = 0,
+        .instances_capacity = 0,
+        .palette = NULL,
+        .palette_count = 0,
+        .palette_capacity = 0,
+        .jobs = NULL,
+        .jobs_count = 0,
+        .stream = ring_buffer_create(),
+        .palette_offset = 0
+    };
+
+    return result;
+}
+
+// Returns the instance, -1 when out of memory. The skeleton must outlive the animator.
+GLsizei animator_add(animator_t* self, const skeleton_t* skeleton) {
+    if (self->instances_count == self->instances_capacity) {
+        size_t capacity = self->instances_capacity ? self->instances_capacity * 2 : 16;
+        animator_instance_t* instances = (animator_instance_t*)realloc(self->instances, capacity * sizeof(animator_instance_t));
+
+        if (!instances) {
+            return -1;
+        }
+
+        self->instances = instances;
+        self->instances_capacity = capacity;
+    }
+
+    if (self->palette_count + skeleton->joints_count > self->palette_capacity) {
+        GLsizei capacity = self->palette_capacity ? self->palette_capacity : 256;
+
+        while (capacity < self->palette_count + skeleton->joints_count) {
+            capacity *= 2;
+        }
+
+        mat4* palette = (mat4*)aligned_alloc(32, (size_t)capacity * sizeof(mat4));
+
+        if (!palette) {
+            return -1;
+        }
+
+        if (self->palette) {
+            memcpy(palette, self->palette, (size_t)self->palette_count * sizeof(mat4));
+            free(self->palette);
+        }
+
+        self->palette = palette;
+        self->palette_capacity = capacity;
+    }
+
+    for (GLsizei i = 0; i < skeleton->joints_count; ++i) {
+        glm_mat4_identity(self->palette[self->palette_count + i]);
+    }
+
+    self->instances[self->instances_count] = (animator_instance_t) {
+        .skeleton = skeleton,
+        .animation = -1,
+        .time = 0.0f,
+        .palette_offset = self->palette_count
+    };
+    self->palette_count += skeleton->joints_count;
+
+    return (GLsizei)self->instances_count++;
+}
+
+void animator_play(animator_t* self, GLsizei instance, GLsizei animation, float time) {
+    self->instances[instance].animation = animation;
+    self->instances[instance].time = time;
+}
+
+// The joints_offset of objects drawn with the instance's pose
+GLint animator_get_joints_offset(const animator_t* self, GLsizei instance) {
+    return self->instances[instance].palette_offset;
+}
+
+bool animator_job_reserve(animator_job_t* self, size_t joints_count, size_t slerps_count) {
+    if (joints_count > self->joints_capacity) {
+        free(self->translations);
+        free(self->rotations);
+        free(self->scales);
+        free(self->globals);
+
+        self->translations = (vec3*)malloc(joints_count * sizeof(vec3));
+        self->rotations = (versor*)malloc(joints_count * sizeof(versor));
+        self->scales = (vec3*)malloc(joints_count * sizeof(vec3));
+        self->globals = (mat4*)aligned_alloc(32, joints_count * sizeof(mat4));
+        self->joints_capacity = self->translations && self->rotations && self->scales && self->globals ? joints_count : 0;
+    }
+
+    if (slerps_count > self->slerps_capacity) {
+        free(self->slerp_from);
+        free(self->slerp_to);
+        free(self->slerp_factors);
+        free(self->slerp_results);
+        free(self->slerp_targets);
+
+        self->slerp_from = (versor*)malloc(slerps_count * sizeof(versor));
+        self->slerp_to = (versor*)malloc(slerps_count * sizeof(versor));
+        self->slerp_factors = (float*)malloc(slerps_count * sizeof(float));
+        self->slerp_results = (versor*)malloc(slerps_count * sizeof(versor));
+        self->slerp_targets = (float**)malloc(slerps_count * sizeof(float*));
+        self->slerps_capacity = self->slerp_from && self->slerp_to && self->slerp_factors && self->slerp_results && self->slerp_targets ? slerps_count : 0;
+    }
+
+    return self->joints_capacity >= joints_count && self->slerps_capacity >= slerps_count;
+}
+
+// Key before time and the blend factor towards the next one
+size_t animation_channel_find_key(const animation_channel_t* self, float time, float* factor) {
+    size_t low = 0;
+    size_t high = self->keys_count;
+
+    *factor = 0.0f;
+
+    if (time <= self->times[0]) {
+        return 0;
+    }
+
+    if (time >= self->times[self->keys_count - 1]) {
+        return self->keys_count - 1;
+    }
+
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+
+        if (self->times[middle] <= time) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    if (!self->step && self->times[low + 1] > self->times[low]) {
+        *factor = (time - self->times[low]) / (self->times[low + 1] - self->times[low]);
+    }
+
+    return low;
+}
+
+void animator_job(void* data) {
+    animator_job_t* self = (animator_job_t*)data;
+    animator_instance_t* instances = &self->animator->instances[self->first_instance];
+    size_t joints_count = 0;
+    size_t slerps_count = 0;
+    size_t slerp = 0;
+    size_t offset = 0;
+
+    for (size_t i = 0; i < self->instances_count; ++i) {
+        joints_count += (size_t)instances[i].skeleton->joints_count;
+
+        if (instances[i].animation >= 0) {
+            slerps_count += instances[i].skeleton->animations[instances[i].animation].channels_count;
+        }
+    }
+
+    if (!animator_job_reserve(self, joints_count, slerps_count)) {
+        return;
+    }
+
+    // Rest pose, then every channel overrides its property. Rotations are queued for one batched slerp.
+    for (size_t i = 0; i < self->instances_count; ++i) {
+        const skeleton_t* skeleton = instances[i].skeleton;
+        size_t count = (size_t)skeleton->joints_count;
+
+        memcpy(&self->translations[offset], skeleton->translations, count * sizeof(vec3));
+        memcpy(&self->rotations[offset], skeleton->rotations, count * sizeof(versor));
+        memcpy(&self->scales[offset], skeleton->scales, count * sizeof(vec3));
+
+        if (instances[i].animation >= 0) {
+            const animation_t* animation = &skeleton->animations[instances[i].animation];
+
+            for (size_t j = 0; j < animation->channels_count; ++j) {
+                const animation_channel_t* channel = &animation->channels[j];
+                float factor = 0.0f;
+                size_t key = animation_channel_find_key(channel, instances[i].time, &factor);
+                size_t next = key + 1 < channel->keys_count ? key + 1 : key;
+                size_t joint = offset + (size_t)channel->joint;
+
+                switch (channel->path) {
+                    case ANIMATION_PATH_TRANSLATION: {
+                        glm_vec3_lerp(&channel->values[key * 3], &channel->values[next * 3], factor, self->translations[joint]);
+                    } break;
+                    case ANIMATION_PATH_SCALE: {
+                        glm_vec3_lerp(&channel->values[key * 3], &channel->values[next * 3], factor, self->scales[joint]);
+                    } break;
+                    case ANIMATION_PATH_ROTATION: {
+                        memcpy(self->slerp_from[slerp], &channel->values[key * 4], sizeof(versor));
+                        memcpy(self->slerp_to[slerp], &channel->values[next * 4], sizeof(versor));
+                        self->slerp_factors[slerp] = factor;
+                        self->slerp_targets[slerp] = self->rotations[joint];
+                        ++slerp;
+                    } break;
+                }
+            }
+        }
+
+        offset += count;
+    }
+
+    quat_slerp_batch(self->slerp_from, self->slerp_to, self->slerp_factors, self->slerp_results, slerp);
+
+    for (size_t i = 0; i < slerp; ++i) {
+        memcpy(self->slerp_targets[i], self->slerp_results[i], sizeof(versor));
+    }
+
+    offset = 0;
+
+    for (size_t i = 0; i < self->instances_count; ++i) {
+        const skeleton_t* skeleton = instances[i].skeleton;
+        mat4* globals = &self->globals[offset];
+        mat4* palette = &self->animator->palette[instances[i].palette_offset];
+
+        for (GLsizei j = 0; j < skeleton->joints_count; ++j) {
+            GLsizei joint = skeleton->order[j];
+            GLint parent = skeleton->parents[joint];
+            mat4 local;
+
+            glm_quat_mat4(self->rotations[offset + (size_t)joint], local);
+            glm_vec4_scale(local[0], self->scales[offset + (size_t)joint][0], local[0]);
+            glm_vec4_scale(local[1], self->scales[offset + (size_t)joint][1], local[1]);
+            glm_vec4_scale(local[2], self->scales[offset + (size_t)joint][2], local[2]);
+            glm_vec3_copy(self->translations[offset + (size_t)joint], local[3]);
+
+            glm_mat4_mul(parent >= 0 ? globals[parent] : skeleton->root_matrices[joint], local, globals[joint]);
+            glm_mat4_mul(globals[joint], skeleton->inverse_bind_matrices[joint], palette[joint]);
+        }
+
+        offset += (size_t)skeleton->joints_count;
+    }
+}
+
+// Advances every instance, samples them on the job pool in batches and uploads the palette
+void animator_update(animator_t* self, float delta) {
+    size_t jobs_count = (self->instances_count + ANIMATOR_BATCH_SIZE - 1) / ANIMATOR_BATCH_SIZE;
+
+    if (!self->instances_count) {
+        return;
+    }
+
+    if (jobs_count > self->jobs_count) {
+        animator_job_t* jobs = (animator_job_t*)realloc(self->jobs, jobs_count * sizeof(animator_job_t));
+
+        if (!jobs) {
+            return;
+        }
+
+        memset(&jobs[self->jobs_count], 0, (jobs_count - self->jobs_count) * sizeof(animator_job_t));
+        self->jobs = jobs;
+        self->jobs_count = jobs_count;
+    }
+
+    for (size_t i = 0; i < self->instances_count; ++i) {
+        animator_instance_t* instance = &self->instances[i];
+
+        if (instance->animation >= 0) {
+            float duration = instance->skeleton->animations[instance->animation].duration;
+
+            instance->time = duration > 0.0f ? fmodf(instance->time + delta, duration) : 0.0f;
+            instance->time += instance->time < 0.0f ? duration : 0.0f;
+        }
+    }
+
+    for (size_t i = 0; i < jobs_count; ++i) {
+        self->jobs[i].animator = self;
+        self->jobs[i].first_instance = i * ANIMATOR_BATCH_SIZE;
+        self->jobs[i].instances_count = self->instances_count - self->jobs[i].first_instance < ANIMATOR_BATCH_SIZE ? self->instances_count - self->jobs[i].first_instance : ANIMATOR_BATCH_SIZE;
+
+        if (self->job_pool) {
+            job_pool_push(self->job_pool, animator_job, &self->jobs[i]);
+        }
+        else {
+            animator_job(&self->jobs[i]);
+        }
+    }
+
+    if (self->job_pool) {
+        job_pool_wait(self->job_pool);
+    }
+
+    GLsizeiptr size = (GLsizeiptr)sizeof(mat4) * self->palette_count;
+    mat4* palette = (mat4*)ring_buffer_allocate_storage(&self->stream, size, &self->palette_offset);
+
+    if (palette) {
+        memcpy(palette, self->palette, (size_t)size);
+    }
+}
+
+// binding is the joint_palette block binding of the vertex shader
+void animator_bind(const animator_t* self, GLuint binding) {
+    if (!self->stream.buffer) {
+        return;
+    }
+
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, self->stream.buffer, self->palette_offset, (GLsizeiptr)sizeof(mat4) * self->palette_count);
+    gl_debug();
+}
+
+void animator_destroy(animator_t* self) {
+    for (size_t i = 0; i < self->jobs_count; ++i) {
+        free(self->jobs[i].translations);
+        free(self->jobs[i].rotations);
+        free(self->jobs[i].scales);
+        free(self->jobs[i].globals);
+        free(self->jobs[i].slerp_from);
+        free(self->jobs[i].slerp_to);
+        free(self->jobs[i].slerp_factors);
+        free(self->jobs[i].slerp_results);
+        free(self->jobs[i].slerp_targets);
+    }
+
+    ring_buffer_destroy(&self->stream);
+
+    free(self->jobs);
+    free(self->instances);
+    free(self->palette);
+
+    *self = animator_create(self->job_pool);
+}
+
+
+object_t object_default() {
+    object_t result = {
+        .position = GLM_VEC3_ZERO_INIT,
+        .rotation = GLM_VEC3_ZERO_INIT,
+        .scale = GLM_VEC3_ONE_INIT,
+        .matrix = GLM_MAT4_IDENTITY_INIT,
+        .program.id = 0,
+        .task = NULL,
+        .mesh = {
+            .id = 0,
+            .indices_count = 0
+        },
+        .joints_offset = -1,
+        .textures = NULL,
+        .textures_count = 0
+    };
+
+    return result;
+}
+
+// With a compiler the program is only queued here, object_draw picks it up once the driver is done.
+// The compiler must outlive the object.
+object_t object_create_async(
+    shader_compiler_t* compiler,
+    const char* vertex_shader_file_name,
+    const char* geometry_shader_file_name,
+    const char* fragment_shader_file_name,
+    const char* mesh_file_name,
+    const char** texture_file_names,
+    int textures_count
+) {
+    object_t result = object_default();
+    texture_t textures[textures_count];
+
+    if (compiler) {
+        result.task = shader_compiler_submit(compiler, vertex_shader_file_name, geometry_shader_file_name, fragment_shader_file_name);
+
+        if (!result.task) {
+            return object_default();
+        }
+    }
+    else {
+        shader_compiler_task_t task = {
+            .compiler = NULL,
+            .file_names = {
+                (char*)vertex_shader_file_name,
+                (char*)geometry_shader_file_name,
+                (char*)fragment_shader_file_name
+            },
+            .shaders = { { .id = 0 }, { .id = 0 }, { .id = 0 } },
+            .program.id = 0,
+            .claimed = false
+        };
+
+        shader_compiler_task_submit(&task);
+
+        if (shader_compiler_task_resolve(&task) != PROGRAM_STATUS_READY) {
+            return object_default();
+        }
+
+        result.program = task.program;
+    }
+
+    for (int i = 0; i < textures_count; ++i) {
+        textures[i] = texture_create(texture_file_names[i]);
+
+        if (!textures[i].id) {
+            for (int j = 0; j < i; ++j) {
+                texture_destroy(&textures[j]);
+            }
+
+            printf("Error load:\n    %s\n", texture_file_names[i]);
+
+            if (result.program.id) {
+                program_destroy(&result.program);
+            }
+
+            return object_default();
+        }
+    }
+
+    if (!mesh_file_name) {
+        GLfloat positions[] = {
+            -1.0f, 1.0f, 0.0f,
+            1.0f, 1.0f, 0.0f,
+            1.0f, -1.0f, 0.0f,
+            -1.0f, -1.0f, 0.0f
+
+            // -1.0f, 1.0f, -1.0f,
+            // 1.0f, 1.0f, -1.0f,
+            // 1.0f, 1.0f, 0.0f,
+            // -1.0f, 1.0f, 0.0f
+        };
+
+        GLfloat texture_coords[] = {
+            0.0f, 0.0f,
+            1.0f, 0.0f,
+            1.0f, 1.0f,
+            0.0f, 1.0f
+
+            // 0.0f, 0.0f,
+            // 1.0f, 0.0f,
+            // 1.0f, 1.0f,
+            // 0.0f, 1.0f
+        };
+
+        GLfloat colors[] = {
+            1.0f, 1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f, 1.0f,
+            1.0f, 1.0f, 1.0f, 1.0f
+
+            // 1.0f, 1.0f, 1.0f, 1.0f,
+            // 1.0f, 1.0f, 1.0f, 1.0f,
+            // 1.0f, 1.0f, 1.0f, 1.0f,
+            // 1.0f, 1.0f, 1.0f, 1.0f
+        };
+
+        GLuint indices[] = {
+            0, 1, 2,
+            2, 3, 0
+            // 4, 5, 6,
+            // 6, 7, 4
+        };
+
+        GLuint vertices_count = array_size(positions) / 3;
+
+        result.mesh = _mesh_create_(NULL, vertices_count, positions, NULL, texture_coords, colors, NULL, NULL, NULL, array_size(indices), indices, 0, NULL);
+    }
+    else {
+        result.mesh = mesh_create(mesh_file_name);
+    }
+
+    if (!result.mesh.id) {
+        for (int i = 0; i < textures_count; ++i) {
+            texture_destroy(&textures[i]);
+        }
+
+        mesh_destroy(&result.mesh);
+        program_destroy(&result.program);
+
+        return object_default();
+    }
+
+    result.textures = (texture_t*)calloc((size_t)textures_count, sizeof(texture_t));
+
+    if (result.textures) {
+        for (int i = 0; i < textures_count; ++i) {
+            result.textures[i] = textures[i];
+        }
+    }
+
+    result.textures_count = textures_count;
+
+    return result;
+}
+
+object_t object_create(
+    const char* vertex_shader_file_name,
+    const char* geometry_shader_file_name,
+    const char* fragment_shader_file_name,
+    const char* mesh_file_name,
+    const char** texture_file_names,
+    int textures_count
+) {
+    return object_create_async(NULL, vertex_shader_file_name, geometry_shader_file_name, fragment_shader_file_name, mesh_file_name, texture_file_names, textures_count);
+}
+
+void object_destroy(object_t* self) {
+    for (int i = 0; i < self->textures_count; ++i) {
+        texture_destroy(&self->textures[i]);
+    }
+
+    self->textures_count = 0;
+
+    if (self->mesh.id) {
+        mesh_destroy(&self->mesh);
+    }
+
+    if (self->program.id) {
+        program_destroy(&self->program);
+    }
+
+    // A program still owned by the compiler is destroyed together with the compiler
+
+    *self = object_default();
+}
+
+// Adopts the program once its compile task has finished, never waits for the driver
+bool object_is_ready(object_t* self) {
+    if (self->task) {
+        switch (shader_compiler_task_poll(self->task)) {
+            case PROGRAM_STATUS_READY: {
+                self->program = shader_compiler_task_claim(self->task);
+                self->task = NULL;
+            } break;
+            case PROGRAM_STATUS_FAILED: {
+                self->task = NULL;
+            } break;
+            default: {
+            } break;
+        }
+    }
+
+    return !self->task && self->program.id;
+}
+
+void object_bind_textures(const object_t* self) {
+    for (int i = 0; i < self->textures_count; ++i) {
+        glActiveTexture(GL_TEXTURE0 + (GLenum)i);
+        gl_debug();
+        texture_bind(&self->textures[i]);
+    }
+}
+
+// Textures, program and uniforms shared by object_draw and object_draw_instanced
+void object_bind(object_t* self, camera_t* camera) {
+    object_bind_textures(self);
+    program_use(&self->program, camera, self->matrix);
+
+    glUniform1i(glGetUniformLocation(self->program.id, "texture_diffuse1"), 0);
+    gl_debug();
+    glUniform1i(glGetUniformLocation(self->program.id, "texture_diffuse2"), 1);
+    gl_debug();
+    glUniform1i(glGetUniformLocation(self->program.id, "joints_offset"), self->joints_offset);
+    gl_debug();
+}
+
+// The level of detail for matrix, meshlet culled at full detail, with the object already bound
+void object_draw_mesh(object_t* self, camera_t* camera, mat4 matrix) {
+    GLsizei lod = mesh_select_lod(&self->mesh, camera, matrix);
+
+    if (lod == 0 && self->mesh.meshlets_count) {
+        mesh_draw_submeshes(&self->mesh, self->mesh.meshlet_ranges, mesh_cull_meshlets(&self->mesh, camera, matrix, self->mesh.meshlet_ranges));
+    }
+    else {
+        mesh_draw_lod(&self->mesh, lod);
+    }
+}
+
+void object_draw(object_t* self, camera_t* camera) {
+    vec4 planes[6];
+
+    if (!object_is_ready(self)) {
+        return;
+    }
+
+    camera_get_frustum(camera, planes);
+
+    if (self->joints_offset < 0 && !mesh_in_frustum(&self->mesh, (const vec4*)planes, self->matrix)) {
+        return;
+    }
+
+    object_bind(self, camera);
+    object_draw_mesh(self, camera, self->matrix);
+}
+
+
+instance_buffer_t instance_buffer_create() {
+    instance_buffer_t result = {
+        .instances = NULL,
+        .instances_count = 0,
+        .instances_capacity = 0,
+        .buffer = 0,
+        .buffer_capacity = 0,
+        .dirty = false
+    };
+
+    return result;
+}
+
+// Returns the instance, -1 when out of memory
+GLsizei instance_buffer_add(instance_buffer_t* self, mat4 matrix, vec4 color) {
+    if (self->instances_count == self->instances_capacity) {
+        GLsizei capacity = self->instances_capacity ? self->instances_capacity * 2 : 256;
+        instance_t* instances = (instance_t*)aligned_alloc(32, (size_t)capacity * sizeof(instance_t));
+
+        if (!instances) {
+            return -1;
+        }
+
+        if (self->instances) {
+            memcpy(instances, self->instances, (size_t)self->instances_count * sizeof(instance_t));
+            free(self->instances);
+        }
+
+        self->instances = instances;
+        self->instances_capacity = capacity;
+    }
+
+    glm_mat4_copy(matrix, self->instances[self->instances_count].matrix);
+    glm_vec4_copy(color, self->instances[self->instances_count].color);
+    self->dirty = true;
+
+    return self->instances_count++;
+}
+
+void instance_buffer_set(instance_buffer_t* self, GLsizei instance, mat4 matrix, vec4 color) {
+    glm_mat4_copy(matrix, self->instances[instance].matrix);
+    glm_vec4_copy(color, self->instances[instance].color);
+    self->dirty = true;
+}
+
+void instance_buffer_clear(instance_buffer_t* self) {
+    self->instances_count = 0;
+    self->dirty = true;
+}
+
+// The storage only grows, unchanged instances are not uploaded again
+void instance_buffer_upload(instance_buffer_t* self) {
+    if (!self->dirty || !self->instances_count) {
+        return;
+    }
+
+    if (self->instances_count > self->buffer_capacity) {
+        glDeleteBuffers(1, &self->buffer);
+        gl_debug();
+        glCreateBuffers(1, &self->buffer);
+        gl_debug();
+        glNamedBufferStorage(self->buffer, (GLsizeiptr)sizeof(instance_t) * self->instances_capacity, NULL, GL_DYNAMIC_STORAGE_BIT);
+        gl_debug();
+
+        self->buffer_capacity = self->instances_capacity;
+    }
+
+    glNamedBufferSubData(self->buffer, 0, (GLsizeiptr)sizeof(instance_t) * self->instances_count, self->instances);
+    gl_debug();
+
+    self->dirty = false;
+}
+
+void instance_buffer_destroy(instance_buffer_t* self) {
+    glDeleteBuffers(1, &self->buffer);
+    gl_debug();
+
+    free(self->instances);
+
+    *self = instance_buffer_create();
+}
+
+#define INSTANCE_BUFFER_BINDING 2
+
+// One draw call per submesh for all instances, object->matrix is ignored and the full detail level is drawn
+void object_draw_instanced(object_t* self, camera_t* camera, instance_buffer_t* instances) {
+    if (!instances->instances_count || !object_is_ready(self)) {
+        return;
+    }
+
+    instance_buffer_upload(instances);
+    object_bind(self, camera);
+
+    glUniform1i(glGetUniformLocation(self->program.id, "instanced"), 1);
+    gl_debug();
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_BUFFER_BINDING, instances->buffer);
+    gl_debug();
+
+    mesh_draw_instanced(&self->mesh, 0, instances->instances_count);
+
+    glUniform1i(glGetUniformLocation(self->program.id, "instanced"), 0);
+    gl_debug();
+}
+
+
+uint32_t ecs_align(uint32_t offset) {
+    return (offset + ECS_COLUMN_ALIGNMENT - 1) & ~(uint32_t)(ECS_COLUMN_ALIGNMENT - 1);
+}
+
+// Fills offsets for capacity rows and returns the bytes they take
+size_t archetype_layout(archetype_t* self, const uint32_t* sizes, uint32_t capacity) {
+    uint32_t offset = ecs_align(capacity * (uint32_t)sizeof(entity_t));
+
+    for (uint32_t i = 0; i < ECS_MAX_COMPONENTS; ++i) {
+        if (self->mask & (1ull << i)) {
+            self->offsets[i] = offset;
+            offset = ecs_align(offset + capacity * sizes[i]);
+        }
+    }
+
+    return offset;
+}
+
+archetype_t archetype_create(uint64_t mask, const uint32_t* sizes) {
+    archetype_t result = {
+        .mask = mask,
+        .offsets = { 0 },
+        .capacity = 0,
+        .chunk_size = 0,
+        .chunks = NULL,
+        .counts = NULL,
+        .chunks_count = 0,
+        .chunks_capacity = 0
+    };
+    uint32_t row_size = sizeof(entity_t);
+
+    for (uint32_t i = 0; i < ECS_MAX_COMPONENTS; ++i) {
+        row_size += mask & (1ull << i) ? sizes[i] : 0;
+    }
+
+    // Column padding is not in row_size, so step down until the layout fits
+    result.capacity = ECS_CHUNK_SIZE / row_size;
+
+    while (result.capacity > 1 && archetype_layout(&result, sizes, result.capacity) > ECS_CHUNK_SIZE) {
+        --result.capacity;
+    }
+
+    result.capacity = result.capacity ? result.capacity : 1;
+    result.chunk_size = archetype_layout(&result, sizes, result.capacity);
+    result.chunk_size = result.chunk_size > ECS_CHUNK_SIZE ? (result.chunk_size + 63) & ~(size_t)63 : ECS_CHUNK_SIZE;
+
+    return result;
+}
+
+void archetype_destroy(archetype_t* self) {
+    for (uint32_t i = 0; i < self->chunks_count; ++i) {
+        free(self->chunks[i]);
+    }
+
+    free(self->chunks);
+    free(self->counts);
+
+    self->chunks = NULL;
+    self->counts = NULL;
+    self->chunks_count = 0;
+    self->chunks_capacity = 0;
+}
+
+// Appends a zeroed row to the last chunk, false when out of memory
+bool archetype_push(archetype_t* self, uint32_t* chunk, uint32_t* row) {
+    if (!self->chunks_count || self->counts[self->chunks_count - 1] == self->capacity) {
+        if (self->chunks_count == self->chunks_capacity) {
+            uint32_t capacity = self->chunks_capacity ? self->chunks_capacity * 2 : 4;
+            uint8_t** chunks = (uint8_t**)realloc(self->chunks, capacity * sizeof(uint8_t*));
+
+            if (chunks) {
+                self->chunks = chunks;
+            }
+
+            uint32_t* counts = chunks ? (uint32_t*)realloc(self->counts, capacity * sizeof(uint32_t)) : NULL;
+
+            if (!counts) {
+                return false;
+            }
+
+            self->counts = counts;
+            self->chunks_capacity = capacity;
+        }
+
+        uint8_t* data = (uint8_t*)aligned_alloc(64, self->chunk_size);
+
+        if (!data) {
+            return false;
+        }
+
+        self->chunks[self->chunks_count] = data;
+        self->counts[self->chunks_count] = 0;
+        self->chunks_count += 1;
+    }
+
+    *chunk = self->chunks_count - 1;
+    *row = self->counts[*chunk]++;
+
+    return true;
+}
+
+// Column of the component in one chunk, the component must be in the archetype
+void* archetype_get_column(const archetype_t* self, uint32_t chunk, uint32_t component) {
+    return self->chunks[chunk] + self->offsets[component];
+}
+
+void* ecs_view_get(const ecs_view_t* self, uint32_t component) {
+    return self->chunk + self->archetype->offsets[component];
+}
+
+const entity_t* ecs_view_get_entities(const ecs_view_t* self) {
+    return (const entity_t*)self->chunk;
+}
+
+// -1 for unskinned components
+GLint render_component_get_joints_offset(const render_component_t* self) {
+    return self->skinned ? self->joints_offset : -1;
+}
+
+world_t world_create(job_pool_t* job_pool) {
+    world_t result = {
+        .job_pool = job_pool,
+        .component_sizes = {
+            [ECS_COMPONENT_TRANSFORM] = sizeof(transform_component_t),
+            [ECS_COMPONENT_RENDER] = sizeof(render_component_t)
+        },
+        .components_count = ECS_BUILTIN_COMPONENTS_COUNT,
+        .archetypes = NULL,
+        .archetypes_count = 0,
+        .archetypes_capacity = 0,
+        .records = NULL,
+        .records_count = 0,
+        .records_capacity = 0,
+        .free_record = -1,
+        .jobs = NULL,
+        .jobs_capacity = 0
+    };
+
+    return result;
+}
+
+void world_destroy(world_t* self) {
+    for (uint32_t i = 0; i < self->archetypes_count; ++i) {
+        archetype_destroy(&self->archetypes[i]);
+    }
+
+    free(self->archetypes);
+    free(self->records);
+    free(self->jobs);
+
+    *self = world_create(self->job_pool);
+}
+
+// Returns the component id for masks (1ull << id), -1 when all ECS_MAX_COMPONENTS are taken
+int world_register_component(world_t* self, size_t size) {
+    if (self->components_count == ECS_MAX_COMPONENTS) {
+        return -1;
+    }
+
+    self->component_sizes[self->components_count] = (uint32_t)size;
+
+    return (int)self->components_count++;
+}
+
+// Index of the archetype with exactly these components, created on first use, -1 when out of memory
+int32_t world_get_archetype(world_t* self, uint64_t mask) {
+    for (uint32_t i = 0; i < self->archetypes_count; ++i) {
+        if (self->archetypes[i].mask == mask) {
+            return (int32_t)i;
+        }
+    }
+
+    if (self->archetypes_count == self->archetypes_capacity) {
+        uint32_t capacity = self->archetypes_capacity ? self->archetypes_capacity * 2 : 16;
+        archetype_t* archetypes = (archetype_t*)realloc(self->archetypes, capacity * sizeof(archetype_t));
+
+        if (!archetypes) {
+            return -1;
+        }
+
+        self->archetypes = archetypes;
+        self->archetypes_capacity = capacity;
+    }
+
+    self->archetypes[self->archetypes_count] = archetype_create(mask, self->component_sizes);
+
+    return (int32_t)self->archetypes_count++;
+}
+
+// NULL for dead entities
+entity_record_t* world_get_record(const world_t* self, entity_t entity) {
+    uint32_t index = (uint32_t)entity;
+
+    if (index >= self->records_count || self->records[index].generation != (uint32_t)(entity >> 32) || self->records[index].archetype < 0) {
+        return NULL;
+    }
+
+    return &self->records[index];
+}
+
+// Fills the row with the last row of the archetype and gives up the last row, keeping chunks dense
+void world_erase_row(world_t* self, archetype_t* archetype, uint32_t chunk, uint32_t row) {
+    uint32_t last_chunk = archetype->chunks_count - 1;
+    uint32_t last_row = archetype->counts[last_chunk] - 1;
+
+    if (last_chunk != chunk || last_row != row) {
+        entity_t moved = ((entity_t*)archetype->chunks[last_chunk])[last_row];
+
+        ((entity_t*)archetype->chunks[chunk])[row] = moved;
+
+        for (uint32_t i = 0; i < ECS_MAX_COMPONENTS; ++i) {
+            if (archetype->mask & (1ull << i)) {
+                uint32_t size = self->component_sizes[i];
+
+                memcpy((uint8_t*)archetype_get_column(archetype, chunk, i) + (size_t)row * size, (uint8_t*)archetype_get_column(archetype, last_chunk, i) + (size_t)last_row * size, size);
+            }
+        }
+
+        self->records[(uint32_t)moved].chunk = chunk;
+        self->records[(uint32_t)moved].row = row;
+    }
+
+    if (!--archetype->counts[last_chunk]) {
+        free(archetype->chunks[last_chunk]);
+        archetype->chunks_count -= 1;
+    }
+}
+
+// Places the entity in the archetype of mask, components it keeps are copied and new ones are zeroed
+bool world_move_entity(world_t* self, uint32_t index, uint64_t mask) {
+    entity_record_t* record = &self->records[index];
+    int32_t target = world_get_archetype(self, mask);
+    uint32_t chunk, row;
+
+    if (target < 0 || !archetype_push(&self->archetypes[target], &chunk, &row)) {
+        return false;
+    }
+
+    archetype_t* destination = &self->archetypes[target];
+
+    ((entity_t*)destination->chunks[chunk])[row] = ((entity_t)record->generation << 32) | index;
+
+    for (uint32_t i = 0; i < ECS_MAX_COMPONENTS; ++i) {
+        if (mask & (1ull << i)) {
+            uint32_t size = self->component_sizes[i];
+            uint8_t* value = (uint8_t*)archetype_get_column(destination, chunk, i) + (size_t)row * size;
+
+            if (record->archetype >= 0 && self->archetypes[record->archetype].mask & (1ull << i)) {
+                memcpy(value, (uint8_t*)archetype_get_column(&self->archetypes[record->archetype], record->chunk, i) + (size_t)record->row * size, size);
+            }
+            else {
+                memset(value, 0, size);
+            }
+        }
+    }
+
+    if (record->archetype >= 0) {
+        world_erase_row(self, &self->archetypes[record->archetype], record->chunk, record->row);
+    }
+
+    record->archetype = target;
+    record->chunk = chunk;
+    record->row = row;
+
+    return true;
+}
+
+// Components start zeroed, returns 0 when out of memory
+entity_t world_spawn(world_t* self, uint64_t mask) {
+    int32_t index = self->free_record;
+
+    if (index < 0) {
+        if (self->records_count == self->records_capacity) {
+            uint32_t capacity = self->records_capacity ? self->records_capacity * 2 : 1024;
+            entity_record_t* records = (entity_record_t*)realloc(self->records, capacity * sizeof(entity_record_t));
+
+            if (!records) {
+                return 0;
+            }
+
+            self->records = records;
+            self->records_capacity = capacity;
+        }
+
+        index = (int32_t)self->records_count++;
+        self->records[index].generation = 1;
+    }
+    else {
+        self->free_record = self->records[index].next_free;
+    }
+
+    self->records[index].archetype = -1;
+    self->records[index].next_free = -1;
+
+    if (!world_move_entity(self, (uint32_t)index, mask)) {
+        self->records[index].next_free = self->free_record;
+        self->free_record = index;
+        return 0;
+    }
+
+    return ((entity_t)self->records[index].generation << 32) | (uint32_t)index;
+}
+
+void world_despawn(world_t* self, entity_t entity) {
+    entity_record_t* record = world_get_record(self, entity);
+
+    if (!record) {
+        return;
+    }
+
+    world_erase_row(self, &self->archetypes[record->archetype], record->chunk, record->row);
+
+    record->archetype = -1;
+    record->generation += 1;
+    record->next_free = self->free_record;
+    self->free_record = (int32_t)(uint32_t)entity;
+}
+
+bool world_is_alive(const world_t* self, entity_t entity) {
+    return world_get_record(self, entity) != NULL;
+}
+
+// NULL when the entity is dead or lacks the component. Valid until the next structural change.
+void* world_get(const world_t* self, entity_t entity, uint32_t component) {
+    entity_record_t* record = world_get_record(self, entity);
+
+    if (!record || !(self->archetypes[record->archetype].mask & (1ull << component))) {
+        return NULL;
+    }
+
+    return (uint8_t*)archetype_get_column(&self->archetypes[record->archetype], record->chunk, component) + (size_t)record->row * self->component_sizes[component];
+}
+
+// Moves the entity to the archetype with the component added (zeroed) or removed
+bool world_set_component(world_t* self, entity_t entity, uint32_t component, bool present) {
+    entity_record_t* record = world_get_record(self, entity);
+
+    if (!record) {
+        return false;
+    }
+
+    uint64_t mask = self->archetypes[record->archetype].mask;
+    uint64_t target = present ? mask | (1ull << component) : mask & ~(1ull << component);
+
+    return target == mask || world_move_entity(self, (uint32_t)entity, target);
+}
+
+void ecs_job(void* data) {
+    ecs_job_t* self = (ecs_job_t*)data;
+
+    self->system(&self->view, self->data);
+}
+
+// Calls system once per chunk of every archetype that has all components of mask, in parallel on the world's job pool
+void world_run(world_t* self, uint64_t mask, ecs_system_t system, void* data) {
+    size_t jobs_count = 0;
+
+    for (uint32_t i = 0; i < self->archetypes_count; ++i) {
+        jobs_count += (self->archetypes[i].mask & mask) == mask ? self->archetypes[i].chunks_count : 0;
+    }
+
+    if (jobs_count > self->jobs_capacity) {
+        ecs_job_t* jobs = (ecs_job_t*)realloc(self->jobs, jobs_count * sizeof(ecs_job_t));
+
+        if (!jobs) {
+            return;
+        }
+
+        self->jobs = jobs;
+        self->jobs_capacity = jobs_count;
+    }
+
+    jobs_count = 0;
+
+    for (uint32_t i = 0; i < self->archetypes_count; ++i) {
+        archetype_t* archetype = &self->archetypes[i];
+
+        if ((archetype->mask & mask) != mask) {
+            continue;
+        }
+
+        for (uint32_t j = 0; j < archetype->chunks_count; ++j) {
+            ecs_job_t* job = &self->jobs[jobs_count++];
+
+            job->view = (ecs_view_t) {
+                .archetype = archetype,
+                .chunk = archetype->chunks[j],
+                .count = archetype->counts[j]
+            };
+            job->system = system;
+            job->data = data;
+
+            if (self->job_pool) {
+                job_pool_push(self->job_pool, ecs_job, job);
+            }
+            else {
+                ecs_job(job);
+            }
+        }
+    }
+
+    if (self->job_pool) {
+        job_pool_wait(self->job_pool);
+    }
+}
+
+void world_transform_system(const ecs_view_t* view, void* data) {
+    transform_component_t* transforms = (transform_component_t*)ecs_view_get(view, ECS_COMPONENT_TRANSFORM);
+
+    (void)data;
+
+    for (uint32_t i = 0; i < view->count; ++i) {
+        mat4 rotation;
+
+        glm_translate_make(transforms[i].matrix, transforms[i].position);
+        glm_euler_xyz(transforms[i].rotation, rotation);
+        glm_mat4_mul(transforms[i].matrix, rotation, transforms[i].matrix);
+        glm_scale(transforms[i].matrix, transforms[i].scale);
+    }
+}
+
+// Composes translation * rotation * scale into the matrix of every transform
+void world_update_transforms(world_t* self) {
+    world_run(self, 1ull << ECS_COMPONENT_TRANSFORM, world_transform_system, NULL);
+}
+
+#define WORLD_CULL_BATCH 64
+
+// Classifies count (at most WORLD_CULL_BATCH) entities of a chunk with one frustum_test_boxes call. Skinned entities can
+// leave their bind pose bounds and those without an object have none, both are reported as intersecting.
+void world_cull_batch(const vec4 planes[6], const transform_component_t* transforms, const render_component_t* renders, uint32_t count, uint8_t* results) {
+    float boxes[WORLD_CULL_BATCH * 6] = { 0 };
+
+    for (uint32_t i = 0; i < count; ++i) {
+        vec3 bounds[2] = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+
+        if (renders[i].object && !renders[i].skinned) {
+            glm_aabb_transform((vec3*)renders[i].object->mesh.bounds, (vec4*)transforms[i].matrix, bounds);
+        }
+
+        for (uint32_t j = 0; j < 3; ++j) {
+            boxes[j * WORLD_CULL_BATCH + i] = (bounds[0][j] + bounds[1][j]) * 0.5f;
+            boxes[(j + 3) * WORLD_CULL_BATCH + i] = (bounds[1][j] - bounds[0][j]) * 0.5f;
+        }
+    }
+
+    frustum_test_boxes(planes, boxes, WORLD_CULL_BATCH, count, results);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!renders[i].object || renders[i].skinned) {
+            results[i] = FRUSTUM_TEST_INTERSECTING;
+        }
+    }
+}
+
+// Draws every entity with a transform and a render component on the calling (GL) thread, skipping those outside the frustum.
+// Consecutive entities of the same object only change the model matrix and joints offset.
+void world_draw(world_t* self, camera_t* camera) {
+    uint64_t mask = (1ull << ECS_COMPONENT_TRANSFORM) | (1ull << ECS_COMPONENT_RENDER);
+    object_t* bound = NULL;
+    vec4 planes[6];
+
+    camera_get_frustum(camera, planes);
+
+    for (uint32_t i = 0; i < self->archetypes_count; ++i) {
+        archetype_t* archetype = &self->archetypes[i];
+
+        if ((archetype->mask & mask) != mask) {
+            continue;
+        }
+
+        for (uint32_t j = 0; j < archetype->chunks_count; ++j) {
+            transform_component_t* transforms = (transform_component_t*)archetype_get_column(archetype, j, ECS_COMPONENT_TRANSFORM);
+            render_component_t* renders = (render_component_t*)archetype_get_column(archetype, j, ECS_COMPONENT_RENDER);
+            uint32_t count = archetype->counts[j];
+            uint8_t tests[WORLD_CULL_BATCH];
+
+            for (uint32_t k = 0; k < count; ++k) {
+                object_t* object = renders[k].object;
+                GLint joints_offset = render_component_get_joints_offset(&renders[k]);
+
+                if (k % WORLD_CULL_BATCH == 0) {
+                    world_cull_batch((const vec4*)planes, &transforms[k], &renders[k], count - k < WORLD_CULL_BATCH ? count - k : WORLD_CULL_BATCH, tests);
+                }
+
+                if (!object || tests[k % WORLD_CULL_BATCH] == FRUSTUM_TEST_OUTSIDE || !object_is_ready(object)) {
+                    continue;
+                }
+
+                if (object != bound) {
+                    object_bind(object, camera);
+                    bound = object;
+                }
+
+                glUniformMatrix4fv(glGetUniformLocation(object->program.id, "model"), 1, GL_FALSE, &transforms[k].matrix[0][0]);
+                gl_debug();
+                glUniform1i(glGetUniformLocation(object->program.id, "joints_offset"), joints_offset);
+                gl_debug();
+
+                object_draw_mesh(object, camera, transforms[k].matrix);
+            }
+        }
+    }
+}
+
+
+// Local matrices from unit quaternions, scales and translations, the SSE path builds four at a time from transposed quaternions
+void transform_compose_batch(const vec3* translations, const versor* rotations, const vec3* scales, mat4* destinations, size_t count) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(rotations[i + 0]);
+        __m128 y = _mm_loadu_ps(rotations[i + 1]);
+        __m128 z = _mm_loadu_ps(rotations[i + 2]);
+        __m128 w = _mm_loadu_ps(rotations[i + 3]);
+        __m128 zero = _mm_setzero_ps();
+
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+
+        __m128 sx = _mm_set_ps(scales[i + 3][0], scales[i + 2][0], scales[i + 1][0], scales[i][0]);
+        __m128 sy = _mm_set_ps(scales[i + 3][1], scales[i + 2][1], scales[i + 1][1], scales[i][1]);
+        __m128 sz = _mm_set_ps(scales[i + 3][2], scales[i + 2][2], scales[i + 1][2], scales[i][2]);
+        __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+        __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+        __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+        __m128 c00 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+        __m128 c01 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+        __m128 c02 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+        __m128 c10 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+        __m128 c11 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+        __m128 c12 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+        __m128 c20 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+        __m128 c21 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+        __m128 c22 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+        __m128 c03 = zero, c13 = zero, c23 = zero;
+
+        // Back from one lane per matrix to one register per column
+        _MM_TRANSPOSE4_PS(c00, c01, c02, c03);
+        _MM_TRANSPOSE4_PS(c10, c11, c12, c13);
+        _MM_TRANSPOSE4_PS(c20, c21, c22, c23);
+
+        __m128 columns[3][4] = {
+            { c00, c01, c02, c03 },
+            { c10, c11, c12, c13 },
+            { c20, c21, c22, c23 }
+        };
+
+        for (size_t j = 0; j < 4; ++j) {
+            _mm_storeu_ps(destinations[i + j][0], columns[0][j]);
+            _mm_storeu_ps(destinations[i + j][1], columns[1][j]);
+            _mm_storeu_ps(destinations[i + j][2], columns[2][j]);
+            _mm_storeu_ps(destinations[i + j][3], _mm_set_ps(1.0f, translations[i + j][2], translations[i + j][1], translations[i + j][0]));
+        }
+    }
+#endif
+
+    for (; i < count; ++i) {
+        float x = rotations[i][0], y = rotations[i][1], z = rotations[i][2], w = rotations[i][3];
+        mat4 result = {
+            { (1.0f - 2.0f * (y * y + z * z)) * scales[i][0], 2.0f * (x * y + w * z) * scales[i][0], 2.0f * (x * z - w * y) * scales[i][0], 0.0f },
+            { 2.0f * (x * y - w * z) * scales[i][1], (1.0f - 2.0f * (x * x + z * z)) * scales[i][1], 2.0f * (y * z + w * x) * scales[i][1], 0.0f },
+            { 2.0f * (x * z + w * y) * scales[i][2], 2.0f * (y * z - w * x) * scales[i][2], (1.0f - 2.0f * (x * x + y * y)) * scales[i][2], 0.0f },
+            { translations[i][0], translations[i][1], translations[i][2], 1.0f }
+        };
+
+        glm_mat4_copy(result, destinations[i]);
+    }
+}
+
+transform_hierarchy_t transform_hierarchy_create() {
+    transform_hierarchy_t result = {
+        .count = 0,
+        .capacity = 0,
+        .handles = NULL,
+        .parents = NULL,
+        .parent_handles = NULL,
+        .subtree_sizes = NULL,
+        .translations = NULL,
+        .rotations = NULL,
+        .scales = NULL,
+        .locals = NULL,
+        .worlds = NULL,
+        .local_dirty = NULL,
+        .indices = NULL,
+        .handles_count = 0,
+        .handles_capacity = 0,
+        .free_handle = -1,
+        .dirty = NULL,
+        .dirty_count = 0,
+        .dirty_capacity = 0,
+        .sort_pending = false
+    };
+
+    return result;
+}
+
+void transform_hierarchy_destroy(transform_hierarchy_t* self) {
+    free(self->handles);
+    free(self->parents);
+    free(self->parent_handles);
+    free(self->subtree_sizes);
+    free(self->translations);
+    free(self->rotations);
+    free(self->scales);
+    free(self->locals);
+    free(self->worlds);
+    free(self->local_dirty);
+    free(self->indices);
+    free(self->dirty);
+
+    *self = transform_hierarchy_create();
+}
+
+// Arrays that were already grown keep their larger size when a later one fails, so a retry is safe
+bool transform_hierarchy_reserve(transform_hierarchy_t* self, GLsizei count) {
+    if (count <= self->capacity) {
+        return true;
+    }
+
+    GLsizei capacity = self->capacity ? self->capacity * 2 : 256;
+
+    while (capacity < count) {
+        capacity *= 2;
+    }
+
+    void** arrays[] = {
+        (void**)&self->handles, (void**)&self->parents, (void**)&self->parent_handles, (void**)&self->subtree_sizes,
+        (void**)&self->translations, (void**)&self->rotations, (void**)&self->scales, (void**)&self->local_dirty
+    };
+    const size_t sizes[] = { sizeof(GLint), sizeof(GLint), sizeof(GLint), sizeof(GLsizei), sizeof(vec3), sizeof(versor), sizeof(vec3), sizeof(bool) };
+
+    for (unsigned int i = 0; i < array_size(arrays); ++i) {
+        void* data = realloc(*arrays[i], (size_t)capacity * sizes[i]);
+
+        if (!data) {
+            return false;
+        }
+
+        *arrays[i] = data;
+    }
+
+    mat4* locals = (mat4*)aligned_alloc(32, (size_t)capacity * sizeof(mat4));
+    mat4* worlds = (mat4*)aligned_alloc(32, (size_t)capacity * sizeof(mat4));
+
+    if (!locals || !worlds) {
+        free(locals);
+        free(worlds);
+        return false;
+    }
+
+    if (self->locals) {
+        memcpy(locals, self->locals, (size_t)self->count * sizeof(mat4));
+        memcpy(worlds, self->worlds, (size_t)self->count * sizeof(mat4));
+        free(self->locals);
+        free(self->worlds);
+    }
+
+    self->locals = locals;
+    self->worlds = worlds;
+    self->capacity = capacity;
+
+    return true;
+}
+
+// Subtrees rooted at index are recomputed by the next update
+bool transform_hierarchy_queue(transform_hierarchy_t* self, GLint index) {
+    if (self->dirty_count == self->dirty_capacity) {
+        GLsizei capacity = self->dirty_capacity ? self->dirty_capacity * 2 : 64;
+        GLint* dirty = (GLint*)realloc(self->dirty, (size_t)capacity * sizeof(GLint));
+
+        if (!dirty) {
+            return false;
+        }
+
+        self->dirty = dirty;
+        self->dirty_capacity = capacity;
+    }
+
+    self->dirty[self->dirty_count++] = index;
+
+    return true;
+}
+
+// Gathers count elements of size bytes into depth-first order through scratch
+void transform_hierarchy_permute(void* data, void* scratch, const GLint* order, GLsizei count, size_t size) {
+    for (GLsizei i = 0; i < count; ++i) {
+        memcpy((uint8_t*)scratch + (size_t)i * size, (uint8_t*)data + (size_t)order[i] * size, size);
+    }
+
+    memcpy(data, scratch, (size_t)count * size);
+}
+
+// Restores depth-first order after nodes were reparented, added below a parent or removed, then queues every root
+bool transform_hierarchy_sort(transform_hierarchy_t* self) {
+    GLsizei count = self->count;
+    GLint* links = (GLint*)malloc((size_t)count * 4 * sizeof(GLint));
+    void* scratch = aligned_alloc(32, (size_t)(count ? count : 1) * sizeof(mat4));
+
+    if (!links || !scratch) {
+        free(links);
+        free(scratch);
+        return false;
+    }
+
+    GLint* first_child = links;
+    GLint* next_sibling = links + count;
+    GLint* order = links + count * 2;
+    GLint* stack = links + count * 3;
+    GLsizei ordered = 0;
+
+    for (GLsizei i = 0; i < count; ++i) {
+        first_child[i] = -1;
+    }
+
+    // Prepending leaves each child list in descending order, so the stack pops children in ascending order
+    for (GLsizei i = 0; i < count; ++i) {
+        if (self->handles[i] >= 0 && self->parent_handles[i] >= 0) {
+            GLint parent = self->indices[self->parent_handles[i]];
+
+            next_sibling[i] = first_child[parent];
+            first_child[parent] = (GLint)i;
+        }
+    }
+
+    for (GLsizei i = 0; i < count; ++i) {
+        GLsizei stack_count = 0;
+
+        if (self->handles[i] < 0 || self->parent_handles[i] >= 0) {
+            continue;
+        }
+
+        stack[stack_count++] = (GLint)i;
+
+        while (stack_count) {
+            GLint node = stack[--stack_count];
+
+            order[ordered++] = node;
+
+            for (GLint child = first_child[node]; child >= 0; child = next_sibling[child]) {
+                stack[stack_count++] = child;
+            }
+        }
+    }
+
+    transform_hierarchy_permute(self->handles, scratch, order, ordered, sizeof(GLint));
+    transform_hierarchy_permute(self->parent_handles, scratch, order, ordered, sizeof(GLint));
+    transform_hierarchy_permute(self->translations, scratch, order, ordered, sizeof(vec3));
+    transform_hierarchy_permute(self->rotations, scratch, order, ordered, sizeof(versor));
+    transform_hierarchy_permute(self->scales, scratch, order, ordered, sizeof(vec3));
+    transform_hierarchy_permute(self->locals, scratch, order, ordered, sizeof(mat4));
+    transform_hierarchy_permute(self->local_dirty, scratch, order, ordered, sizeof(bool));
+
+    free(links);
+    free(scratch);
+
+    self->count = ordered;
+    self->dirty_count = 0;
+    self->sort_pending = false;
+
+    for (GLsizei i = 0; i < ordered; ++i) {
+        self->indices[self->handles[i]] = (GLint)i;
+        self->subtree_sizes[i] = 1;
+    }
+
+    for (GLsizei i = 0; i < ordered; ++i) {
+        self->parents[i] = self->parent_handles[i] >= 0 ? self->indices[self->parent_handles[i]] : -1;
+    }
+
+    for (GLsizei i = ordered - 1; i >= 0; --i) {
+        if (self->parents[i] >= 0) {
+            self->subtree_sizes[self->parents[i]] += self->subtree_sizes[i];
+        }
+        else if (!transform_hierarchy_queue(self, (GLint)i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Returns the handle of an identity node under parent (a handle, -1 for a root), -1 when out of memory
+GLint transform_hierarchy_add(transform_hierarchy_t* self, GLint parent) {
+    GLint handle = self->free_handle;
+
+    if (!transform_hierarchy_reserve(self, self->count + 1)) {
+        return -1;
+    }
+
+    if (handle >= 0) {
+        self->free_handle = self->indices[handle];
+    }
+    else {
+        if (self->handles_count == self->handles_capacity) {
+            GLsizei capacity = self->handles_capacity ? self->handles_capacity * 2 : 256;
+            GLint* indices = (GLint*)realloc(self->indices, (size_t)capacity * sizeof(GLint));
+
+            if (!indices) {
+                return -1;
+            }
+
+            self->indices = indices;
+            self->handles_capacity = capacity;
+        }
+
+        handle = (GLint)self->handles_count++;
+    }
+
+    GLint index = (GLint)self->count++;
+
+    self->indices[handle] = index;
+    self->handles[index] = handle;
+    self->parent_handles[index] = parent;
+    self->parents[index] = parent >= 0 ? self->indices[parent] : -1;
+    self->subtree_sizes[index] = 1;
+    glm_vec3_zero(self->translations[index]);
+    glm_quat_identity(self->rotations[index]);
+    glm_vec3_one(self->scales[index]);
+    glm_mat4_identity(self->locals[index]);
+    glm_mat4_identity(self->worlds[index]);
+    self->local_dirty[index] = false;
+
+    // A new root at the end keeps the order depth-first, a new child has to be moved behind its parent
+    self->sort_pending |= parent >= 0;
+
+    transform_hierarchy_queue(self, index);
+
+    return handle;
+}
+
+// Removes the node with its whole subtree, their handles become free
+void transform_hierarchy_remove(transform_hierarchy_t* self, GLint handle) {
+    if (self->sort_pending && !transform_hierarchy_sort(self)) {
+        return;
+    }
+
+    GLint first = self->indices[handle];
+    GLint last = first + self->subtree_sizes[first];
+
+    for (GLint i = first; i < last; ++i) {
+        self->indices[self->handles[i]] = self->free_handle;
+        self->free_handle = self->handles[i];
+        self->handles[i] = -1;
+    }
+
+    self->sort_pending = true;
+}
+
+// parent is a handle, -1 for a root, and must not be inside the node's subtree
+void transform_hierarchy_set_parent(transform_hierarchy_t* self, GLint handle, GLint parent) {
+    self->parent_handles[self->indices[handle]] = parent;
+    self->sort_pending = true;
+}
+
+// rotation is a unit quaternion
+void transform_hierarchy_set_local(transform_hierarchy_t* self, GLint handle, vec3 translation, versor rotation, vec3 scale) {
+    GLint index = self->indices[handle];
+
+    glm_vec3_copy(translation, self->translations[index]);
+    glm_vec4_copy(rotation, self->rotations[index]);
+    glm_vec3_copy(scale, self->scales[index]);
+
+    if (!self->local_dirty[index]) {
+        self->local_dirty[index] = transform_hierarchy_queue(self, index);
+    }
+}
+
+// Valid until the next add, remove or update
+vec4* transform_hierarchy_get_world(const transform_hierarchy_t* self, GLint handle) {
+    return self->worlds[self->indices[handle]];
+}
+
+int transform_hierarchy_index_compare(const void* a, const void* b) {
+    GLint left = *(const GLint*)a;
+    GLint right = *(const GLint*)b;
+
+    return (left > right) - (left < right);
+}
+
+void transform_hierarchy_update_range(transform_hierarchy_t* self, GLint first, GLint last) {
+    for (GLint i = first; i < last; ++i) {
+        GLint end = i;
+
+        while (end < last && self->local_dirty[end]) {
+            self->local_dirty[end++] = false;
+        }
+
+        if (end > i) {
+            transform_compose_batch(&self->translations[i], &self->rotations[i], &self->scales[i], &self->locals[i], (size_t)(end - i));
+            i = end - 1;
+        }
+    }
+
+    // Parents come first, so each parent world is final by the time its children read it
+    for (GLint i = first; i < last; ++i) {
+        if (self->parents[i] >= 0) {
+            glm_mat4_mul(self->worlds[self->parents[i]], self->locals[i], self->worlds[i]);
+        }
+        else {
+            glm_mat4_copy(self->locals[i], self->worlds[i]);
+        }
+    }
+}
+
+// Recomputes the subtrees of nodes changed since the last update, does nothing when no node changed
+void transform_hierarchy_update(transform_hierarchy_t* self) {
+    GLint end = 0;
+
+    if (self->sort_pending && !transform_hierarchy_sort(self)) {
+        return;
+    }
+
+    if (!self->dirty_count) {
+        return;
+    }
+
+    qsort(self->dirty, (size_t)self->dirty_count, sizeof(GLint), transform_hierarchy_index_compare);
+
+    // A queued node inside a subtree already recomputed is covered by it
+    for (GLsizei i = 0; i < self->dirty_count; ++i) {
+        GLint first = self->dirty[i];
+
+        if (first < end) {
+            continue;
+        }
+
+        end = first + self->subtree_sizes[first];
+        transform_hierarchy_update_range(self, first, end);
+    }
+
+    self->dirty_count = 0;
+}
+
+
+// Takes the coarsest detail level when data has any, the occluder does not reference data afterwards
+occluder_t occluder_create(const mesh_data_t* data) {
+    occluder_t result = {
+        .positions = NULL,
+        .positions_count = 0,
+        .indices = NULL,
+        .indices_count = 0
+    };
+    const submesh_t* submeshes = data->lods_count ? data->lods[data->lods_count - 1].submeshes : data->submeshes;
+    const GLfloat* positions = data->attributes[VERTEX_ATTRIBUTE_TYPE_POSITION];
+    size_t indices_count = 0;
+
+    if (!positions) {
+        return result;
+    }
+
+    for (size_t i = 0; i < data->submeshes_count; ++i) {
+        indices_count += (size_t)submeshes[i].indices_count;
+    }
+
+    result.positions = (vec3*)malloc(data->vertices_count * sizeof(vec3));
+    result.indices = (uint32_t*)malloc(indices_count * sizeof(uint32_t));
+
+    if (!result.positions || !result.indices) {
+        free(result.positions);
+        free(result.indices);
+        return (occluder_t) { .positions = NULL };
+    }
+
+    memcpy(result.positions, positions, data->vertices_count * sizeof(vec3));
+    result.positions_count = data->vertices_count;
+
+    for (size_t i = 0; i < data->submeshes_count; ++i) {
+        for (GLsizei j = 0; j < submeshes[i].indices_count; ++j) {
+            result.indices[result.indices_count++] = (uint32_t)((GLint)data->indices[submeshes[i].first_index + (GLuint)j] + submeshes[i].base_vertex);
+        }
+    }
+
+    return result;
+}
+
+occluder_t occluder_load(const char* file_name, const mesh_options_t* mesh_options) {
+    mesh_data_t data = mesh_data_load(file_name, mesh_options);
+    occluder_t result = occluder_create(&data);
+
+    mesh_data_free(&data);
+
+    return result;
+}
+
+void occluder_destroy(occluder_t* self) {
+    free(self->positions);
+    free(self->indices);
+
+    *self = (occluder_t) {
+        .positions = NULL
+    };
+}
+
+// job_pool NULL - rasterizes on the calling thread
+occlusion_buffer_t occlusion_buffer_create(job_pool_t* job_pool) {
+    occlusion_buffer_t result = {
+        .job_pool = job_pool,
+        .depth = (float*)aligned_alloc(32, OCCLUSION_WIDTH * OCCLUSION_HEIGHT * sizeof(float)),
+        .hiz = (float*)malloc(OCCLUSION_BLOCKS_X * OCCLUSION_BLOCKS_Y * sizeof(float)),
+        .draws = NULL,
+        .draws_count = 0,
+        .draws_capacity = 0,
+        .triangles = NULL,
+        .triangles_capacity = 0,
+        .jobs = NULL,
+        .jobs_capacity = 0
+    };
+
+    glm_mat4_identity(result.view_projection);
+
+    if (!result.depth || !result.hiz) {
+        puts("Failed to allocate the occlusion buffer");
+    }
+
+    return result;
+}
+
+void occlusion_buffer_destroy(occlusion_buffer_t* self) {
+    free(self->depth);
+    free(self->hiz);
+    free(self->draws);
+    free(self->triangles);
+    free(self->jobs);
+
+    *self = (occlusion_buffer_t) {
+        .depth = NULL
+    };
+}
+
+// Starts a frame, nothing is occluded until occlusion_buffer_render
+void occlusion_buffer_begin(occlusion_buffer_t* self, const camera_t* camera) {
+    glm_mat4_mul((vec4*)camera->projection, (vec4*)camera->view, self->view_projection);
+    self->draws_count = 0;
+
+    for (int i = 0; self->hiz && i < OCCLUSION_BLOCKS_X * OCCLUSION_BLOCKS_Y; ++i) {
+        self->hiz[i] = 1.0f;
+    }
+}
+
+// Occluders must stay alive until occlusion_buffer_render
+void occlusion_buffer_add(occlusion_buffer_t* self, const occluder_t* occluder, mat4 matrix) {
+    if (self->draws_count == self->draws_capacity) {
+        size_t capacity = self->draws_capacity ? self->draws_capacity * 2 : 256;
+        occlusion_draw_t* draws = (occlusion_draw_t*)aligned_alloc(32, capacity * sizeof(occlusion_draw_t));
+
+        if (!draws) {
+            return;
+        }
+
+        if (self->draws) {
+            memcpy(draws, self->draws, self->draws_count * sizeof(occlusion_draw_t));
+            free(self->draws);
+        }
+
+        self->draws = draws;
+        self->draws_capacity = capacity;
+    }
+
+    occlusion_draw_t* draw = &self->draws[self->draws_count++];
+
+    glm_mat4_copy(matrix, draw->matrix);
+    draw->occluder = occluder;
+    draw->triangles_count = 0;
+}
+
+// Projects one occluder into its slice of triangles. Triangles crossing the near plane are dropped rather than clipped,
+// like back faces and those without a pixel center, an occluder may only ever cover less than it should.
+void occlusion_setup_job(void* data) {
+    occlusion_job_t* job = (occlusion_job_t*)data;
+    occlusion_buffer_t* self = job->buffer;
+    occlusion_draw_t* draw = &self->draws[job->index];
+    const occluder_t* occluder = draw->occluder;
+    occlusion_triangle_t* triangles = &self->triangles[draw->first_triangle];
+    mat4 matrix;
+
+    glm_mat4_mul(self->view_projection, draw->matrix, matrix);
+
+    for (size_t i = 0; i + 2 < occluder->indices_count; i += 3) {
+        occlusion_triangle_t* triangle = &triangles[draw->triangles_count];
+        bool visible = true;
+
+        for (int j = 0; j < 3 && visible; ++j) {
+            vec4 clip;
+
+            const float* position = occluder->positions[occluder->indices[i + (size_t)j]];
+
+            glm_mat4_mulv(matrix, (vec4) { position[0], position[1], position[2], 1.0f }, clip);
+
+            // In front of the GL near plane, where clip z reaches -w
+            visible = clip[3] > 1e-5f && clip[2] >= -clip[3];
+
+            if (visible) {
+                triangle->x[j] = (clip[0] / clip[3] * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+                triangle->y[j] = (clip[1] / clip[3] * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+                triangle->z[j] = clip[2] / clip[3] * 0.5f + 0.5f;
+            }
+        }
+
+        float area = (triangle->x[1] - triangle->x[0]) * (triangle->y[2] - triangle->y[0]) - (triangle->x[2] - triangle->x[0]) * (triangle->y[1] - triangle->y[0]);
+
+        if (!visible || area <= 0.0f) {
+            continue;
+        }
+
+        // Pixels whose centers may be inside, clamped to the buffer
+        float min_x = fminf(triangle->x[0], fminf(triangle->x[1], triangle->x[2])) - 0.5f;
+        float min_y = fminf(triangle->y[0], fminf(triangle->y[1], triangle->y[2])) - 0.5f;
+        float max_x = fmaxf(triangle->x[0], fmaxf(triangle->x[1], triangle->x[2])) - 0.5f;
+        float max_y = fmaxf(triangle->y[0], fmaxf(triangle->y[1], triangle->y[2])) - 0.5f;
+
+        triangle->bounds[0] = min_x < 0.0f ? 0 : (int32_t)ceilf(min_x);
+        triangle->bounds[1] = min_y < 0.0f ? 0 : (int32_t)ceilf(min_y);
+        triangle->bounds[2] = max_x >= OCCLUSION_WIDTH - 1 ? OCCLUSION_WIDTH - 1 : (int32_t)floorf(max_x);
+        triangle->bounds[3] = max_y >= OCCLUSION_HEIGHT - 1 ? OCCLUSION_HEIGHT - 1 : (int32_t)floorf(max_y);
+
+        if (triangle->bounds[0] > triangle->bounds[2] || triangle->bounds[1] > triangle->bounds[3]) {
+            continue;
+        }
+
+        draw->triangles_count += 1;
+    }
+}
+
+// Keeps the nearest depth of the pixels of the triangle inside [x0, x1] x [y0, y1], four pixels at a time with SSE
+void occlusion_rasterize(float* depth, const occlusion_triangle_t* triangle, int32_t x0, int32_t y0, int32_t x1, int32_t y1) {
+    const float* x = triangle->x;
+    const float* y = triangle->y;
+
+    // Edge i is opposite vertex i, e_i(px, py) = a_i * px + b_i * py + c_i is its barycentric weight times the area
+    float a[3] = { y[1] - y[2], y[2] - y[0], y[0] - y[1] };
+    float b[3] = { x[2] - x[1], x[0] - x[2], x[1] - x[0] };
+    float c[3] = { x[1] * y[2] - x[2] * y[1], x[2] * y[0] - x[0] * y[2], x[0] * y[1] - x[1] * y[0] };
+    float area = c[0] + c[1] + c[2];
+
+    // Depth as a plane over the screen
+    float dz_dx = (a[0] * triangle->z[0] + a[1] * triangle->z[1] + a[2] * triangle->z[2]) / area;
+    float dz_dy = (b[0] * triangle->z[0] + b[1] * triangle->z[1] + b[2] * triangle->z[2]) / area;
+    float z_0 = (c[0] * triangle->z[0] + c[1] * triangle->z[1] + c[2] * triangle->z[2]) / area;
+
+    for (int32_t py = y0; py <= y1; ++py) {
+        float center_y = (float)py + 0.5f;
+        float* row = &depth[py * OCCLUSION_WIDTH];
+        int32_t px = x0;
+
+#if defined(__SSE2__)
+        px = x0 & ~3;
+
+        const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        const __m128 zero = _mm_setzero_ps();
+
+        for (; px <= x1; px += 4) {
+            __m128 center_x = _mm_add_ps(_mm_set1_ps((float)px), offsets);
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+            for (int i = 0; i < 3; ++i) {
+                __m128 edge = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[i]), center_x), _mm_set1_ps(b[i] * center_y + c[i]));
+
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(edge, zero));
+            }
+
+            // Lanes outside [x0, x1] belong to a neighbouring tile
+            __m128i lanes = _mm_add_epi32(_mm_set1_epi32(px), _mm_set_epi32(3, 2, 1, 0));
+
+            inside = _mm_and_ps(inside, _mm_castsi128_ps(_mm_cmpgt_epi32(lanes, _mm_set1_epi32(x0 - 1))));
+            inside = _mm_and_ps(inside, _mm_castsi128_ps(_mm_cmplt_epi32(lanes, _mm_set1_epi32(x1 + 1))));
+
+            if (!_mm_movemask_ps(inside)) {
+                continue;
+            }
+
+            __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(dz_dx), center_x), _mm_set1_ps(dz_dy * center_y + z_0));
+            __m128 current = _mm_load_ps(&row[px]);
+            __m128 nearest = _mm_min_ps(current, z);
+
+            _mm_store_ps(&row[px], _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+        }
+#endif // __SSE2__
+
+        for (; px <= x1; ++px) {
+            float center_x = (float)px + 0.5f;
+
+            if (a[0] * center_x + b[0] * center_y + c[0] < 0.0f || a[1] * center_x + b[1] * center_y + c[1] < 0.0f || a[2] * center_x + b[2] * center_y + c[2] < 0.0f) {
+                continue;
+            }
+
+            float z = dz_dx * center_x + dz_dy * center_y + z_0;
+
+            row[px] = z < row[px] ? z : row[px];
+        }
+    }
+}
+
+// Clears, rasterizes every overlapping triangle and builds the hierarchical-Z of one tile
+void occlusion_tile_job(void* data) {
+    occlusion_job_t* job = (occlusion_job_t*)data;
+    occlusion_buffer_t* self = job->buffer;
+    int32_t x0 = (int32_t)(job->index % OCCLUSION_TILES_X) * OCCLUSION_TILE;
+    int32_t y0 = (int32_t)(job->index / OCCLUSION_TILES_X) * OCCLUSION_TILE;
+    int32_t x1 = x0 + OCCLUSION_TILE - 1;
+    int32_t y1 = y0 + OCCLUSION_TILE - 1;
+
+    for (int32_t y = y0; y <= y1; ++y) {
+        for (int32_t x = x0; x <= x1; ++x) {
+            self->depth[y * OCCLUSION_WIDTH + x] = 1.0f;
+        }
+    }
+
+    for (size_t i = 0; i < self->draws_count; ++i) {
+        const occlusion_draw_t* draw = &self->draws[i];
+
+        for (size_t j = 0; j < draw->triangles_count; ++j) {
+            const occlusion_triangle_t* triangle = &self->triangles[draw->first_triangle + j];
+
+            if (triangle->bounds[0] > x1 || triangle->bounds[2] < x0 || triangle->bounds[1] > y1 || triangle->bounds[3] < y0) {
+                continue;
+            }
+
+            occlusion_rasterize(
+                self->depth,
+                triangle,
+                triangle->bounds[0] > x0 ? triangle->bounds[0] : x0,
+                triangle->bounds[1] > y0 ? triangle->bounds[1] : y0,
+                triangle->bounds[2] < x1 ? triangle->bounds[2] : x1,
+                triangle->bounds[3] < y1 ? triangle->bounds[3] : y1
+            );
+        }
+    }
+
+    for (int32_t by = y0 / OCCLUSION_BLOCK; by <= y1 / OCCLUSION_BLOCK; ++by) {
+        for (int32_t bx = x0 / OCCLUSION_BLOCK; bx <= x1 / OCCLUSION_BLOCK; ++bx) {
+            float farthest = 0.0f;
+
+            for (int32_t y = by * OCCLUSION_BLOCK; y < (by + 1) * OCCLUSION_BLOCK; ++y) {
+                for (int32_t x = bx * OCCLUSION_BLOCK; x < (bx + 1) * OCCLUSION_BLOCK; ++x) {
+                    farthest = fmaxf(farthest, self->depth[y * OCCLUSION_WIDTH + x]);
+                }
+            }
+
+            self->hiz[by * OCCLUSION_BLOCKS_X + bx] = farthest;
+        }
+    }
+}
+
+bool occlusion_buffer_reserve(occlusion_buffer_t* self, size_t triangles_count, size_t jobs_count) {
+    if (triangles_count > self->triangles_capacity) {
+        occlusion_triangle_t* triangles = (occlusion_triangle_t*)realloc(self->triangles, triangles_count * sizeof(occlusion_triangle_t));
+
+        if (!triangles) {
+            return false;
+        }
+
+        self->triangles = triangles;
+        self->triangles_capacity = triangles_count;
+    }
+
+    if (jobs_count > self->jobs_capacity) {
+        occlusion_job_t* jobs = (occlusion_job_t*)realloc(self->jobs, jobs_count * sizeof(occlusion_job_t));
+
+        if (!jobs) {
+            return false;
+        }
+
+        self->jobs = jobs;
+        self->jobs_capacity = jobs_count;
+    }
+
+    return true;
+}
+
+void occlusion_buffer_dispatch(occlusion_buffer_t* self, job_function_t function, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        self->jobs[i] = (occlusion_job_t) {
+            .buffer = self,
+            .index = i
+        };
+
+        if (self->job_pool) {
+            job_pool_push(self->job_pool, function, &self->jobs[i]);
+        }
+        else {
+            function(&self->jobs[i]);
+        }
+    }
+
+    if (self->job_pool) {
+        job_pool_wait(self->job_pool);
+    }
+}
+
+// Renders the queued occluders: one job per occluder sets up triangles, then one job per tile rasterizes them.
+// Jobs pushed to the pool before the call run alongside, nothing waits on the GPU.
+void occlusion_buffer_render(occlusion_buffer_t* self) {
+    const size_t tiles_count = OCCLUSION_TILES_X * OCCLUSION_TILES_Y;
+    size_t triangles_count = 0;
+
+    if (!self->depth || !self->hiz) {
+        return;
+    }
+
+    for (size_t i = 0; i < self->draws_count; ++i) {
+        self->draws[i].first_triangle = triangles_count;
+        triangles_count += self->draws[i].occluder->indices_count / 3;
+    }
+
+    if (!occlusion_buffer_reserve(self, triangles_count, self->draws_count > tiles_count ? self->draws_count : tiles_count)) {
+        self->draws_count = 0;
+    }
+
+    occlusion_buffer_dispatch(self, occlusion_setup_job, self->draws_count);
+    occlusion_buffer_dispatch(self, occlusion_tile_job, tiles_count);
+}
+
+// Whether the box bounds moved by matrix may be visible. Boxes reaching behind the camera always are.
+bool occlusion_buffer_test(const occlusion_buffer_t* self, const vec3 bounds[2], mat4 matrix) {
+    float min_x = FLT_MAX;
+    float min_y = FLT_MAX;
+    float max_x = -FLT_MAX;
+    float max_y = -FLT_MAX;
+    float nearest = FLT_MAX;
+    mat4 transform;
+
+    glm_mat4_mul((vec4*)self->view_projection, matrix, transform);
+
+    for (int i = 0; i < 8; ++i) {
+        vec4 corner = { bounds[i & 1][0], bounds[(i >> 1) & 1][1], bounds[(i >> 2) & 1][2], 1.0f };
+        vec4 clip;
+
+        glm_mat4_mulv(transform, corner, clip);
+
+        if (clip[3] <= 1e-5f) {
+            return true;
+        }
+
+        float x = (clip[0] / clip[3] * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+        float y = (clip[1] / clip[3] * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+        float z = clip[2] / clip[3] * 0.5f + 0.5f;
+
+        min_x = fminf(min_x, x);
+        min_y = fminf(min_y, y);
+        max_x = fmaxf(max_x, x);
+        max_y = fmaxf(max_y, y);
+        nearest = fminf(nearest, z);
+    }
+
+    int32_t bx0 = min_x <= 0.0f ? 0 : (int32_t)min_x / OCCLUSION_BLOCK;
+    int32_t by0 = min_y <= 0.0f ? 0 : (int32_t)min_y / OCCLUSION_BLOCK;
+    int32_t bx1 = max_x >= OCCLUSION_WIDTH ? OCCLUSION_BLOCKS_X - 1 : (int32_t)max_x / OCCLUSION_BLOCK;
+    int32_t by1 = max_y >= OCCLUSION_HEIGHT ? OCCLUSION_BLOCKS_Y - 1 : (int32_t)max_y / OCCLUSION_BLOCK;
+
+    for (int32_t by = by0; by <= by1; ++by) {
+        for (int32_t bx = bx0; bx <= bx1; ++bx) {
+            if (nearest <= self->hiz[by * OCCLUSION_BLOCKS_X + bx]) {
+                return true;
+            }
+        }
+    }
+
+    // Off screen boxes are left to frustum culling
+    return bx0 > bx1 || by0 > by1;
+}
+
+
+// Only the low RENDER_KEY_ID_BITS of the GL names take part, a collision only costs a redundant state change
+uint64_t render_key_make(GLuint pass, bool translucent, GLuint program, GLuint textures, GLuint mesh, float depth) {
+    const uint64_t id_mask = (1u << RENDER_KEY_ID_BITS) - 1;
+    const uint64_t depth_mask = (1u << RENDER_KEY_DEPTH_BITS) - 1;
+    uint32_t depth_bits;
+    uint64_t state;
+
+    // Non-negative floats order like their bit patterns, the top 24 bits below the sign keep that order
+    depth = depth > 0.0f ? depth : 0.0f;
+    memcpy(&depth_bits, &depth, sizeof(depth_bits));
+
+    uint64_t quantized = (depth_bits >> (31 - RENDER_KEY_DEPTH_BITS)) & depth_mask;
+
+    state = ((program & id_mask) << (RENDER_KEY_ID_BITS * 2)) | ((textures & id_mask) << RENDER_KEY_ID_BITS) | (mesh & id_mask);
+
+    uint64_t result = ((uint64_t)(pass & 3) << RENDER_KEY_PASS_SHIFT) | ((uint64_t)translucent << RENDER_KEY_TRANSLUCENT_SHIFT);
+
+    if (translucent) {
+        return result | ((depth_mask - quantized) << (RENDER_KEY_ID_BITS * 3)) | state;
+    }
+
+    return result | (state << RENDER_KEY_DEPTH_BITS) | quantized;
+}
+
+void command_list_destroy(command_list_t* self) {
+    free(self->draws);
+    free(self->keys);
+
+    *self = (command_list_t) {
+        .draws = NULL
+    };
+}
+
+bool command_list_reserve(command_list_t* self, GLsizei count) {
+    if (count <= self->capacity) {
+        return true;
+    }
+
+    GLsizei capacity = self->capacity ? self->capacity * 2 : 1024;
+
+    while (capacity < count) {
+        capacity *= 2;
+    }
+
+    render_draw_t* draws = (render_draw_t*)aligned_alloc(32, (size_t)capacity * sizeof(render_draw_t));
+    uint64_t* keys = (uint64_t*)realloc(self->keys, (size_t)capacity * sizeof(uint64_t));
+
+    if (keys) {
+        self->keys = keys;
+    }
+
+    if (!draws || !keys) {
+        free(draws);
+        return false;
+    }
+
+    if (self->draws) {
+        memcpy(draws, self->draws, (size_t)self->count * sizeof(render_draw_t));
+        free(self->draws);
+    }
+
+    self->draws = draws;
+    self->capacity = capacity;
+
+    return true;
+}
+
+// job_pool NULL - only the calling thread records
+render_queue_t render_queue_create(const job_pool_t* job_pool) {
+    render_queue_t result = {
+        .camera = NULL,
+        .occlusion = NULL,
+        .job_pool = job_pool,
+        .foreign_reported = false,
+        .lists = NULL,
+        .lists_count = 0,
+        .draws = NULL,
+        .keys = NULL,
+        .order = NULL,
+        .keys_temporary = NULL,
+        .order_temporary = NULL,
+        .count = 0,
+        .capacity = 0
+    };
+    size_t lists_count = job_pool ? job_pool->threads_count + 1 : 1;
+
+    result.lists = (command_list_t*)calloc(lists_count, sizeof(command_list_t));
+
+    if (!result.lists) {
+        puts("Failed to allocate command lists");
+        return result;
+    }
+
+    result.lists_count = lists_count;
+
+    return result;
+}
+
+void render_queue_destroy(render_queue_t* self) {
+    for (size_t i = 0; i < self->lists_count; ++i) {
+        command_list_destroy(&self->lists[i]);
+    }
+
+    free(self->lists);
+    free(self->draws);
+    free(self->keys);
+    free(self->order);
+    free(self->keys_temporary);
+    free(self->order_temporary);
+
+    *self = (render_queue_t) {
+        .camera = NULL
+    };
+}
+
+// Starts a frame, the camera must stay unchanged until render_queue_submit
+void render_queue_begin(render_queue_t* self, const camera_t* camera) {
+    self->camera = camera;
+    self->owner = pthread_self();
+    self->count = 0;
+    camera_get_frustum(camera, self->planes);
+
+    for (size_t i = 0; i < self->lists_count; ++i) {
+        self->lists[i].count = 0;
+    }
+}
+
+// Room for the merged draws of all lists
+bool render_queue_reserve(render_queue_t* self, GLsizei count) {
+    if (count <= self->capacity) {
+        return true;
+    }
+
+    GLsizei capacity = self->capacity ? self->capacity * 2 : 1024;
+
+    while (capacity < count) {
+        capacity *= 2;
+    }
+
+    render_draw_t** draws = (render_draw_t**)realloc(self->draws, (size_t)capacity * sizeof(render_draw_t*));
+
+    if (draws) {
+        self->draws = draws;
+    }
+
+    uint64_t* keys = draws ? (uint64_t*)realloc(self->keys, (size_t)capacity * sizeof(uint64_t)) : NULL;
+
+    if (keys) {
+        self->keys = keys;
+    }
+
+    uint32_t* order = keys ? (uint32_t*)realloc(self->order, (size_t)capacity * sizeof(uint32_t)) : NULL;
+
+    if (order) {
+        self->order = order;
+    }
+
+    uint64_t* keys_temporary = (uint64_t*)malloc((size_t)capacity * sizeof(uint64_t));
+    uint32_t* order_temporary = (uint32_t*)malloc((size_t)capacity * sizeof(uint32_t));
+
+    if (!order || !keys_temporary || !order_temporary) {
+        free(keys_temporary);
+        free(order_temporary);
+        return false;
+    }
+
+    free(self->keys_temporary);
+    free(self->order_temporary);
+
+    self->keys_temporary = keys_temporary;
+    self->order_temporary = order_temporary;
+    self->capacity = capacity;
+
+    return true;
+}
+
+// render_queue_push for a draw already tested against the queue's frustum, such as a batch from world_cull_batch
+void render_queue_record(render_queue_t* self, object_t* object, mat4 matrix, GLint joints_offset, GLuint pass, bool translucent) {
+    size_t index = job_thread_get_index(self->job_pool);
+    GLuint textures = 0;
+
+    // List 0 belongs to the thread that called render_queue_begin, any other thread outside of the pool is rejected
+    if (index >= self->lists_count || (!index && !pthread_equal(pthread_self(), self->owner))) {
+        if (!atomic_exchange(&self->foreign_reported, true)) {
+            puts("render_queue_push called from a thread outside of the queue's job pool, its draws are dropped");
+        }
+
+        return;
     }
-    if (geometry_shader.id) {
-        shader_destroy(&geometry_shader);
+
+    if (object->task || !object->program.id) {
+        return;
     }
-    if (vertex_shader.id) {
-        shader_destroy(&vertex_shader);
+
+    if (joints_offset < 0 && self->occlusion && !occlusion_buffer_test(self->occlusion, (const vec3*)object->mesh.bounds, matrix)) {
+        return;
     }
 
-    if (!program_check(&result.program)) {
-        return object_default();
+    command_list_t* list = &self->lists[index];
+
+    if (!command_list_reserve(list, list->count + 1)) {
+        return;
     }
 
-    for (int i = 0; i < textures_count; ++i) {
-        textures[i] = texture_create(texture_file_names[i]);
+    for (int i = 0; i < object->textures_count; ++i) {
+        textures = textures * 31 + object->textures[i].id;
+    }
 
-        if (!textures[i].id) {
-            for (int j = 0; j < i; ++j) {
-                texture_destroy(&textures[j]);
-            }
+    // View space depth of the origin, the camera looks down -z
+    float depth = -(self->camera->view[0][2] * matrix[3][0] + self->camera->view[1][2] * matrix[3][1] + self->camera->view[2][2] * matrix[3][2] + self->camera->view[3][2]);
+    render_draw_t* draw = &list->draws[list->count];
 
-            printf("Error load:\n    %s\n", texture_file_names[i]);
+    glm_mat4_copy(matrix, draw->matrix);
+    draw->object = object;
+    draw->joints_offset = joints_offset;
 
-            return object_default();
+    list->keys[list->count] = render_key_make(pass, translucent, object->program.id, textures, object->mesh.id, depth);
+    list->count += 1;
+}
+
+// Queues the object's mesh at matrix unless it is outside the frustum. pass orders groups of draws (0 to 3),
+// translucent draws go after the opaque ones of their pass with blending on and depth writes off.
+// Safe to call from the thread that called render_queue_begin and from jobs of the queue's job pool at the same time.
+// Makes no GL calls, so objects still compiling are skipped until object_is_ready adopts their program on the GL thread.
+void render_queue_push(render_queue_t* self, object_t* object, mat4 matrix, GLint joints_offset, GLuint pass, bool translucent) {
+    if (joints_offset < 0 && !mesh_in_frustum(&object->mesh, (const vec4*)self->planes, matrix)) {
+        return;
+    }
+
+    render_queue_record(self, object, matrix, joints_offset, pass, translucent);
+}
+
+void world_ready_system(const ecs_view_t* view, void* data) {
+    render_component_t* renders = (render_component_t*)ecs_view_get(view, ECS_COMPONENT_RENDER);
+
+    (void)data;
+
+    for (uint32_t i = 0; i < view->count; ++i) {
+        if (renders[i].object) {
+            object_is_ready(renders[i].object);
         }
     }
+}
 
-    if (!mesh_file_name) {
-        GLfloat positions[] = {
-            -1.0f, 1.0f, 0.0f,
-            1.0f, 1.0f, 0.0f,
-            1.0f, -1.0f, 0.0f,
-            -1.0f, -1.0f, 0.0f
+void world_record_system(const ecs_view_t* view, void* data) {
+    render_queue_t* queue = (render_queue_t*)data;
+    transform_component_t* transforms = (transform_component_t*)ecs_view_get(view, ECS_COMPONENT_TRANSFORM);
+    render_component_t* renders = (render_component_t*)ecs_view_get(view, ECS_COMPONENT_RENDER);
+    uint8_t tests[WORLD_CULL_BATCH];
 
-            // -1.0f, 1.0f, -1.0f,
-            // 1.0f, 1.0f, -1.0f,
-            // 1.0f, 1.0f, 0.0f,
-            // -1.0f, 1.0f, 0.0f
-        };
+    for (uint32_t i = 0; i < view->count; ++i) {
+        if (i % WORLD_CULL_BATCH == 0) {
+            world_cull_batch((const vec4*)queue->planes, &transforms[i], &renders[i], view->count - i < WORLD_CULL_BATCH ? view->count - i : WORLD_CULL_BATCH, tests);
+        }
 
-        GLfloat texture_coords[] = {
-            0.0f, 0.0f,
-            1.0f, 0.0f,
-            1.0f, 1.0f,
-            0.0f, 1.0f
+        if (renders[i].object && tests[i % WORLD_CULL_BATCH] != FRUSTUM_TEST_OUTSIDE) {
+            render_queue_record(queue, renders[i].object, transforms[i].matrix, render_component_get_joints_offset(&renders[i]), 0, false);
+        }
+    }
+}
 
-            // 0.0f, 0.0f,
-            // 1.0f, 0.0f,
-            // 1.0f, 1.0f,
-            // 0.0f, 1.0f
-        };
+// Culls and records every entity with a transform and a render component into queue in parallel on the world's job pool,
+// which must be the queue's one. Call on the GL thread and draw with render_queue_submit.
+void world_record(world_t* self, render_queue_t* queue) {
+    uint64_t mask = (1ull << ECS_COMPONENT_TRANSFORM) | (1ull << ECS_COMPONENT_RENDER);
 
-        GLfloat colors[] = {
-            1.0f, 1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f, 1.0f,
-            1.0f, 1.0f, 1.0f, 1.0f
+    // Compile tasks are polled and their programs adopted here on the GL thread, the jobs only read the result
+    for (uint32_t i = 0; i < self->archetypes_count; ++i) {
+        archetype_t* archetype = &self->archetypes[i];
 
-            // 1.0f, 1.0f, 1.0f, 1.0f,
-            // 1.0f, 1.0f, 1.0f, 1.0f,
-            // 1.0f, 1.0f, 1.0f, 1.0f,
-            // 1.0f, 1.0f, 1.0f, 1.0f
-        };
+        if ((archetype->mask & mask) != mask) {
+            continue;
+        }
 
-        GLuint indices[] = {
-            0, 1, 2,
-            2, 3, 0
-            // 4, 5, 6,
-            // 6, 7, 4
-        };
+        for (uint32_t j = 0; j < archetype->chunks_count; ++j) {
+            ecs_view_t view = {
+                .archetype = archetype,
+                .chunk = archetype->chunks[j],
+                .count = archetype->counts[j]
+            };
 
-        GLuint vertices_count = array_size(positions) / 3;
+            world_ready_system(&view, NULL);
+        }
+    }
+
+    world_run(self, mask, world_record_system, queue);
+}
+
+// Sorts and draws the frame, the program and camera uniforms are only set when the program changes and textures when they differ
+// Translucent runs blend with the function set by gl_load, blending and depth writes are left as gl_load sets them.
+void render_queue_submit(render_queue_t* self) {
+    object_t* bound = NULL;
+    bool blending = false;
+    GLsizei count = 0;
+
+    for (size_t i = 0; i < self->lists_count; ++i) {
+        count += self->lists[i].count;
+    }
+
+    if (!render_queue_reserve(self, count)) {
+        return;
+    }
+
+    // Lists go in thread order, the stable sort keeps equal keys in recording order within each
+    for (size_t i = 0; i < self->lists_count; ++i) {
+        command_list_t* list = &self->lists[i];
+
+        for (GLsizei j = 0; j < list->count; ++j) {
+            self->draws[self->count] = &list->draws[j];
+            self->keys[self->count] = list->keys[j];
+            self->order[self->count] = (uint32_t)self->count;
+            self->count += 1;
+        }
 
-        result.mesh.indices_count = array_size(indices);
-        result.mesh.id = _mesh_create_(vertices_count, positions, NULL, texture_coords, colors, NULL, NULL, result.mesh.indices_count, indices);
+        list->count = 0;
+    }
+
+    radix_sort(self->keys, self->order, self->keys_temporary, self->order_temporary, (size_t)self->count);
+
+    // gl_load enables blending globally, opaque runs need it off. Set rather than queried, a glGet would stall the pipeline.
+    glDisable(GL_BLEND);
+    gl_debug();
+    glDepthMask(GL_TRUE);
+    gl_debug();
 
-        if (!result.mesh.id) {
-            for (int i = 0; i < textures_count; ++i) {
-                texture_destroy(&textures[i]);
+    for (GLsizei i = 0; i < self->count; ++i) {
+        render_draw_t* draw = self->draws[self->order[i]];
+        object_t* object = draw->object;
+        bool translucent = (self->keys[i] >> RENDER_KEY_TRANSLUCENT_SHIFT) & 1;
+
+        if (translucent != blending) {
+            if (translucent) {
+                glEnable(GL_BLEND);
+                gl_debug();
+                glDepthMask(GL_FALSE);
+                gl_debug();
+            }
+            else {
+                glDisable(GL_BLEND);
+                gl_debug();
+                glDepthMask(GL_TRUE);
+                gl_debug();
             }
 
-            mesh_destroy(&result.mesh);
-            program_destroy(&result.program);
+            blending = translucent;
+        }
+
+        if (object != bound) {
+            bool same_textures = bound && bound->textures_count == object->textures_count;
 
-            return object_default();
+            for (int j = 0; same_textures && j < object->textures_count; ++j) {
+                same_textures = bound->textures[j].id == object->textures[j].id;
+            }
+
+            if (!bound || bound->program.id != object->program.id) {
+                object_bind(object, (camera_t*)self->camera);
+            }
+            else if (!same_textures) {
+                object_bind_textures(object);
+            }
+
+            bound = object;
         }
+
+        glUniformMatrix4fv(glGetUniformLocation(object->program.id, "model"), 1, GL_FALSE, &draw->matrix[0][0]);
+        gl_debug();
+        glUniform1i(glGetUniformLocation(object->program.id, "joints_offset"), draw->joints_offset);
+        gl_debug();
+
+        object_draw_mesh(object, (camera_t*)self->camera, draw->matrix);
     }
 
-    result.textures = (texture_t*)calloc((size_t)textures_count, sizeof(texture_t));
+    // Back to the defaults of gl_load for object_draw and sprites
+    glEnable(GL_BLEND);
+    gl_debug();
+    glDepthMask(GL_TRUE);
+    gl_debug();
 
-    if (result.textures) {
-        for (int i = 0; i < textures_count; ++i) {
-            result.textures[i] = textures[i];
+    self->count = 0;
+}
+
+
+sprite_batch_t sprite_batch_create() {
+    const vertex_format formats[VERTEX_ATTRIBUTE_TYPE_COUNT] = {
+        [VERTEX_ATTRIBUTE_TYPE_POSITION] = VERTEX_FORMAT_FLOAT_3,
+        [VERTEX_ATTRIBUTE_TYPE_TEX_COORD] = VERTEX_FORMAT_FLOAT_2,
+        [VERTEX_ATTRIBUTE_TYPE_COLOR] = VERTEX_FORMAT_UNORM_8_4
+    };
+    sprite_batch_t result = {
+        .id = 0,
+        .index_buffer = 0,
+        .layout = vertex_layout_create(formats),
+        .vertices = ring_buffer_create(),
+        .first = 0,
+        .count = 0,
+        .camera = NULL,
+        .program = NULL,
+        .texture = NULL
+    };
+    GLuint* indices = (GLuint*)malloc(sizeof(GLuint) * 6 * SPRITE_BATCH_CAPACITY);
+
+    if (!indices) {
+        return result;
+    }
+
+    // Every draw starts at index 0 and reaches its quads through base_vertex
+    for (GLuint i = 0; i < SPRITE_BATCH_CAPACITY; ++i) {
+        GLuint quad[6] = { 0, 1, 2, 2, 3, 0 };
+
+        for (int j = 0; j < 6; ++j) {
+            indices[i * 6 + (GLuint)j] = i * 4 + quad[j];
         }
     }
 
-    result.textures_count = textures_count;
+    glCreateBuffers(1, &result.index_buffer);
+    gl_debug();
+    glNamedBufferStorage(result.index_buffer, (GLsizeiptr)sizeof(GLuint) * 6 * SPRITE_BATCH_CAPACITY, indices, 0);
+    gl_debug();
+
+    free(indices);
+
+    if (!ring_buffer_reserve(&result.vertices, (GLsizeiptr)sizeof(sprite_vertex_t) * 4 * SPRITE_BATCH_CAPACITY)) {
+        return result;
+    }
+
+    glCreateVertexArrays(1, &result.id);
+    gl_debug();
+    glVertexArrayVertexBuffer(result.id, 0, result.vertices.buffer, 0, (GLsizei)result.layout.stride);
+    gl_debug();
+    glVertexArrayElementBuffer(result.id, result.index_buffer);
+    gl_debug();
+
+    vertex_layout_apply(&result.layout, result.id, 0);
+
+    return result;
+}
+
+void sprite_batch_destroy(sprite_batch_t* self) {
+    ring_buffer_destroy(&self->vertices);
+
+    glDeleteVertexArrays(1, &self->id);
+    gl_debug();
+    glDeleteBuffers(1, &self->index_buffer);
+    gl_debug();
+
+    *self = (sprite_batch_t) {
+        .id = 0
+    };
+}
+
+// Draws the sprites pushed since the last flush
+void sprite_batch_flush(sprite_batch_t* self) {
+    mat4 identity = GLM_MAT4_IDENTITY_INIT;
+
+    if (!self->count) {
+        return;
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    gl_debug();
+    texture_bind(self->texture);
+
+    program_use(self->program, self->camera, identity);
+    glUniform1i(glGetUniformLocation(self->program->id, "texture_diffuse1"), 0);
+    gl_debug();
+    glUniform1i(glGetUniformLocation(self->program->id, "texture_diffuse2"), 0);
+    gl_debug();
+    glUniform1i(glGetUniformLocation(self->program->id, "joints_offset"), -1);
+    gl_debug();
+
+    glBindVertexArray(self->id);
+    gl_debug();
+    glDrawElementsBaseVertex(GL_TRIANGLES, self->count * 6, GL_UNSIGNED_INT, NULL, self->first);
+    gl_debug();
+    glBindVertexArray(0);
+    gl_debug();
+
+    self->count = 0;
+}
+
+// The camera must stay unchanged until sprite_batch_end
+void sprite_batch_begin(sprite_batch_t* self, const camera_t* camera) {
+    self->camera = camera;
+}
+
+// Flushes first when program or texture differ from the pending sprites, or the run or region is full
+void sprite_batch_push(sprite_batch_t* self, const program_t* program, const texture_t* texture, const sprite_t* sprite) {
+    const GLsizeiptr size = (GLsizeiptr)sizeof(sprite_vertex_t) * 4;
+    GLintptr offset = 0;
+
+    if (!self->vertices.buffer) {
+        return;
+    }
+
+    if (self->count && (program != self->program || texture->id != self->texture->id || self->count == SPRITE_BATCH_CAPACITY || !ring_buffer_fits(&self->vertices, size, sizeof(sprite_vertex_t)))) {
+        sprite_batch_flush(self);
+    }
+
+    sprite_vertex_t* vertices = (sprite_vertex_t*)ring_buffer_allocate(&self->vertices, size, sizeof(sprite_vertex_t), &offset);
+
+    if (!vertices) {
+        return;
+    }
+
+    if (!self->count) {
+        self->first = (GLint)(offset / (GLintptr)sizeof(sprite_vertex_t));
+    }
+
+    self->program = program;
+    self->texture = texture;
+    float left = sprite->position[0] - sprite->size[0] * 0.5f;
+    float right = sprite->position[0] + sprite->size[0] * 0.5f;
+    float bottom = sprite->position[1] - sprite->size[1] * 0.5f;
+    float top = sprite->position[1] + sprite->size[1] * 0.5f;
+    uint8_t color[4];
+
+    for (int i = 0; i < 4; ++i) {
+        color[i] = float_to_unorm_8(sprite->color[i]);
+    }
+
+    // Corners in the order of the object_create quad: top left, top right, bottom right, bottom left
+    sprite_vertex_t corners[4] = {
+        { { left, top, sprite->layer }, { sprite->uv[0], sprite->uv[1] }, { color[0], color[1], color[2], color[3] } },
+        { { right, top, sprite->layer }, { sprite->uv[2], sprite->uv[1] }, { color[0], color[1], color[2], color[3] } },
+        { { right, bottom, sprite->layer }, { sprite->uv[2], sprite->uv[3] }, { color[0], color[1], color[2], color[3] } },
+        { { left, bottom, sprite->layer }, { sprite->uv[0], sprite->uv[3] }, { color[0], color[1], color[2], color[3] } }
+    };
+
+    memcpy(vertices, corners, sizeof(corners));
+
+    self->count += 1;
+}
+
+// Once per frame, the next frame writes into the next region
+void sprite_batch_end(sprite_batch_t* self) {
+    sprite_batch_flush(self);
+    ring_buffer_advance(&self->vertices);
+}
+
+
+// Nanoseconds on the GLFW timer, monotonic and usable from any thread
+uint64_t profiler_now() {
+    uint64_t value = glfwGetTimerValue();
+    uint64_t frequency = glfwGetTimerFrequency();
+
+    return value / frequency * 1000000000ull + value % frequency * 1000000000ull / frequency;
+}
+
+profiler_t profiler_create() {
+    profiler_t result = {
+        .frame = 0,
+        .depth = 0,
+        .events = NULL,
+        .events_count = 0,
+        .events_capacity = 0,
+        .mutex = PTHREAD_MUTEX_INITIALIZER,
+        .frame_begin = 0,
+        .cpu_frame_time = 0,
+        .gpu_frame_time = 0,
+        .frames_dropped = 0
+    };
+
+    for (int i = 0; i < PROFILER_FRAMES; ++i) {
+        glCreateQueries(GL_TIMESTAMP, PROFILER_ZONES * 2, result.frames[i].queries);
+        gl_debug();
+    }
+
+    return result;
+}
+
+void profiler_destroy(profiler_t* self) {
+    for (int i = 0; i < PROFILER_FRAMES; ++i) {
+        glDeleteQueries(PROFILER_ZONES * 2, self->frames[i].queries);
+        gl_debug();
+    }
+
+    pthread_mutex_destroy(&self->mutex);
+    free(self->events);
+
+    *self = (profiler_t) {
+        .events = NULL
+    };
+}
+
+void profiler_push(profiler_t* self, const char* name, uint64_t begin, uint64_t end, uint32_t thread) {
+    pthread_mutex_lock(&self->mutex);
+
+    if (self->events_count == self->events_capacity && self->events_capacity < PROFILER_MAX_EVENTS) {
+        size_t capacity = self->events_capacity ? self->events_capacity * 2 : 1024;
+        profiler_event_t* events = (profiler_event_t*)realloc(self->events, capacity * sizeof(profiler_event_t));
+
+        if (events) {
+            self->events = events;
+            self->events_capacity = capacity;
+        }
+    }
+
+    if (self->events_count < self->events_capacity) {
+        self->events[self->events_count++] = (profiler_event_t) {
+            .name = name,
+            .begin = begin,
+            .end = end,
+            .thread = thread
+        };
+    }
+
+    pthread_mutex_unlock(&self->mutex);
+}
+
+// Records a CPU zone from begin (profiler_now) until now
+void profiler_cpu_zone(profiler_t* self, const char* name, uint64_t begin) {
+    profiler_push(self, name, begin, profiler_now(), job_thread_get_id());
+}
+
+// Reads the frame's queries if the GPU is done with them, never waits
+void profiler_collect(profiler_t* self, profiler_frame_t* frame) {
+    GLuint available = GL_FALSE;
+    uint64_t first = UINT64_MAX;
+    uint64_t last = 0;
+
+    if (!frame->last) {
+        return;
+    }
+
+    glGetQueryObjectuiv(frame->last, GL_QUERY_RESULT_AVAILABLE, &available);
+    gl_debug();
+
+    if (!available) {
+        self->frames_dropped += 1;
+        return;
+    }
+
+    for (GLsizei i = 0; i < frame->count; ++i) {
+        GLuint64 begin = 0;
+        GLuint64 end = 0;
+
+        // A zone left open at the end of the frame never wrote its end timestamp
+        if (!frame->ended[i]) {
+            continue;
+        }
+
+        glGetQueryObjectui64v(frame->queries[i * 2], GL_QUERY_RESULT, &begin);
+        gl_debug();
+        glGetQueryObjectui64v(frame->queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+        gl_debug();
+
+        // The GPU clock is moved onto the CPU one through the pair of timestamps taken at profiler_begin_frame
+        begin = frame->cpu_base + (begin - (uint64_t)frame->gpu_base);
+        end = frame->cpu_base + (end - (uint64_t)frame->gpu_base);
+        first = begin < first ? begin : first;
+        last = end > last ? end : last;
+
+        profiler_push(self, frame->names[i], begin, end, PROFILER_GPU_THREAD);
+    }
+
+    self->gpu_frame_time = last - first;
+}
+
+// Once per frame on the GL thread before any GPU zone. cpu_frame_time and gpu_frame_time then hold the last measured
+// frame, a GPU time close to the CPU one means the frame is GPU bound.
+void profiler_begin_frame(profiler_t* self) {
+    uint64_t now = profiler_now();
+
+    self->cpu_frame_time = self->frame_begin ? now - self->frame_begin : 0;
+    self->frame_begin = now;
+    self->frame = (self->frame + 1) % PROFILER_FRAMES;
+    self->depth = 0;
+
+    profiler_frame_t* frame = &self->frames[self->frame];
+
+    profiler_collect(self, frame);
+
+    frame->count = 0;
+    frame->last = 0;
+    frame->cpu_base = profiler_now();
+    glGetInteger64v(GL_TIMESTAMP, &frame->gpu_base);
+    gl_debug();
+}
+
+// GPU zones nest and must be ended on the GL thread within the frame, zones beyond PROFILER_ZONES are not measured
+void profiler_gpu_begin(profiler_t* self, const char* name) {
+    profiler_frame_t* frame = &self->frames[self->frame];
+
+    // Too deep, profiler_gpu_end pops it without a stack entry
+    if (self->depth >= PROFILER_MAX_DEPTH) {
+        self->depth += 1;
+        return;
+    }
+
+    if (frame->count == PROFILER_ZONES) {
+        self->stack[self->depth++] = -1;
+        return;
+    }
+
+    glQueryCounter(frame->queries[frame->count * 2], GL_TIMESTAMP);
+    gl_debug();
+
+    frame->names[frame->count] = name;
+    frame->ended[frame->count] = false;
+    self->stack[self->depth++] = frame->count++;
+}
+
+void profiler_gpu_end(profiler_t* self) {
+    profiler_frame_t* frame = &self->frames[self->frame];
+
+    if (!self->depth) {
+        return;
+    }
+
+    if (--self->depth >= PROFILER_MAX_DEPTH) {
+        return;
+    }
+
+    GLint zone = self->stack[self->depth];
+
+    if (zone < 0) {
+        return;
+    }
+
+    glQueryCounter(frame->queries[zone * 2 + 1], GL_TIMESTAMP);
+    gl_debug();
 
-    return result;
+    frame->ended[zone] = true;
+    frame->last = frame->queries[zone * 2 + 1];
 }
 
-void object_destroy(object_t* self) {
-    for (int i = 0; i < self->textures_count; ++i) {
-        texture_destroy(&self->textures[i]);
+// Writes the zones collected so far as a Chrome trace (chrome://tracing, Perfetto) and clears them
+bool profiler_export(profiler_t* self, const char* file_name) {
+    FILE* stream = fopen(file_name, "w");
+    bool result = false;
+
+    if (!stream) {
+        printf("%s is not opened\n", file_name);
+        return result;
     }
 
-    self->textures_count = 0;
+    pthread_mutex_lock(&self->mutex);
 
-    if (self->mesh.id) {
-        mesh_destroy(&self->mesh);
-    }
+    uint64_t origin = UINT64_MAX;
 
-    if (self->program.id) {
-        program_destroy(&self->program);
+    for (size_t i = 0; i < self->events_count; ++i) {
+        origin = self->events[i].begin < origin ? self->events[i].begin : origin;
     }
 
-    *self = object_default();
-}
+    fprintf(stream, "{\"traceEvents\":[\n");
+    fprintf(stream, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"GPU\"}}", PROFILER_GPU_THREAD);
 
-void object_draw(object_t* self, camera_t* camera) {
-    for (int i = 0; i < self->textures_count; ++i) {
-        glActiveTexture(GL_TEXTURE0 + (GLenum)i);
-        gl_debug();
-        texture_bind(&self->textures[i]);
+    for (size_t i = 0; i < self->events_count; ++i) {
+        const profiler_event_t* event = &self->events[i];
+
+        fprintf(
+            stream,
+            ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+            event->name,
+            event->thread,
+            (double)(event->begin - origin) / 1000.0,
+            (double)(event->end - event->begin) / 1000.0
+        );
     }
 
-    program_use(&self->program, camera, self->matrix);
+    fprintf(stream, "\n]}\n");
 
-    glUniform1i(glGetUniformLocation(self->program.id, "texture_diffuse1"), 0);
-    gl_debug();
-    glUniform1i(glGetUniformLocation(self->program.id, "texture_diffuse2"), 1);
-    gl_debug();
+    self->events_count = 0;
+
+    pthread_mutex_unlock(&self->mutex);
+
+    result = !ferror(stream);
+
+    if (fclose(stream)) {
+        printf("%s is not closed\n", file_name);
+        result = false;
+    }
 
-    mesh_draw(&self->mesh);
+    return result;
 }
 
 
@@ -1238,6 +9059,9 @@ camera_t camera_default() {
     glm_vec3_zero(result.direction);
     glm_vec3_zero(result.center);
 
+    result.viewport_height = 1.0f;
+    result.lod_threshold = 1.0f;
+
     return result;
 }
 
@@ -1263,16 +9087,33 @@ camera_t camera_initialize_3d() {
     return result;
 }
 
-void camera_update(camera_t* self, GLFWwindow* window) {
+uint32_t camera_input_poll(GLFWwindow* window) {
+    const int keys[] = {
+        GLFW_KEY_LEFT_SHIFT, GLFW_KEY_LEFT, GLFW_KEY_RIGHT, GLFW_KEY_UP, GLFW_KEY_DOWN,
+        GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_Q, GLFW_KEY_E, GLFW_KEY_W, GLFW_KEY_S,
+        GLFW_KEY_F, GLFW_KEY_2, GLFW_KEY_3
+    };
+    uint32_t result = 0;
+
+    // Bit i of camera_input is keys[i]
+    for (unsigned int i = 0; i < array_size(keys); ++i) {
+        result |= glfwGetKey(window, keys[i]) ? 1u << i : 0u;
+    }
+
+    return result;
+}
+
+// Moves the camera by delta seconds of input, safe on any thread
+void camera_simulate(camera_t* self, uint32_t input, float delta) {
     static vec3 up = { 0.0f, 1.0f, 0.0f };
-    float speed = 0.01f;
+    float speed = 0.6f * delta;
 
-    if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT)) {
+    if (input & CAMERA_INPUT_FAST) {
         speed *= 50.0f;
     }
 
 
-    if (glfwGetKey(window, GLFW_KEY_LEFT)) {
+    if (input & CAMERA_INPUT_LEFT) {
         self->rotation[0] -= 1.0f * speed;
 
         if (self->rotation[0] < 0.0f) {
@@ -1283,7 +9124,7 @@ void camera_update(camera_t* self, GLFWwindow* window) {
         self->direction[2] = -cosf(glm_rad(self->rotation[0]));
     }
 
-    if (glfwGetKey(window, GLFW_KEY_RIGHT)) {
+    if (input & CAMERA_INPUT_RIGHT) {
         self->rotation[0] += 1.0f * speed;
 
         if (self->rotation[0] >= 360.0f) {
@@ -1294,7 +9135,7 @@ void camera_update(camera_t* self, GLFWwindow* window) {
         self->direction[2] = -cosf(glm_rad(self->rotation[0]));
     }
 
-    if (glfwGetKey(window, GLFW_KEY_UP)) {
+    if (input & CAMERA_INPUT_UP) {
         self->rotation[1] += 1.0f * speed;
 
         if (self->rotation[1] >= 89.0f) {
@@ -1304,7 +9145,7 @@ void camera_update(camera_t* self, GLFWwindow* window) {
         self->direction[1] = tanf(glm_rad(self->rotation[1]));
     }
 
-    if (glfwGetKey(window, GLFW_KEY_DOWN)) {
+    if (input & CAMERA_INPUT_DOWN) {
         self->rotation[1] -= 1.0f * speed;
 
         if (self->rotation[1] < -89.0f) {
@@ -1315,7 +9156,7 @@ void camera_update(camera_t* self, GLFWwindow* window) {
     }
 
 
-    if (glfwGetKey(window, GLFW_KEY_A)) {
+    if (input & CAMERA_INPUT_STRAFE_L) {
         vec3 buffer = { 0.0f, 0.0f, 0.0f };
 
         glm_vec3_cross(self->direction, up, buffer);
@@ -1325,7 +9166,7 @@ void camera_update(camera_t* self, GLFWwindow* window) {
         self->position[2] -= glm_rad(buffer[2]) * speed;
     }
 
-    if (glfwGetKey(window, GLFW_KEY_D)) {
+    if (input & CAMERA_INPUT_STRAFE_R) {
         vec3 buffer = { 0.0f, 0.0f, 0.0f };
 
         glm_vec3_cross(self->direction, up, buffer);
@@ -1335,26 +9176,26 @@ void camera_update(camera_t* self, GLFWwindow* window) {
         self->position[2] += glm_rad(buffer[2]) * speed;
     }
 
-    if (glfwGetKey(window, GLFW_KEY_Q)) {
+    if (input & CAMERA_INPUT_LOWER) {
         self->position[1] -= glm_rad(1.0f) * speed;
     }
 
-    if (glfwGetKey(window, GLFW_KEY_E)) {
+    if (input & CAMERA_INPUT_RAISE) {
         self->position[1] += glm_rad(1.0f) * speed;
     }
 
-    if (glfwGetKey(window, GLFW_KEY_W)) {
+    if (input & CAMERA_INPUT_FORWARD) {
         self->position[0] += glm_rad(self->direction[0]) * speed;
         self->position[2] += glm_rad(self->direction[2]) * speed;
     }
 
-    if (glfwGetKey(window, GLFW_KEY_S)) {
+    if (input & CAMERA_INPUT_BACKWARD) {
         self->position[0] -= glm_rad(self->direction[0]) * speed;
         self->position[2] -= glm_rad(self->direction[2]) * speed;
     }
 
 
-    if (glfwGetKey(window, GLFW_KEY_F)) {
+    if (input & CAMERA_INPUT_RESET) {
         glm_vec3_zero(self->position);
         glm_vec3_zero(self->rotation);
         glm_vec3_zero(self->direction);
@@ -1364,11 +9205,11 @@ void camera_update(camera_t* self, GLFWwindow* window) {
     }
 
 
-    if (glfwGetKey(window, GLFW_KEY_2)) {
+    if (input & CAMERA_INPUT_2D) {
         camera_switch_2d(self);
     }
 
-    if (glfwGetKey(window, GLFW_KEY_3)) {
+    if (input & CAMERA_INPUT_3D) {
         camera_switch_3d(self);
     }
 
@@ -1379,6 +9220,316 @@ void camera_update(camera_t* self, GLFWwindow* window) {
     glm_lookat(self->position, self->center, up, self->view);
 }
 
+// current with position and center between previous (alpha 0) and current (alpha 1)
+void camera_blend(const camera_t* previous, const camera_t* current, float alpha, camera_t* destination) {
+    static vec3 up = { 0.0f, 1.0f, 0.0f };
+    float viewport_height = destination->viewport_height;
+
+    *destination = *current;
+    destination->viewport_height = viewport_height;
+
+    glm_vec3_lerp((float*)previous->position, (float*)current->position, alpha, destination->position);
+    glm_vec3_lerp((float*)previous->center, (float*)current->center, alpha, destination->center);
+    glm_lookat(destination->position, destination->center, up, destination->view);
+}
+
+void camera_update_viewport(camera_t* self, GLFWwindow* window) {
+    int width = 0;
+    int height = 0;
+
+    glfwGetFramebufferSize(window, &width, &height);
+
+    self->viewport_height = height > 0 ? (float)height : 1.0f;
+}
+
+// One 60 Hz step per call, use a simulation_t to move the camera independently of the frame rate
+void camera_update(camera_t* self, GLFWwindow* window) {
+    camera_simulate(self, camera_input_poll(window), 1.0f / 60.0f);
+    camera_update_viewport(self, window);
+}
+
+
+#define SIMULATION_MAX_STEPS 8
+
+// Advances state by delta seconds with the latest input
+typedef void (*simulation_step_t)(void* state, const void* input, float delta, void* data);
+
+// Writes the state between previous (alpha 0) and current (alpha 1) to destination
+typedef void (*simulation_blend_t)(const void* previous, const void* current, float alpha, void* destination, void* data);
+
+// Steps state at a fixed tick on its own thread. After every step the state is published as the current snapshot and the
+// former one becomes previous; the render thread blends the two, one tick behind real time, so motion stays smooth at
+// any frame rate. The state should hold only what rendering needs since it is copied on every publish.
+// Once the input is all zero and a step leaves the state unchanged the thread parks until simulation_set_input changes it,
+// so step must depend only on the state and input.
+typedef struct simulation_t {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    bool running;
+    bool parked;
+    double tick;
+    size_t state_size;
+    size_t input_size;
+    simulation_step_t step;
+    simulation_blend_t blend;
+    void* data;
+    uint8_t* state;
+    uint8_t* input;
+    uint8_t* step_input;
+    uint8_t* snapshots[2];
+    uint8_t* blended[2];
+    double current_time;
+    size_t steps_count;
+} simulation_t;
+
+// state is copied as the initial state of both snapshots, frequency is in steps per second
+simulation_t simulation_create(double frequency, const void* state, size_t state_size, size_t input_size, simulation_step_t step, simulation_blend_t blend, void* data) {
+    simulation_t result = {
+        .mutex = PTHREAD_MUTEX_INITIALIZER,
+        .wake = PTHREAD_COND_INITIALIZER,
+        .running = false,
+        .parked = false,
+        .tick = 1.0 / frequency,
+        .state_size = state_size,
+        .input_size = input_size,
+        .step = step,
+        .blend = blend,
+        .data = data,
+        .current_time = 0.0,
+        .steps_count = 0
+    };
+    uint8_t* memory = (uint8_t*)calloc(5 * state_size + 2 * input_size + 1, 1);
+
+    if (!memory) {
+        puts("Failed to allocate simulation state");
+        return result;
+    }
+
+    result.state = memory;
+    result.snapshots[0] = memory + state_size;
+    result.snapshots[1] = memory + state_size * 2;
+    result.blended[0] = memory + state_size * 3;
+    result.blended[1] = memory + state_size * 4;
+    result.input = memory + state_size * 5;
+    result.step_input = result.input + input_size;
+
+    memcpy(result.state, state, state_size);
+    memcpy(result.snapshots[0], state, state_size);
+    memcpy(result.snapshots[1], state, state_size);
+
+    return result;
+}
+
+void* simulation_thread(void* data) {
+    simulation_t* self = (simulation_t*)data;
+    double next = glfwGetTime();
+
+    pthread_mutex_lock(&self->mutex);
+
+    while (self->running) {
+        if (self->parked) {
+            pthread_cond_wait(&self->wake, &self->mutex);
+
+            // Resumes from now instead of catching up on the idle time
+            next = glfwGetTime();
+            continue;
+        }
+
+        double now = glfwGetTime();
+
+        if (now < next) {
+            struct timespec until;
+
+            // pthread_cond_timedwait takes CLOCK_REALTIME, glfwGetTime only measures the remaining wait
+            timespec_get(&until, TIME_UTC);
+            until.tv_nsec += (long)((next - now) * 1e9);
+            until.tv_sec += until.tv_nsec / 1000000000;
+            until.tv_nsec %= 1000000000;
+
+            pthread_cond_timedwait(&self->wake, &self->mutex, &until);
+            continue;
+        }
+
+        // A stalled simulation skips ahead rather than spiraling into ever more catch up steps
+        if (now - next > self->tick * SIMULATION_MAX_STEPS) {
+            next = now;
+        }
+
+        memcpy(self->step_input, self->input, self->input_size);
+        pthread_mutex_unlock(&self->mutex);
+
+        self->step(self->state, self->step_input, (float)self->tick, self->data);
+
+        pthread_mutex_lock(&self->mutex);
+
+        uint8_t* previous = self->snapshots[0];
+
+        self->snapshots[0] = self->snapshots[1];
+        self->snapshots[1] = previous;
+        memcpy(self->snapshots[1], self->state, self->state_size);
+
+        self->current_time = next;
+        self->steps_count += 1;
+        next += self->tick;
+
+        bool idle = !memcmp(self->snapshots[0], self->snapshots[1], self->state_size);
+
+        for (size_t i = 0; idle && i < self->input_size; ++i) {
+            idle = !self->step_input[i] && !self->input[i];
+        }
+
+        self->parked = idle;
+    }
+
+    pthread_mutex_unlock(&self->mutex);
+
+    return NULL;
+}
+
+// The simulation keeps a pointer to itself, it must not be moved after that
+bool simulation_start(simulation_t* self) {
+    if (self->running || !self->state) {
+        return self->running;
+    }
+
+    self->running = true;
+
+    if (pthread_create(&self->thread, NULL, simulation_thread, self)) {
+        puts("Failed to pthread_create()");
+        self->running = false;
+    }
+
+    return self->running;
+}
+
+// The input the next steps see, copied. A change wakes a parked simulation.
+void simulation_set_input(simulation_t* self, const void* input) {
+    pthread_mutex_lock(&self->mutex);
+
+    if (memcmp(self->input, input, self->input_size)) {
+        memcpy(self->input, input, self->input_size);
+
+        self->parked = false;
+        pthread_cond_signal(&self->wake);
+    }
+
+    pthread_mutex_unlock(&self->mutex);
+}
+
+// Blends the snapshots for the current time into destination, the state size large
+void simulation_interpolate(simulation_t* self, void* destination) {
+    pthread_mutex_lock(&self->mutex);
+
+    memcpy(self->blended[0], self->snapshots[0], self->state_size);
+    memcpy(self->blended[1], self->snapshots[1], self->state_size);
+
+    // Rendering runs one tick behind, between the time of the previous snapshot and the current one
+    double alpha = self->steps_count > 1 ? (glfwGetTime() - self->current_time) / self->tick : 1.0;
+
+    pthread_mutex_unlock(&self->mutex);
+
+    alpha = alpha < 0.0 ? 0.0 : alpha > 1.0 ? 1.0 : alpha;
+
+    self->blend(self->blended[0], self->blended[1], (float)alpha, destination, self->data);
+}
+
+void simulation_destroy(simulation_t* self) {
+    if (self->running) {
+        pthread_mutex_lock(&self->mutex);
+        self->running = false;
+        pthread_cond_signal(&self->wake);
+        pthread_mutex_unlock(&self->mutex);
+
+        pthread_join(self->thread, NULL);
+    }
+
+    free(self->state);
+
+    *self = (simulation_t) {
+        .state = NULL
+    };
+}
+
+void camera_simulation_step(void* state, const void* input, float delta, void* data) {
+    (void)data;
+
+    camera_simulate((camera_t*)state, *(const uint32_t*)input, delta);
+}
+
+void camera_simulation_blend(const void* previous, const void* current, float alpha, void* destination, void* data) {
+    (void)data;
+
+    camera_blend((const camera_t*)previous, (const camera_t*)current, alpha, (camera_t*)destination);
+}
+
+
+// Decides when a frame is worth rendering. Input on an attached window and frame_scheduler_invalidate (from any thread,
+// e.g. when a resource finished loading) request the next frame right away, frame_scheduler_schedule a frame at a time,
+// e.g. the next animated texture frame or audio visualization update. frame_scheduler_wait sleeps until either happens.
+typedef struct frame_scheduler_t {
+    atomic_bool dirty;
+    double deadline;
+} frame_scheduler_t;
+
+frame_scheduler_t frame_scheduler_create() {
+    frame_scheduler_t result = {
+        .dirty = true,
+        .deadline = DBL_MAX
+    };
+
+    return result;
+}
+
+// Input callbacks of a window_create_opengl window invalidate the scheduler, it must stay at this address while attached
+void frame_scheduler_attach(frame_scheduler_t* self, GLFWwindow* window) {
+    glfwSetWindowUserPointer(window, self);
+}
+
+void frame_scheduler_invalidate(frame_scheduler_t* self) {
+    atomic_store(&self->dirty, true);
+    glfwPostEmptyEvent();
+}
+
+// Main thread only, time is on the glfwGetTime clock
+void frame_scheduler_schedule(frame_scheduler_t* self, double time) {
+    self->deadline = time < self->deadline ? time : self->deadline;
+}
+
+// Processes events instead of glfwPollEvents and blocks until the next frame is due, then forgets the request.
+// Returns false when the window should close.
+bool frame_scheduler_wait(frame_scheduler_t* self, GLFWwindow* window) {
+    glfwPollEvents();
+
+    while (!glfwWindowShouldClose(window) && !atomic_load(&self->dirty)) {
+        double now = glfwGetTime();
+
+        if (now >= self->deadline) {
+            break;
+        }
+
+        if (self->deadline == DBL_MAX) {
+            glfwWaitEvents();
+        }
+        else {
+            glfwWaitEventsTimeout(self->deadline - now);
+        }
+    }
+
+    atomic_store(&self->dirty, false);
+    self->deadline = DBL_MAX;
+
+    return !glfwWindowShouldClose(window);
+}
+
+void window_invalidate(GLFWwindow* window) {
+    frame_scheduler_t* scheduler = (frame_scheduler_t*)glfwGetWindowUserPointer(window);
+
+    if (scheduler) {
+        frame_scheduler_invalidate(scheduler);
+    }
+}
+
 
 void glfw_error_callback(int error, const char* description) {
     puts("GLFW Error:");
@@ -1393,32 +9544,42 @@ void glfw_window_pos_callback(GLFWwindow* window, int xpos, int ypos) {
 }
 
 void glfw_window_size_callback(GLFWwindow* window, int width, int height) {
+    window_invalidate(window);
 }
 
 void glfw_window_close_callback(GLFWwindow* window) {
 }
 
 void glfw_window_refresh_callback(GLFWwindow* window) {
+    window_invalidate(window);
 }
 
 void glfw_window_focus_callback(GLFWwindow* window, int focused) {
+    window_invalidate(window);
 }
 
 void glfw_window_iconify_callback(GLFWwindow* window, int iconified) {
+    window_invalidate(window);
 }
 
 void glfw_window_maximize_callback(GLFWwindow* window, int maximized) {
+    window_invalidate(window);
 }
 
 void glfw_framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
     gl_debug();
+
+    window_invalidate(window);
 }
 
 void glfw_window_content_scale_callback(GLFWwindow* window, float xscale, float yscale) {
+    window_invalidate(window);
 }
 
 void glfw_key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    window_invalidate(window);
+
     // printf("key: %i\n", key);
     // printf("scancode: %i\n", scancode);
     // printf("action: %i\n", action);
@@ -1435,15 +9596,19 @@ void glfw_key_callback(GLFWwindow* window, int key, int scancode, int action, in
 }
 
 void glfw_char_callback(GLFWwindow* window, unsigned int codepoint) {
+    window_invalidate(window);
 }
 
 void glfw_char_mods_callback(GLFWwindow* window, unsigned int codepoint, int mods) {
 }
 
 void glfw_mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
+    window_invalidate(window);
 }
 
 void glfw_cursor_pos_callback(GLFWwindow* window, double xpos, double ypos) {
+    window_invalidate(window);
+
     // int width = 0;
     // int height = 0;
 
@@ -1478,12 +9643,15 @@ void glfw_cursor_pos_callback(GLFWwindow* window, double xpos, double ypos) {
 }
 
 void glfw_cursor_enter_callback(GLFWwindow* window, int entered) {
+    window_invalidate(window);
 }
 
 void glfw_scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
+    window_invalidate(window);
 }
 
 void glfw_drop_callback(GLFWwindow* window, int count, const char** names) {
+    window_invalidate(window);
 }
 
 void glfw_joystick_callback(int jid, int event) {
@@ -1567,7 +9735,8 @@ GLFWwindow* window_create_opengl() {
     GLFWwindow* result = NULL;
 
     if (glfwInit()) {
-        const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+        GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+        const GLFWvidmode* mode = monitor ? glfwGetVideoMode(monitor) : NULL;
 
         glfwSetErrorCallback(glfw_error_callback);
         // glfwWindowHint(GLFW_SAMPLES, 16);
@@ -1575,12 +9744,15 @@ GLFWwindow* window_create_opengl() {
         // glfwWindowHint(GLFW_MAXIMIZED, GLFW_TRUE);
         glfwWindowHint(GLFW_TRANSPARENT_FRAMEBUFFER, GLFW_TRUE);
 
-        result = glfwCreateWindow(mode->width / 2, mode->height / 2, "Project", NULL, NULL);
+        // No monitor (a headless server or a disconnected display) - a fixed size at the default position
+        result = glfwCreateWindow(mode ? mode->width / 2 : 1280, mode ? mode->height / 2 : 720, "Project", NULL, NULL);
 
         if (result) {
             glfwMakeContextCurrent(result);
 
-            glfwSetWindowPos(result, mode->width / 4, mode->height / 4);
+            if (mode) {
+                glfwSetWindowPos(result, mode->width / 4, mode->height / 4);
+            }
 
             glfwSetMonitorCallback(glfw_monitor_callback);
             glfwSetWindowPosCallback(result, glfw_window_pos_callback);
@@ -1619,6 +9791,250 @@ GLFWwindow* window_create_opengl() {
 }
 
 
+// A hidden window for its context only, render into an offscreen_t. Without a display it takes GLFW's null platform
+// (GLFW 3.4) and tries the native, EGL and OSMesa context APIs in that order.
+GLFWwindow* window_create_headless(int width, int height) {
+    const int apis[] = { GLFW_NATIVE_CONTEXT_API, GLFW_EGL_CONTEXT_API, GLFW_OSMESA_CONTEXT_API };
+    GLFWwindow* result = NULL;
+
+#if defined(GLFW_PLATFORM_NULL)
+    if (!getenv("DISPLAY") && !getenv("WAYLAND_DISPLAY")) {
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    }
+#endif // GLFW_PLATFORM_NULL
+
+    if (!glfwInit()) {
+        return result;
+    }
+
+    glfwSetErrorCallback(glfw_error_callback);
+
+    for (unsigned int i = 0; !result && i < array_size(apis); ++i) {
+        glfwDefaultWindowHints();
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, apis[i]);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+        result = glfwCreateWindow(width, height, "Project", NULL, NULL);
+    }
+
+    glfwDefaultWindowHints();
+
+    if (result) {
+        glfwMakeContextCurrent(result);
+
+        if (gl_load()) {
+            return result;
+        }
+
+        glfwDestroyWindow(result);
+        result = NULL;
+    }
+
+    glfwTerminate();
+
+    return result;
+}
+
+
+#define OFFSCREEN_READBACKS 3
+
+// A frame copied out of a readback buffer, owned by the encoder job that writes it
+typedef struct offscreen_frame_t {
+    uint8_t* pixels;
+    int width;
+    int height;
+    char file_name[256];
+} offscreen_frame_t;
+
+// A framebuffer frames are rendered into and read back without stalling: glReadPixels goes into one of
+// OFFSCREEN_READBACKS persistently mapped pixel pack buffers and is picked up once that buffer comes around again.
+// PNG encoding runs on the encoders pool, so throughput is bound by rendering rather than by vsync or zlib.
+typedef struct offscreen_t {
+    GLuint framebuffer;
+    GLuint color;
+    GLuint depth;
+    GLsizei width;
+    GLsizei height;
+    GLuint buffers[OFFSCREEN_READBACKS];
+    uint8_t* pixels[OFFSCREEN_READBACKS];
+    GLsync fences[OFFSCREEN_READBACKS];
+    char file_names[OFFSCREEN_READBACKS][256];
+    GLsizei readback;
+    char pattern[256];
+    size_t frames_count;
+    job_pool_t encoders;
+} offscreen_t;
+
+// pattern is a printf format taking the frame number as size_t, e.g. "frames/%05zu.png"
+offscreen_t offscreen_create(GLsizei width, GLsizei height, const char* pattern) {
+    const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr size = (GLsizeiptr)width * height * 4;
+    offscreen_t result = {
+        .framebuffer = 0,
+        .color = 0,
+        .depth = 0,
+        .width = width,
+        .height = height,
+        .buffers = { 0 },
+        .pixels = { NULL },
+        .fences = { NULL },
+        .readback = 0,
+        .frames_count = 0,
+        .encoders = job_pool_create(0)
+    };
+
+    snprintf(result.pattern, sizeof(result.pattern), "%s", pattern);
+
+    glCreateRenderbuffers(1, &result.color);
+    gl_debug();
+    glNamedRenderbufferStorage(result.color, GL_RGBA8, width, height);
+    gl_debug();
+    glCreateRenderbuffers(1, &result.depth);
+    gl_debug();
+    glNamedRenderbufferStorage(result.depth, GL_DEPTH24_STENCIL8, width, height);
+    gl_debug();
+
+    glCreateFramebuffers(1, &result.framebuffer);
+    gl_debug();
+    glNamedFramebufferRenderbuffer(result.framebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, result.color);
+    gl_debug();
+    glNamedFramebufferRenderbuffer(result.framebuffer, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, result.depth);
+    gl_debug();
+    glNamedFramebufferReadBuffer(result.framebuffer, GL_COLOR_ATTACHMENT0);
+    gl_debug();
+
+    if (glCheckNamedFramebufferStatus(result.framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        puts("Offscreen framebuffer is incomplete");
+    }
+
+    glCreateBuffers(OFFSCREEN_READBACKS, result.buffers);
+    gl_debug();
+
+    for (int i = 0; i < OFFSCREEN_READBACKS; ++i) {
+        glNamedBufferStorage(result.buffers[i], size, NULL, flags);
+        gl_debug();
+        result.pixels[i] = (uint8_t*)glMapNamedBufferRange(result.buffers[i], 0, size, flags);
+        gl_debug();
+    }
+
+    return result;
+}
+
+void offscreen_encode_job(void* data) {
+    offscreen_frame_t* frame = (offscreen_frame_t*)data;
+
+    if (!stbi_write_png(frame->file_name, frame->width, frame->height, 4, frame->pixels, frame->width * 4)) {
+        printf("%s is not written\n", frame->file_name);
+    }
+
+    free(frame->pixels);
+    free(frame);
+}
+
+// Waits for the readback, copies it flipped to top-down rows and hands it to an encoder
+void offscreen_collect(offscreen_t* self, GLsizei readback) {
+    size_t row = (size_t)self->width * 4;
+
+    if (!self->fences[readback]) {
+        return;
+    }
+
+    while (glClientWaitSync(self->fences[readback], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+    }
+
+    gl_debug();
+    glDeleteSync(self->fences[readback]);
+    gl_debug();
+    self->fences[readback] = NULL;
+
+    offscreen_frame_t* frame = (offscreen_frame_t*)malloc(sizeof(offscreen_frame_t));
+    uint8_t* pixels = (uint8_t*)malloc(row * (size_t)self->height);
+
+    if (!frame || !pixels || !self->pixels[readback]) {
+        printf("%s is dropped\n", self->file_names[readback]);
+        free(frame);
+        free(pixels);
+        return;
+    }
+
+    for (GLsizei y = 0; y < self->height; ++y) {
+        memcpy(pixels + (size_t)y * row, self->pixels[readback] + (size_t)(self->height - 1 - y) * row, row);
+    }
+
+    *frame = (offscreen_frame_t) {
+        .pixels = pixels,
+        .width = self->width,
+        .height = self->height
+    };
+    memcpy(frame->file_name, self->file_names[readback], sizeof(frame->file_name));
+
+    job_pool_push(&self->encoders, offscreen_encode_job, frame);
+}
+
+// Draws until offscreen_end go into the framebuffer
+void offscreen_begin(offscreen_t* self) {
+    glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffer);
+    gl_debug();
+    glViewport(0, 0, self->width, self->height);
+    gl_debug();
+}
+
+// Queues the frame's readback and encodes the one issued OFFSCREEN_READBACKS - 1 frames ago
+void offscreen_end(offscreen_t* self) {
+    GLsizei readback = self->readback;
+
+    offscreen_collect(self, readback);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, self->buffers[readback]);
+    gl_debug();
+    glReadPixels(0, 0, self->width, self->height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    gl_debug();
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    gl_debug();
+
+    self->fences[readback] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gl_debug();
+
+    snprintf(self->file_names[readback], sizeof(self->file_names[readback]), self->pattern, self->frames_count);
+
+    self->readback = (readback + 1) % OFFSCREEN_READBACKS;
+    self->frames_count += 1;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    gl_debug();
+}
+
+// Encodes the frames still in flight and waits until every file is written
+void offscreen_finish(offscreen_t* self) {
+    for (GLsizei i = 0; i < OFFSCREEN_READBACKS; ++i) {
+        offscreen_collect(self, (self->readback + i) % OFFSCREEN_READBACKS);
+    }
+
+    job_pool_wait(&self->encoders);
+}
+
+void offscreen_destroy(offscreen_t* self) {
+    offscreen_finish(self);
+    job_pool_destroy(&self->encoders);
+
+    glDeleteBuffers(OFFSCREEN_READBACKS, self->buffers);
+    gl_debug();
+    glDeleteFramebuffers(1, &self->framebuffer);
+    gl_debug();
+    glDeleteRenderbuffers(1, &self->color);
+    gl_debug();
+    glDeleteRenderbuffers(1, &self->depth);
+    gl_debug();
+
+    *self = (offscreen_t) {
+        .framebuffer = 0
+    };
+}
+
+
 #include <AL/al.h>
 #include <AL/alc.h>
 
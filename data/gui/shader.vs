@@ -4,18 +4,66 @@ layout (location = 0) in vec3 a_position;
 layout (location = 1) in vec3 a_normal;
 layout (location = 2) in vec2 a_tex_coord;
 layout (location = 3) in vec4 a_color;
-layout (location = 4) in vec3 a_tangent;
-layout (location = 5) in vec3 a_bitangent;
+layout (location = 4) in vec4 a_tangent;
+layout (location = 5) in uvec4 a_joints;
+layout (location = 6) in vec4 a_weights;
+layout (location = 7) in uint a_draw_id;
+
+layout (std430, binding = 0) readonly buffer joint_palette {
+    mat4 joint_matrices[];
+};
+
+layout (std430, binding = 1) readonly buffer draw_transforms {
+    mat4 draw_matrices[];
+};
+
+struct instance_t {
+    mat4 matrix;
+    vec4 color;
+};
+
+layout (std430, binding = 2) readonly buffer instance_data {
+    instance_t instances[];
+};
 
 out vec2 tex_coord;
 out vec4 color;
+out vec3 normal;
+out vec3 tangent;
+out vec3 bitangent;
 
 uniform mat4 projection;
 uniform mat4 view;
 uniform mat4 model;
+uniform int joints_offset = -1;
+uniform bool draw_indirect = false;
+uniform bool instanced = false;
 
 void main() {
-    gl_Position = projection * view * model * vec4(a_position, 1.0);
+    mat4 skin = mat4(1.0);
+
+    if (joints_offset >= 0) {
+        skin = a_weights.x * joint_matrices[joints_offset + int(a_joints.x)] +
+            a_weights.y * joint_matrices[joints_offset + int(a_joints.y)] +
+            a_weights.z * joint_matrices[joints_offset + int(a_joints.z)] +
+            a_weights.w * joint_matrices[joints_offset + int(a_joints.w)];
+    }
+
+    mat4 base_model = model;
+
+    if (draw_indirect) {
+        base_model = draw_matrices[a_draw_id];
+    }
+    else if (instanced) {
+        base_model = instances[gl_InstanceID].matrix;
+    }
+
+    mat4 skinned_model = base_model * skin;
+
+    gl_Position = projection * view * skinned_model * vec4(a_position, 1.0);
     tex_coord = a_tex_coord;
-    color = a_color;
+    color = instanced ? a_color * instances[gl_InstanceID].color : a_color;
+    normal = mat3(skinned_model) * a_normal;
+    tangent = mat3(skinned_model) * a_tangent.xyz;
+    bitangent = cross(normal, tangent) * a_tangent.w;
 }
@@ -11,6 +11,9 @@
 // Compilation and Launch:
 //   gcc main.c -std=c18 -Wall -Wconversion -lpthread -lglfw -lOpenGL -lopenal -ldl -lm -s -o main; ./main
 //
+// Headless, renders 60 frames into frame_0000.png...:
+//   ./main --headless
+//
 // Other:
 //   -Wextra -Werror
 ////////////////////////////////////////
@@ -34,8 +37,28 @@
 
 
 int main(int argc, char** argv) {
-    GLFWwindow* window = window_create_opengl();
+    bool headless = argc > 1 && !strcmp(argv[1], "--headless");
+    GLFWwindow* window = headless ? window_create_headless(1280, 720) : window_create_opengl();
+
+    if (!window) {
+        puts("Failed to create a window");
+        return 1;
+    }
+
     camera_t camera = camera_initialize_2d();
+    simulation_t simulation = simulation_create(60.0, &camera, sizeof(camera), sizeof(uint32_t), camera_simulation_step, camera_simulation_blend, NULL);
+    offscreen_t offscreen = { .framebuffer = 0 };
+    frame_scheduler_t scheduler = frame_scheduler_create();
+    uint32_t previous_input = 0;
+
+    if (headless) {
+        offscreen = offscreen_create(1280, 720, "frame_%04zu.png");
+    }
+    else {
+        frame_scheduler_attach(&scheduler, window);
+    }
+
+    shader_compiler_t shader_compiler = shader_compiler_create(window);
 
     audio_device_t audio_device = audio_device_create();
     audio_buffer_t buffer = audio_buffer_create("data/resources/test.mp3");
@@ -46,12 +69,18 @@ int main(int argc, char** argv) {
         "data/resources/test.gif"
     };
 
-    object_t object = object_create(
+    object_t object = object_create_async(
+        &shader_compiler,
         "data/gui/shader.vs", NULL, "data/gui/shader.fs",
         NULL,
         textures, 2
     );
 
+    // Every headless frame is written out, so the first one must not be drawn before the program is linked
+    if (headless) {
+        shader_compiler_wait(&shader_compiler);
+    }
+
     {
         int window_width = 0;
         int window_height = 0;
@@ -69,23 +98,66 @@ int main(int argc, char** argv) {
     }
 
     audio_source_play(&source);
+    simulation_start(&simulation);
 
     while (!glfwWindowShouldClose(window)) {
+        if (headless) {
+            offscreen_begin(&offscreen);
+        }
+
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
         gl_debug();
 
-        camera_update(&camera, window);
+        uint32_t input = camera_input_poll(window);
+
+        simulation_set_input(&simulation, &input);
+        simulation_interpolate(&simulation, &camera);
+        camera_update_viewport(&camera, window);
 
         object_draw(&object, &camera);
 
         program_unuse();
         texture_unbind();
 
+        if (headless) {
+            offscreen_end(&offscreen);
+
+            if (offscreen.frames_count == 60) {
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+            }
+
+            glfwPollEvents();
+            continue;
+        }
+
         glfwSwapBuffers(window);
-        glfwPollEvents();
+
+        // Held keys keep the camera moving, after release a few ticks let the interpolation settle
+        if (input) {
+            frame_scheduler_invalidate(&scheduler);
+        }
+        else if (previous_input) {
+            frame_scheduler_schedule(&scheduler, glfwGetTime() + 3.0 * simulation.tick);
+        }
+
+        // Shaders still compiling show up once ready
+        if (!object_is_ready(&object)) {
+            frame_scheduler_schedule(&scheduler, glfwGetTime() + 0.1);
+        }
+
+        previous_input = input;
+
+        frame_scheduler_wait(&scheduler, window);
+    }
+
+    simulation_destroy(&simulation);
+
+    if (headless) {
+        offscreen_destroy(&offscreen);
     }
 
     object_destroy(&object);
+    shader_compiler_destroy(&shader_compiler);
 
     audio_source_destroy(&source);
     audio_buffer_destroy(&buffer);